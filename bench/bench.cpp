@@ -0,0 +1,223 @@
+/*
+    lol-bench: times every phase of the compiler separately
+
+    Usage: lol-bench [--repeat N] [-O<level>] [--commit <id>] [--json <file>] <a.lang> <b.lang> ...
+
+    Every file goes through the whole pipeline N times (lex only, parse, fold, codegen, optimize,
+    JIT compilation of main, execution of main) and the median time of each phase is reported.
+    The output of the programs goes to /dev/null.
+*/
+#include "node.hpp"
+#include "parser.hpp"
+#include "parsing_context.hpp"
+#include "codegen.hpp"
+#include "fold.hpp"
+
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/Support/TargetSelect.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+    const char *const kPhases[] = {"lex", "parse", "fold", "codegen", "optimize", "jit", "exec"};
+    constexpr std::size_t kPhasesCount = sizeof(kPhases) / sizeof(kPhases[0]);
+
+    struct Result {
+        std::string file;
+        std::size_t bytes = 0;
+        std::size_t tokens = 0;
+        std::vector<double> samples[kPhasesCount]; // seconds
+        double median[kPhasesCount] = {};
+    };
+
+    using codegen::unwrap;
+
+    class Stopwatch {
+    public:
+        double lap() {
+            auto now = std::chrono::steady_clock::now();
+            double seconds = std::chrono::duration<double>(now - last).count();
+            last = now;
+            return seconds;
+        }
+
+    private:
+        std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+    };
+
+    std::size_t LexOnly(const std::string &file) {
+        parsingcontext::ParsingContext ctx;
+        FILE *in = fopen(file.c_str(), "r");
+        if (!in) {
+            throw std::runtime_error("Can't open " + file);
+        }
+        yyscan_t scanner;
+        yylex_init_extra(&ctx, &scanner);
+        yyset_in(in, scanner);
+        YYSTYPE lval;
+        YYLTYPE lloc;
+        std::size_t tokens = 0;
+        while (yylex(&lval, &lloc, scanner) != 0) {
+            ++tokens;
+        }
+        yylex_destroy(scanner);
+        fclose(in);
+        return tokens;
+    }
+
+    int RunSilently(int (*mainPtr)()) {
+        std::fflush(stdout);
+        int saved = dup(STDOUT_FILENO);
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        close(devNull);
+        int ret = mainPtr();
+        std::fflush(stdout);
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+        return ret;
+    }
+
+    // one pass of the whole pipeline, appends a sample to every phase
+    void Measure(Result &result, unsigned optLevel) {
+        Stopwatch watch;
+        std::size_t i = 0;
+
+        result.tokens = LexOnly(result.file);
+        result.samples[i++].push_back(watch.lap());
+
+        parsingcontext::ParsingContext parsing;
+        codegen::CodeGenContext codegen;
+        codegen.astBlock = parsingcontext::ParseFile(result.file, parsing);
+        result.samples[i++].push_back(watch.lap());
+
+        AST::FoldConstants(*codegen.astBlock, parsing.arena);
+        result.samples[i++].push_back(watch.lap());
+
+        codegen.initTarget();
+        codegen.generateCode();
+        result.samples[i++].push_back(watch.lap());
+
+        codegen.optimize(optLevel);
+        result.samples[i++].push_back(watch.lap());
+
+        std::unique_ptr<llvm::orc::LLJIT> jit = codegen::CreateHostJIT();
+        unwrap(jit->addIRModule(llvm::orc::ThreadSafeModule(std::move(codegen.module), codegen.tsCtx)));
+        auto *mainPtr = reinterpret_cast<int (*)()>(unwrap(jit->lookup("main")).getAddress());
+        result.samples[i++].push_back(watch.lap());
+
+        RunSilently(mainPtr);
+        result.samples[i++].push_back(watch.lap());
+    }
+
+    double Median(std::vector<double> v) {
+        std::sort(v.begin(), v.end());
+        return v.empty() ? 0 : v[v.size() / 2];
+    }
+
+    void WriteJson(std::ostream &out, const std::vector<Result> &results, const std::string &commit,
+                   unsigned optLevel, unsigned repeat) {
+        out << "{\n  \"commit\": \"" << commit << "\",\n  \"optLevel\": " << optLevel
+            << ",\n  \"repeat\": " << repeat << ",\n  \"results\": [\n";
+        for (std::size_t r = 0; r < results.size(); ++r) {
+            const Result &res = results[r];
+            out << "    {\"file\": \"" << res.file << "\", \"bytes\": " << res.bytes
+                << ", \"tokens\": " << res.tokens << ", \"seconds\": {";
+            for (std::size_t p = 0; p < kPhasesCount; ++p) {
+                out << (p ? ", " : "") << "\"" << kPhases[p] << "\": " << std::setprecision(6) << res.median[p];
+            }
+            out << "}}" << (r + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+    }
+
+    void PrintTable(std::ostream &out, const std::vector<Result> &results) {
+        out << std::left << std::setw(28) << "file" << std::right << std::setw(10) << "MB/s lex";
+        for (const char *phase: kPhases) {
+            out << std::setw(11) << phase;
+        }
+        out << "   (ms)\n";
+        for (const Result &res: results) {
+            std::string name = res.file.substr(res.file.find_last_of('/') + 1);
+            double lexRate = res.median[0] > 0 ? res.bytes / res.median[0] / 1e6 : 0;
+            out << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(1)
+                << std::setw(10) << lexRate << std::setprecision(3);
+            for (double seconds: res.median) {
+                out << std::setw(11) << seconds * 1e3;
+            }
+            out << "\n";
+        }
+    }
+
+    std::string Usage() {
+        return "Usage: lol-bench [--repeat N] [-O<level>] [--commit <id>] [--json <file>] <a.lang> <b.lang> ...";
+    }
+}
+
+int main(int argc, char *argv[]) {
+    unsigned repeat = 5;
+    unsigned optLevel = 2;
+    std::string commit = "unknown";
+    std::string json;
+    std::vector<Result> results;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::max(1, std::atoi(argv[++i]));
+        } else if (arg.size() == 3 && arg[0] == '-' && arg[1] == 'O' && arg[2] >= '0' && arg[2] <= '3') {
+            optLevel = arg[2] - '0';
+        } else if (arg == "--commit" && i + 1 < argc) {
+            commit = argv[++i];
+        } else if (arg == "--json" && i + 1 < argc) {
+            json = argv[++i];
+        } else if (!arg.empty() && arg[0] == '-') {
+            std::cerr << Usage() << std::endl;
+            return 1;
+        } else {
+            results.emplace_back();
+            results.back().file = arg;
+        }
+    }
+    if (results.empty()) {
+        std::cerr << Usage() << std::endl;
+        return 1;
+    }
+
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+
+    try {
+        for (Result &res: results) {
+            std::ifstream in(res.file, std::ios::binary | std::ios::ate);
+            res.bytes = in ? std::size_t(in.tellg()) : 0;
+            for (unsigned r = 0; r < repeat; ++r) {
+                Measure(res, optLevel);
+            }
+            for (std::size_t p = 0; p < kPhasesCount; ++p) {
+                res.median[p] = Median(res.samples[p]);
+            }
+        }
+    } catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    PrintTable(std::cout, results);
+    if (!json.empty()) {
+        std::ofstream out(json);
+        WriteJson(out, results, commit, optLevel, repeat);
+    }
+    return 0;
+}
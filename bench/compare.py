@@ -0,0 +1,47 @@
+#!/usr/bin/env python3
+"""Compares two result files of lol-bench.
+
+Usage: compare.py <old.json> <new.json> [--threshold 1.10]
+
+Prints new/old time of every phase of every file present in both; exits with 1 when some phase got slower
+than threshold times and took more than a millisecond, so that noise on tiny phases is ignored.
+"""
+import argparse
+import json
+import sys
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compares two lol-bench result files")
+    parser.add_argument("old")
+    parser.add_argument("new")
+    parser.add_argument("--threshold", type=float, default=1.10)
+    args = parser.parse_args()
+
+    with open(args.old) as f:
+        old = json.load(f)
+    with open(args.new) as f:
+        new = json.load(f)
+
+    old_results = {r["file"]: r for r in old["results"]}
+    print("%s -> %s" % (old["commit"], new["commit"]))
+    regressed = False
+    for r in new["results"]:
+        base = old_results.get(r["file"])
+        if base is None:
+            continue
+        cells = []
+        for phase, seconds in r["seconds"].items():
+            before = base["seconds"].get(phase, 0)
+            ratio = seconds / before if before > 0 else 1.0
+            mark = ""
+            if ratio > args.threshold and seconds > 1e-3:
+                mark = "!"
+                regressed = True
+            cells.append("%s %.2fx%s" % (phase, ratio, mark))
+        print("%-24s %s" % (r["file"].split("/")[-1], "  ".join(cells)))
+    sys.exit(1 if regressed else 0)
+
+
+if __name__ == "__main__":
+    main()
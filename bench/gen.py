@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+"""Generator of synthetic L programs for the benchmarks.
+
+Every workload stresses one part of the compiler:
+    sequence    long straight-line code: lexer, parser, AST and IR size
+    nesting     deeply nested if/while blocks: parser stack, codegen recursion, CFG size
+    expression  a few huge expressions: expression parsing, type checking, instruction selection
+    fib_loop    hot loop in the style of tests/valid/fibonacci: JIT and execution
+    gcd_loop    hot nested loops in the style of tests/valid/gcd: JIT and execution
+
+Usage: gen.py <output dir> [--scale K] [--only name,name...]
+"""
+import argparse
+import os
+
+
+def sequence(scale):
+    n = 20000 * scale
+    lines = ["    Int v0 = 1;"]
+    for i in range(1, n):
+        lines.append("    Int v%d = v%d + %d;" % (i, i - 1, i % 97))
+        if i % 100 == 0:
+            lines.append("    v%d = v%d * 3 - v%d;" % (i, i, i // 2))
+            lines.append("    print v%d;" % i)
+    return lines
+
+
+def nesting(scale):
+    depth = 200 * scale
+    lines = ["    Int x = 0;", "    Int n = 0;"]
+    indent = "    "
+    for d in range(depth):
+        if d % 2 == 0:
+            lines.append("%sif (x <= %d) {" % (indent, d * 10))
+        else:
+            lines.append("%sInt c%d = 0;" % (indent, d))
+            lines.append("%swhile (c%d < 1) {" % (indent, d))
+        indent += "    "
+        lines.append("%sx = x + 1;" % indent)
+    lines.append("%sn = n + 1;" % indent)
+    for d in reversed(range(depth)):
+        if d % 2 == 1:
+            lines.append("%sc%d = c%d + 1;" % (indent, d, d))
+        indent = indent[:-4]
+        lines.append("%s}" % indent)
+    lines.append("    print x;")
+    lines.append("    print n;")
+    return lines
+
+
+def expression(scale):
+    lines = ["    Int a = 7;", "    Int b = 3;", "    Bool f = True;"]
+    ops = ["+", "-", "*"]
+    for k in range(40 * scale):
+        terms = []
+        for i in range(300):
+            var = "a" if i % 2 == 0 else "b"
+            terms.append("(%s %s %d)" % (var, ops[i % 3], i % 13 + 1))
+        lines.append("    Int e%d = %s;" % (k, " + ".join(terms)))
+        conds = ["(e%d > %d || a == %d)" % (k, i, i) for i in range(100)]
+        lines.append("    f = f && %s;" % " && ".join(conds))
+        lines.append("    print e%d;" % k)
+    lines.append("    print f;")
+    return lines
+
+
+def fib_loop(scale):
+    return [
+        "    Int rounds = %d;" % (200000 * scale),
+        "    Int sum = 0;",
+        "    while (rounds > 0) {",
+        "        Int x = rounds;",
+        "        Int y = 1;",
+        "        Int pos = 1;",
+        "        while (y < 1000000000) {",
+        "            Int next = x + y;",
+        "            x = y;",
+        "            y = next;",
+        "            pos = pos + 1;",
+        "        }",
+        "        sum = sum + y + pos;",
+        "        rounds = rounds - 1;",
+        "    }",
+        "    print sum;",
+    ]
+
+
+def gcd_loop(scale):
+    return [
+        "    Int i = 1;",
+        "    Int total = 0;",
+        "    while (i < %d) {" % (20000 * scale),
+        "        Int x = i * 7919;",
+        "        Int y = i + 104729;",
+        "        while (x != 0) {",
+        "            if (y < x) {",
+        "                Int tmp = y;",
+        "                y = x;",
+        "                x = tmp;",
+        "            }",
+        "            y = y - x;",
+        "        }",
+        "        total = total + y;",
+        "        i = i + 1;",
+        "    }",
+        "    print total;",
+    ]
+
+
+WORKLOADS = {
+    "sequence": sequence,
+    "nesting": nesting,
+    "expression": expression,
+    "fib_loop": fib_loop,
+    "gcd_loop": gcd_loop,
+}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generates synthetic .lang programs for lol-bench")
+    parser.add_argument("out", help="output directory")
+    parser.add_argument("--scale", type=int, default=1, help="size multiplier of every workload")
+    parser.add_argument("--only", default="", help="comma-separated list of workloads")
+    args = parser.parse_args()
+
+    names = args.only.split(",") if args.only else list(WORKLOADS)
+    os.makedirs(args.out, exist_ok=True)
+    for name in names:
+        if name not in WORKLOADS:
+            parser.error("unknown workload " + name)
+        body = WORKLOADS[name](args.scale)
+        with open(os.path.join(args.out, name + ".lang"), "w") as f:
+            f.write("main() {\n" + "\n".join(body) + "\n}\n")
+
+
+if __name__ == "__main__":
+    main()
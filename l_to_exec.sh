@@ -2,6 +2,4 @@
 # $1 -- source code, $2 - exec name
 make -j4
 
-build/lol-compiler "$1" "$2" # compiler automatically add suffix .ll
-llc "$2.ll"  
-clang -no-pie "$2.s" -o "$2"
+build/lol-compiler "$1" "$2" --emit=ll,exe # compiler automatically add suffix .ll
@@ -32,6 +32,13 @@ else
   echo "OK"
 fi
 
+./build/lol-compiler "$prefix/test5.lang" test >out.txt
+if [ -n "$(cmp "$prefix/out5.txt" out.txt)" ]; then
+  echo "FAILED"
+else
+  echo "OK"
+fi
+
 prefix="tests/error_handling/type_mismatch"
 
 ./build/lol-compiler "$prefix/test1.lang" test >out.txt
@@ -55,6 +62,13 @@ else
   echo "OK"
 fi
 
+./build/lol-compiler "$prefix/test4.lang" test >out.txt
+if [ -n "$(cmp "$prefix/out4.txt" out.txt)" ]; then
+  echo "FAILED"
+else
+  echo "OK"
+fi
+
 prefix="tests/error_handling/var_redeclaration"
 
 ./build/lol-compiler "$prefix/test1.lang" test >out.txt
@@ -71,6 +85,60 @@ else
   echo "OK"
 fi
 
+prefix="tests/error_handling/parallel"
+
+./build/lol-compiler "$prefix/test1.lang" test >out.txt
+if [ -n "$(cmp "$prefix/out1.txt" out.txt)" ]; then
+  echo "FAILED"
+else
+  echo "OK"
+fi
+
+./build/lol-compiler "$prefix/test2.lang" test >out.txt
+if [ -n "$(cmp "$prefix/out2.txt" out.txt)" ]; then
+  echo "FAILED"
+else
+  echo "OK"
+fi
+
+./build/lol-compiler "$prefix/test3.lang" test >out.txt
+if [ -n "$(cmp "$prefix/out3.txt" out.txt)" ]; then
+  echo "FAILED"
+else
+  echo "OK"
+fi
+
+prefix="tests/error_handling/scopes"
+
+./build/lol-compiler "$prefix/test1.lang" test >out.txt
+if [ -n "$(cmp "$prefix/out1.txt" out.txt)" ]; then
+  echo "FAILED"
+else
+  echo "OK"
+fi
+
+./build/lol-compiler "$prefix/test2.lang" test >out.txt
+if [ -n "$(cmp "$prefix/out2.txt" out.txt)" ]; then
+  echo "FAILED"
+else
+  echo "OK"
+fi
+
+prefix="tests/runtime_errors"
+
+# an operand that can trap at run time is kept by x*0, False && x and True || x
+for n in 1 2 3 4 5; do
+  for flags in "--no-fold" "" "--exec=vm" "--peval"; do
+    # shellcheck disable=SC2086
+    ./build/lol-compiler "$prefix/test$n.lang" test --exec $flags >out.txt 2>&1
+    if [ $? -eq 0 ] || [ -n "$(cmp "$prefix/out$n.txt" out.txt)" ]; then
+      echo "FAILED"
+    else
+      echo "OK"
+    fi
+  done
+done
+
 prefix="tests/valid/factorial"
 
 ./l_to_exec.sh "$prefix/factorial.lang" test >out.txt
@@ -124,4 +192,255 @@ if [ -n "$(cmp "$prefix/out.txt" out.txt)" ]; then
   echo "FAILED"
 else
   echo "OK"
-fi
\ No newline at end of file
+fi
+
+prefix="tests/valid/pow"
+
+./l_to_exec.sh "$prefix/pow.lang" test >out.txt
+# shellcheck disable=SC2065
+./test >out.txt
+if [ -n "$(cmp "$prefix/out.txt" out.txt)" ]; then
+  echo "FAILED"
+else
+  echo "OK"
+fi
+prefix="tests/valid/strings"
+
+./l_to_exec.sh "$prefix/strings.lang" test >out.txt
+# shellcheck disable=SC2065
+./test >out.txt
+if [ -n "$(cmp "$prefix/out.txt" out.txt)" ]; then
+  echo "FAILED"
+else
+  echo "OK"
+fi
+prefix="tests/valid/print"
+
+./l_to_exec.sh "$prefix/print.lang" test >out.txt
+# shellcheck disable=SC2065
+./test >out.txt
+if [ -n "$(cmp "$prefix/out.txt" out.txt)" ]; then
+  echo "FAILED"
+else
+  echo "OK"
+fi
+prefix="tests/valid/loops"
+
+./l_to_exec.sh "$prefix/loops.lang" test >out.txt
+# shellcheck disable=SC2065
+./test >out.txt
+if [ -n "$(cmp "$prefix/out.txt" out.txt)" ]; then
+  echo "FAILED"
+else
+  echo "OK"
+fi
+prefix="tests/valid/arrays"
+
+./l_to_exec.sh "$prefix/arrays.lang" test >out.txt
+# shellcheck disable=SC2065
+./test >out.txt
+if [ -n "$(cmp "$prefix/out.txt" out.txt)" ]; then
+  echo "FAILED"
+else
+  echo "OK"
+fi
+prefix="tests/valid/parallel"
+
+./l_to_exec.sh "$prefix/parallel.lang" test >out.txt
+# shellcheck disable=SC2065
+./test >out.txt
+if [ -n "$(cmp "$prefix/out.txt" out.txt)" ]; then
+  echo "FAILED"
+else
+  echo "OK"
+fi
+# parallel for on a pool of threads however many CPUs there are, with chunks small enough to be stolen
+for grain in 1 1000; do
+  ./build/lol-compiler "$prefix/parallel.lang" test -O2 --threads=4 --grain=$grain --exec >out.txt
+  if [ -n "$(cmp "$prefix/out.txt" out.txt)" ]; then
+    echo "FAILED"
+  else
+    echo "OK"
+  fi
+done
+prefix="tests/valid/scopes"
+
+./l_to_exec.sh "$prefix/scopes.lang" test >out.txt
+# shellcheck disable=SC2065
+./test >out.txt
+if [ -n "$(cmp "$prefix/out.txt" out.txt)" ]; then
+  echo "FAILED"
+else
+  echo "OK"
+fi
+# --profile: the hits of every line (the times differ from run to run)
+prefix="tests/valid/gcd"
+./build/lol-compiler "$prefix/gcd.lang" test --profile 2>&1 >/dev/null | awk 'NR > 2 { print $1, $2 }' >out.txt
+if [ -n "$(cmp "$prefix/profile.txt" out.txt)" ]; then
+  echo "FAILED"
+else
+  echo "OK"
+fi
+# profile-guided optimization: two runs of the instrumented program, then a build that uses their profile
+prefix="tests/valid/nested"
+rm -f test.prof
+./build/lol-compiler "$prefix/nested.lang" test --emit=exe --pgo-gen=test.prof
+./test >out.txt
+./test >out.txt
+./build/lol-compiler "$prefix/nested.lang" test --emit=exe -O2 --pgo-use=test.prof
+./test >out.txt
+if [ -n "$(cmp "$prefix/out.txt" out.txt)" ] || ! grep -q "^runs 2$" test.prof; then
+  echo "FAILED"
+else
+  echo "OK"
+fi
+# the same branch sites one line further down are another program
+shifted="$(mktemp /tmp/lol-test-XXXXXX.lang)"
+{ echo; cat "$prefix/nested.lang"; } >"$shifted"
+if ./build/lol-compiler "$shifted" test --emit=exe -O2 --pgo-use=test.prof >out.txt 2>&1 ||
+   ! grep -q "The profile does not match the program" out.txt; then
+  echo "FAILED"
+else
+  echo "OK"
+fi
+rm -f test.prof "$shifted"
+# partial evaluation: gcd is reduced to its print, the programs give the same output with any budget
+prefix="tests/valid/gcd"
+./build/lol-compiler "$prefix/gcd.lang" test --peval >out.txt
+if [ -n "$(cmp "$prefix/out.txt" <(./build/lol-compiler "$prefix/gcd.lang" test --peval --exec))" ] || grep -q "br " test.ll; then
+  echo "FAILED"
+else
+  echo "OK"
+fi
+for name in factorial fibonacci gcd nested sqrt pow strings print loops arrays parallel scopes; do
+  prefix="tests/valid/$name"
+  for fuel in 1000000 100; do
+    ./build/lol-compiler "$prefix/$name.lang" test -O2 --peval=$fuel --exec >out.txt
+    if [ -n "$(cmp "$prefix/out.txt" out.txt)" ]; then
+      echo "FAILED"
+    else
+      echo "OK"
+    fi
+  done
+done
+# the same programs on the bytecode interpreter, with and without promotion of hot loops
+for name in factorial fibonacci gcd nested sqrt pow strings print loops arrays parallel scopes; do
+  prefix="tests/valid/$name"
+  for threshold in 0 1; do
+    ./build/lol-compiler "$prefix/$name.lang" --exec=vm --jit-threshold=$threshold >out.txt
+    if [ -n "$(cmp "$prefix/out.txt" out.txt)" ]; then
+      echo "FAILED"
+    else
+      echo "OK"
+    fi
+  done
+done
+# the same programs and errors generated statement by statement while they are parsed
+for name in factorial fibonacci gcd nested sqrt pow strings print loops arrays parallel scopes; do
+  prefix="tests/valid/$name"
+  for level in -O0 -O2; do
+    ./build/lol-compiler "$prefix/$name.lang" test $level --stream --exec >out.txt
+    if [ -n "$(cmp "$prefix/out.txt" out.txt)" ]; then
+      echo "FAILED"
+    else
+      echo "OK"
+    fi
+  done
+done
+for prefix in tests/error_handling/*; do
+  for i in 1 2 3 4 5; do
+    [ -f "$prefix/test$i.lang" ] || continue
+    ./build/lol-compiler "$prefix/test$i.lang" test --stream >out.txt
+    if [ -n "$(cmp "$prefix/out$i.txt" out.txt)" ]; then
+      echo "FAILED"
+    else
+      echo "OK"
+    fi
+  done
+done
+# the same programs outlined into regions and compiled as partitions on several threads
+for name in factorial fibonacci gcd nested sqrt pow strings print loops arrays parallel scopes; do
+  prefix="tests/valid/$name"
+  ./build/lol-compiler "$prefix/$name.lang" test --emit=exe -O2 --split=4 --outline=1
+  ./test >out.txt
+  if [ -n "$(cmp "$prefix/out.txt" out.txt)" ]; then
+    echo "FAILED"
+  else
+    echo "OK"
+  fi
+done
+prefix="tests/valid/loops"
+./build/lol-compiler "$prefix/loops.lang" test --emit=ll,obj --split=2 --outline=1
+if ! grep -q "^define .*@main.region" test.ll || ! nm test.o | grep -q " T main.region"; then
+  echo "FAILED"
+else
+  echo "OK"
+fi
+rm -f test.o
+# the same programs and errors through the compile server
+socket="$(mktemp -u /tmp/lol-test-XXXXXX.sock)"
+./build/lol-compiler --serve="$socket" &
+for i in $(seq 50); do [ -S "$socket" ] && break; sleep 0.1; done
+for name in factorial fibonacci gcd nested sqrt pow strings print loops arrays parallel scopes; do
+  prefix="tests/valid/$name"
+  ./build/lol-compiler --connect="$socket" run -O2 "$prefix/$name.lang" >out.txt
+  if [ -n "$(cmp "$prefix/out.txt" out.txt)" ]; then
+    echo "FAILED"
+  else
+    echo "OK"
+  fi
+done
+# a program that stops with an error ends its own process, the server answers the next request
+prefix="tests/runtime_errors"
+for n in 1 2 3 4 5; do
+  ./build/lol-compiler --connect="$socket" run "$prefix/test$n.lang" >out.txt 2>&1
+  if [ $? -ne 1 ] || [ -n "$(cmp "$prefix/out$n.txt" out.txt)" ]; then
+    echo "FAILED"
+  else
+    echo "OK"
+  fi
+  ./build/lol-compiler --connect="$socket" run tests/valid/gcd/gcd.lang >out.txt
+  if [ -n "$(cmp tests/valid/gcd/out.txt out.txt)" ]; then
+    echo "FAILED"
+  else
+    echo "OK"
+  fi
+done
+for prefix in tests/error_handling/*; do
+  for i in 1 2 3 4 5; do
+    [ -f "$prefix/test$i.lang" ] || continue
+    ./build/lol-compiler --connect="$socket" check "$prefix/test$i.lang" >out.txt
+    if [ -n "$(cmp "$prefix/out$i.txt" out.txt)" ]; then
+      echo "FAILED"
+    else
+      echo "OK"
+    fi
+  done
+done
+./build/lol-compiler --connect="$socket" shutdown
+wait
+# the scanner generated from lexer.l gives the same tokens and errors as the hand-written one
+if command -v flex >/dev/null; then
+  mkdir -p build/flex
+  make -s -j4 LEXER=flex BUILDDIR=build/flex build/flex/lol-compiler
+  for prefix in tests/error_handling/*; do
+    for i in 1 2 3 4 5; do
+      [ -f "$prefix/test$i.lang" ] || continue
+      ./build/flex/lol-compiler "$prefix/test$i.lang" test >out.txt
+      if [ -n "$(cmp "$prefix/out$i.txt" out.txt)" ]; then
+        echo "FAILED"
+      else
+        echo "OK"
+      fi
+    done
+  done
+  for name in factorial fibonacci gcd nested sqrt pow strings print loops arrays parallel scopes; do
+    prefix="tests/valid/$name"
+    ./build/flex/lol-compiler "$prefix/$name.lang" test --exec >out.txt
+    if [ -n "$(cmp "$prefix/out.txt" out.txt)" ]; then
+      echo "FAILED"
+    else
+      echo "OK"
+    fi
+  done
+fi
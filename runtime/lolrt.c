@@ -0,0 +1,556 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+
+#include "lolrt.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct lol_chunk {
+    struct lol_chunk *next;
+    size_t size;
+    size_t used;
+    _Alignas(16) char data[];
+} lol_chunk;
+
+enum {
+    kChunkSize = 64 * 1024,
+    kMinBuffer = 32,
+    kChunksPerThread = 8, // of a parallel for without a grain size
+};
+
+static _Thread_local lol_chunk *chunks; // the current chunk first
+
+static void free_chunks(void) {
+    while (chunks) {
+        lol_chunk *next = chunks->next;
+        free(chunks);
+        chunks = next;
+    }
+}
+
+static size_t align16(size_t size) {
+    return (size + 15) & ~(size_t) 15;
+}
+
+static lol_chunk *new_chunk(size_t size) {
+    lol_chunk *chunk = malloc(sizeof(lol_chunk) + size);
+    if (!chunk) {
+        fputs("Out of memory\n", stderr);
+        abort();
+    }
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+void *lol_alloc(size_t size) {
+    size = align16(size);
+    if (chunks && chunks->used + size <= chunks->size) {
+        void *p = chunks->data + chunks->used;
+        chunks->used += size;
+        return p;
+    }
+    if (size > kChunkSize / 4) {
+        // a big block gets its own chunk behind the current one, which keeps its free space
+        lol_chunk *chunk = new_chunk(size);
+        chunk->used = size;
+        if (chunks) {
+            chunk->next = chunks->next;
+            chunks->next = chunk;
+        } else {
+            chunk->next = NULL;
+            chunks = chunk;
+        }
+        return chunk->data;
+    }
+    lol_chunk *chunk = new_chunk(kChunkSize);
+    chunk->next = chunks;
+    chunks = chunk;
+    chunk->used = size;
+    return chunk->data;
+}
+
+const lol_string *lol_string_concat(const lol_string *lhs, const lol_string *rhs) {
+    if (rhs->length == 0) {
+        return lhs;
+    }
+    if (lhs->length == 0) {
+        return rhs;
+    }
+    size_t length = lhs->length + rhs->length;
+    lol_string *result = lol_alloc(sizeof(lol_string));
+    lol_buffer *buffer = lhs->buffer;
+    if (buffer && buffer->owner == &chunks && lhs->data + lhs->length == buffer->data + buffer->used &&
+        buffer->capacity - buffer->used >= rhs->length) {
+        // nobody has appended to lhs yet: it stays a prefix of the buffer, the result takes the free space after it
+        memcpy(buffer->data + buffer->used, rhs->data, rhs->length);
+        buffer->used += rhs->length;
+        result->data = lhs->data;
+    } else {
+        size_t capacity = length < kMinBuffer / 2 ? kMinBuffer : 2 * length;
+        buffer = lol_alloc(sizeof(lol_buffer) + capacity);
+        buffer->capacity = capacity;
+        buffer->used = length;
+        buffer->owner = &chunks;
+        memcpy(buffer->data, lhs->data, lhs->length);
+        memcpy(buffer->data + lhs->length, rhs->data, rhs->length);
+        result->data = buffer->data;
+    }
+    result->length = length;
+    result->buffer = buffer;
+    return result;
+}
+
+int32_t lol_string_equal(const lol_string *lhs, const lol_string *rhs) {
+    return lhs == rhs || (lhs->length == rhs->length && memcmp(lhs->data, rhs->data, lhs->length) == 0);
+}
+
+const lol_array *lol_array_new(int64_t length, uint64_t elementSize) {
+    if (length < 0 || length > INT32_MAX) {
+        lol_finish();
+        fprintf(stderr, "Array length %lld is out of range\n", (long long) length);
+        exit(1);
+    }
+    // the elements start at the first 64-byte boundary after the header
+    size_t size = (size_t) length * elementSize;
+    char *block = lol_alloc(sizeof(lol_array) + 48 + size);
+    lol_array *array = (lol_array *) block;
+    char *data = (char *) (((uintptr_t) (block + sizeof(lol_array)) + 63) & ~(uintptr_t) 63);
+    memset(data, 0, size);
+    array->length = (uint64_t) length;
+    array->data = data;
+    return array;
+}
+
+void lol_array_index_error(int64_t index, uint64_t length) {
+    lol_finish();
+    fprintf(stderr, "Index %lld is out of the bounds of an array of length %llu\n", (long long) index,
+            (unsigned long long) length);
+    exit(1);
+}
+
+void lol_array_length_error(uint64_t lhs, uint64_t rhs) {
+    lol_finish();
+    fprintf(stderr, "Arrays of different lengths: %llu and %llu\n", (unsigned long long) lhs,
+            (unsigned long long) rhs);
+    exit(1);
+}
+
+void lol_division_error(int32_t lhs, int32_t rhs) {
+    lol_finish();
+    if (rhs == 0) {
+        fprintf(stderr, "Division of %d by zero\n", (int) lhs);
+    } else {
+        fprintf(stderr, "Division of %d by %d overflows Int\n", (int) lhs, (int) rhs);
+    }
+    exit(1);
+}
+
+// everything print writes goes here first and to stdout in big blocks
+static char out[1 << 16];
+static size_t outUsed;
+
+static void flush_output(void) {
+    fwrite(out, 1, outUsed, stdout);
+    outUsed = 0;
+    fflush(stdout);
+}
+
+// room for size more bytes, size <= sizeof(out)
+static char *reserve(size_t size) {
+    if (sizeof(out) - outUsed < size) {
+        flush_output();
+    }
+    return out + outUsed;
+}
+
+static void write_bytes(const char *data, size_t size) {
+    if (size > sizeof(out)) {
+        flush_output();
+        fwrite(data, 1, size, stdout);
+        return;
+    }
+    memcpy(reserve(size), data, size);
+    outUsed += size;
+}
+
+static const char digitPairs[201] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+void lol_print_int(int32_t value) {
+    // 10 digits, the sign and the newline
+    char *p = reserve(12);
+    uint32_t n = (uint32_t) value;
+    if (value < 0) {
+        *p++ = '-';
+        n = 0u - n;
+    }
+    char digits[10];
+    char *d = digits + sizeof(digits);
+    while (n >= 100) {
+        d -= 2;
+        memcpy(d, digitPairs + 2 * (n % 100), 2);
+        n /= 100;
+    }
+    if (n >= 10) {
+        d -= 2;
+        memcpy(d, digitPairs + 2 * n, 2);
+    } else {
+        *--d = (char) ('0' + n);
+    }
+    size_t length = (size_t) (digits + sizeof(digits) - d);
+    memcpy(p, d, length);
+    p[length] = '\n';
+    outUsed = (size_t) (p + length + 1 - out);
+}
+
+void lol_print_bool(int32_t value) {
+    if (value) {
+        write_bytes("True\n", 5);
+    } else {
+        write_bytes("False\n", 6);
+    }
+}
+
+void lol_print_string(const lol_string *s) {
+    write_bytes("\"", 1);
+    write_bytes(s->data, s->length);
+    write_bytes("\"\n", 2);
+}
+
+void lol_print_int_array(const lol_array *a) {
+    const int32_t *data = a->data;
+    write_bytes("[", 1);
+    for (uint64_t i = 0; i < a->length; ++i) {
+        if (i) {
+            write_bytes(", ", 2);
+        }
+        lol_print_int(data[i]);
+        --outUsed; // the newline
+    }
+    write_bytes("]\n", 2);
+}
+
+void lol_print_bool_array(const lol_array *a) {
+    const uint8_t *data = a->data;
+    write_bytes("[", 1);
+    for (uint64_t i = 0; i < a->length; ++i) {
+        if (i) {
+            write_bytes(", ", 2);
+        }
+        if (data[i]) {
+            write_bytes("True", 4);
+        } else {
+            write_bytes("False", 5);
+        }
+    }
+    write_bytes("]\n", 2);
+}
+
+// the pool of the parallel loops: worker 0 is the thread that calls lol_parallel_for, the others are started on
+// demand and wait for the next job. A job is split into chunks of grain iterations; each worker has a range
+// [lo, hi) of chunk numbers packed into one word, takes chunks from its front and, when it is empty, takes the
+// upper half of the range of another worker
+typedef struct {
+    _Alignas(64) _Atomic uint64_t range; // lo << 32 | hi
+} lol_worker;
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t start; // a new job
+    pthread_cond_t done; // the last started worker left the job
+    unsigned threads; // started workers
+    unsigned capacity; // of workers
+    lol_worker *workers;
+    uint64_t generation; // of the current job
+    unsigned participants; // workers of the job, the caller included
+    unsigned running; // started workers still in the job
+    lol_parallel_body body;
+    void *context;
+    int64_t begin, end, grain;
+} pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+static pthread_mutex_t reductions = PTHREAD_MUTEX_INITIALIZER;
+
+static _Thread_local int inParallel; // the thread runs a body
+
+static int take_chunk(unsigned self, uint64_t *chunk) {
+    _Atomic uint64_t *range = &pool.workers[self].range;
+    uint64_t r = atomic_load(range);
+    while ((uint32_t) (r >> 32) < (uint32_t) r) {
+        if (atomic_compare_exchange_weak(range, &r, r + ((uint64_t) 1 << 32))) {
+            *chunk = r >> 32;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int steal_chunk(unsigned self, uint64_t *chunk) {
+    for (unsigned i = 1; i < pool.participants; ++i) {
+        _Atomic uint64_t *range = &pool.workers[(self + i) % pool.participants].range;
+        uint64_t r = atomic_load(range);
+        uint32_t lo, hi;
+        while ((lo = (uint32_t) (r >> 32)) < (hi = (uint32_t) r)) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (atomic_compare_exchange_weak(range, &r, (uint64_t) lo << 32 | mid)) {
+                // only the owner installs a range, and its own one is empty
+                atomic_store(&pool.workers[self].range, (uint64_t) (mid + 1) << 32 | hi);
+                *chunk = mid;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void run_chunks(unsigned self) {
+    uint64_t chunk;
+    while (take_chunk(self, &chunk) || steal_chunk(self, &chunk)) {
+        int64_t first = pool.begin + (int64_t) chunk * pool.grain;
+        int64_t last = pool.end - first > pool.grain ? first + pool.grain : pool.end;
+        pool.body(pool.context, first, last);
+    }
+}
+
+static void *worker_main(void *arg) {
+    unsigned self = (unsigned) (uintptr_t) arg;
+    uint64_t seen = 0;
+    inParallel = 1;
+    pthread_mutex_lock(&pool.mutex);
+    for (;;) {
+        while (pool.generation == seen) {
+            pthread_cond_wait(&pool.start, &pool.mutex);
+        }
+        seen = pool.generation;
+        if (self >= pool.participants) {
+            continue;
+        }
+        pthread_mutex_unlock(&pool.mutex);
+        run_chunks(self);
+        free_chunks();
+        pthread_mutex_lock(&pool.mutex);
+        if (--pool.running == 0) {
+            pthread_cond_signal(&pool.done);
+        }
+    }
+    return NULL;
+}
+
+// called with the mutex held and no job running, returns how many workers there are
+static unsigned start_workers(unsigned wanted) {
+    if (pool.capacity < wanted) {
+        lol_worker *workers = aligned_alloc(_Alignof(lol_worker), wanted * sizeof(lol_worker));
+        if (!workers) {
+            return 1;
+        }
+        free(pool.workers);
+        pool.workers = workers;
+        pool.capacity = wanted;
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    while (pool.threads + 1 < wanted) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, worker_main, (void *) (uintptr_t) (pool.threads + 1))) {
+            break;
+        }
+        ++pool.threads;
+    }
+    pthread_attr_destroy(&attr);
+    return pool.threads + 1 < wanted ? pool.threads + 1 : wanted;
+}
+
+void lol_parallel_for(int64_t begin, int64_t end, int64_t grain, int32_t threads, lol_parallel_body body,
+                      void *context) {
+    if (begin >= end) {
+        return;
+    }
+    uint64_t n = (uint64_t) (end - begin);
+    uint64_t workers = threads > 0 ? (uint64_t) threads : 1;
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus > 0 ? (uint64_t) cpus : 1;
+    }
+    if (grain <= 0) {
+        grain = (int64_t) (n / (workers * kChunksPerThread));
+        grain = grain ? grain : 1;
+    }
+    uint64_t count = (n - 1) / (uint64_t) grain + 1;
+    if (count > UINT32_MAX) {
+        grain = (int64_t) ((n - 1) / UINT32_MAX + 1);
+        count = (n - 1) / (uint64_t) grain + 1;
+    }
+    workers = workers < count ? workers : count;
+    if (workers <= 1 || inParallel) {
+        body(context, begin, end);
+        return;
+    }
+
+    pthread_mutex_lock(&pool.mutex);
+    workers = start_workers((unsigned) workers);
+    if (workers <= 1) {
+        pthread_mutex_unlock(&pool.mutex);
+        body(context, begin, end);
+        return;
+    }
+    pool.body = body;
+    pool.context = context;
+    pool.begin = begin;
+    pool.end = end;
+    pool.grain = grain;
+    pool.participants = (unsigned) workers;
+    pool.running = (unsigned) workers - 1;
+    for (uint64_t w = 0; w < workers; ++w) {
+        atomic_store(&pool.workers[w].range, count * w / workers << 32 | count * (w + 1) / workers);
+    }
+    ++pool.generation;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.mutex);
+
+    inParallel = 1;
+    run_chunks(0);
+    inParallel = 0;
+
+    pthread_mutex_lock(&pool.mutex);
+    while (pool.running) {
+        pthread_cond_wait(&pool.done, &pool.mutex);
+    }
+    pthread_mutex_unlock(&pool.mutex);
+}
+
+void lol_parallel_lock(void) {
+    pthread_mutex_lock(&reductions);
+}
+
+void lol_parallel_unlock(void) {
+    pthread_mutex_unlock(&reductions);
+}
+
+void lol_profile_write(const char *path, uint64_t hash, const uint64_t *counters, uint64_t count) {
+    // the counts of earlier runs of the same program are added up, anything else in the file is replaced
+    uint64_t *total = calloc(count ? count : 1, sizeof(uint64_t));
+    uint64_t runs = 0;
+    FILE *in = fopen(path, "r");
+    if (in) {
+        unsigned long long oldHash, oldRuns, oldCount;
+        if (fscanf(in, "lol-profile 1\nhash %llx\nruns %llu\ncounters %llu\n", &oldHash, &oldRuns, &oldCount) == 3 &&
+            oldHash == hash && oldCount == count) {
+            uint64_t i = 0;
+            unsigned long long value;
+            while (i < count && fscanf(in, "%llu", &value) == 1) {
+                total[i++] = value;
+            }
+            runs = i == count ? oldRuns : 0;
+            if (i != count) {
+                memset(total, 0, count * sizeof(uint64_t));
+            }
+        }
+        fclose(in);
+    }
+
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "Can't write the profile to %s\n", path);
+        free(total);
+        return;
+    }
+    fprintf(out, "lol-profile 1\nhash %llx\nruns %llu\ncounters %llu\n", (unsigned long long) hash,
+            (unsigned long long) runs + 1, (unsigned long long) count);
+    for (uint64_t i = 0; i < count; ++i) {
+        fprintf(out, "%llu\n", (unsigned long long) (total[i] + counters[i]));
+    }
+    fclose(out);
+    free(total);
+}
+
+// the time since the last hit is charged to the line of the last hit
+static struct {
+    uint32_t lines;
+    uint64_t *hits;
+    uint64_t *nanos;
+    uint32_t current;
+    uint64_t since;
+} lineProfile;
+
+static uint64_t now_nanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+void lol_line_profile_begin(uint32_t lines) {
+    lineProfile.lines = lines;
+    lineProfile.hits = calloc(lines, sizeof(uint64_t));
+    lineProfile.nanos = calloc(lines, sizeof(uint64_t));
+    lineProfile.current = 0;
+    lineProfile.since = now_nanos();
+}
+
+void lol_line_profile_hit(uint32_t line) {
+    uint64_t now = now_nanos();
+    lineProfile.nanos[lineProfile.current] += now - lineProfile.since;
+    lineProfile.since = now;
+    lineProfile.current = line;
+    ++lineProfile.hits[line];
+}
+
+void lol_line_profile_report(const char *source) {
+    uint64_t end = now_nanos();
+    flush_output(); // what the program printed comes before the report
+    lineProfile.nanos[lineProfile.current] += end - lineProfile.since;
+
+    uint64_t total = 0;
+    for (uint32_t i = 1; i < lineProfile.lines; ++i) {
+        total += lineProfile.nanos[i];
+    }
+    fprintf(stderr, "Line profile of %s: %.3f ms\n", source, (double) total / 1e6);
+    fprintf(stderr, "%6s %12s %12s %7s  %s\n", "line", "hits", "time, ms", "%", "source");
+
+    FILE *in = fopen(source, "r");
+    char text[256];
+    for (uint32_t line = 1; line < lineProfile.lines; ++line) {
+        // the source is read along, the report shows the first part of long lines
+        int haveText = 0;
+        if (in && fgets(text, sizeof(text), in)) {
+            haveText = 1;
+            size_t length = strlen(text);
+            if (length && text[length - 1] == '\n') {
+                text[length - 1] = '\0';
+            } else {
+                int c;
+                while ((c = fgetc(in)) != EOF && c != '\n') {
+                }
+            }
+        }
+        if (!lineProfile.hits[line]) {
+            continue;
+        }
+        const char *shown = text;
+        while (haveText && (*shown == ' ' || *shown == '\t')) {
+            ++shown;
+        }
+        double nanos = (double) lineProfile.nanos[line];
+        fprintf(stderr, "%6u %12llu %12.3f %7.1f  %s\n", line, (unsigned long long) lineProfile.hits[line],
+                nanos / 1e6, total ? 100.0 * nanos / (double) total : 0.0, haveText ? shown : "");
+    }
+    if (in) {
+        fclose(in);
+    }
+    free(lineProfile.hits);
+    free(lineProfile.nanos);
+    lineProfile.hits = lineProfile.nanos = NULL;
+}
+
+void lol_finish(void) {
+    flush_output();
+    free_chunks();
+}
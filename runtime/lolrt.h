@@ -0,0 +1,122 @@
+/*
+    Runtime library of the compiled L programs
+
+    Linked into the compiler itself (the JIT and the bytecode VM call it in-process) and built as
+    build/liblolrt.a for the executables of --emit=exe. Plain C, so that cc can link it without a C++ runtime.
+
+    A String value is a pointer to an immutable lol_string. Memory of a program run comes from one arena,
+    freed all at once by lol_finish at the end of main. Concatenation appends in place when the left operand
+    ends where the used part of its buffer ends, so building a string in a loop is linear, not quadratic.
+
+    An array (Int[], Bool[]) is a pointer to an immutable lol_array header, whose elements are 64-byte aligned
+    and zeroed when it is created: int32_t for Int[], one byte 0 or 1 for Bool[]. Arrays come from the arena too.
+
+    print does not go through printf: the values are formatted right into a 64KB buffer, so a loop that prints
+    costs no format parsing or stdio locking per value.
+
+    One program runs at a time per process. The bodies of its parallel loops run on a pool of threads, started
+    on the first parallel loop and kept for the next ones; every thread allocates from an arena of its own, and
+    what a body allocates on a thread of the pool is freed when the thread leaves the loop (nothing it creates
+    can outlive the body, see AST::ParallelFor). Only the thread that allocated a buffer appends to it in place.
+*/
+#ifndef LOLRT_H
+#define LOLRT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+#define LOL_NORETURN [[noreturn]]
+extern "C" {
+#else
+#define LOL_NORETURN _Noreturn
+#endif
+
+typedef struct lol_buffer {
+    size_t capacity;
+    size_t used; // bytes of data taken by the strings sharing the buffer
+    const void *owner; // the arena of the thread that allocated it
+    char data[];
+} lol_buffer;
+
+// the layout is mirrored by the string constants of the codegen ({i8*, i64, i8*})
+typedef struct lol_string {
+    const char *data; // not NUL-terminated
+    uint64_t length;
+    lol_buffer *buffer; // NULL for constants
+} lol_string;
+
+// the layout is mirrored by the codegen ({i64, i8*}), which loads both fields as invariant
+typedef struct lol_array {
+    uint64_t length; // at most INT32_MAX, so that every element has an Int index
+    void *data;
+} lol_array;
+
+// memory that lives until lol_finish, 16-byte aligned
+void *lol_alloc(size_t size);
+
+const lol_string *lol_string_concat(const lol_string *lhs, const lol_string *rhs);
+
+// by contents
+int32_t lol_string_equal(const lol_string *lhs, const lol_string *rhs);
+
+// length elements of elementSize bytes, all zero; a negative or too big length ends the program
+const lol_array *lol_array_new(int64_t length, uint64_t elementSize);
+
+// the ends of the program for an index out of the bounds of an array and for an elementwise operation
+// or copy of arrays of different lengths, what was printed so far is written out first
+LOL_NORETURN void lol_array_index_error(int64_t index, uint64_t length);
+
+LOL_NORETURN void lol_array_length_error(uint64_t lhs, uint64_t rhs);
+
+// the end of the program for a division by zero and for INT_MIN / -1, which doesn't fit in Int
+LOL_NORETURN void lol_division_error(int32_t lhs, int32_t rhs);
+
+// print: one value and a newline into the output buffer of the run, written out when it is full or by lol_finish
+void lol_print_int(int32_t value);
+
+// True or False
+void lol_print_bool(int32_t value);
+
+// in double quotes, the way print has always shown strings
+void lol_print_string(const lol_string *s);
+
+// [1, 2, 3] and [True, False]
+void lol_print_int_array(const lol_array *a);
+
+void lol_print_bool_array(const lol_array *a);
+
+// a parallel for: runs the iterations [begin, end) of the body outlined by the codegen, context holds the variables
+typedef void (*lol_parallel_body)(void *context, int64_t begin, int64_t end);
+
+// runs body on [begin, end) split into chunks of grain iterations (0: about 8 chunks per thread) on threads
+// threads (0: one per CPU), the calling one among them; returns when all the chunks are done. Every thread starts
+// with an even share of the chunks and, when it runs out of them, steals half of what is left to another one.
+// A parallel for reached from a body runs on the thread that reached it
+void lol_parallel_for(int64_t begin, int64_t end, int64_t grain, int32_t threads, lol_parallel_body body,
+                      void *context);
+
+// a body takes it to add the results of its chunk to the reduction variables
+void lol_parallel_lock(void);
+
+void lol_parallel_unlock(void);
+
+// end of a run of a program compiled with --pgo-gen: adds counters to the profile in path (format in src/pgo.hpp)
+void lol_profile_write(const char *path, uint64_t hash, const uint64_t *counters, uint64_t count);
+
+// --profile: lines [1, lines) are counted, hit is called when the statement of line starts, the report of the
+// hits and time of every line, with the text of the line from source, goes to stderr at the end of main
+void lol_line_profile_begin(uint32_t lines);
+
+void lol_line_profile_hit(uint32_t line);
+
+void lol_line_profile_report(const char *source);
+
+// end of a program run: writes out the output buffer and frees the memory of the run
+void lol_finish(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
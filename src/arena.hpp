@@ -0,0 +1,116 @@
+/*
+    Bump allocator for AST nodes
+
+    All the nodes of one compilation unit are allocated from its arena and are released
+    in one shot when the arena is destroyed (or cleared), nodes never delete each other.
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace AST {
+    class Arena {
+    public:
+        Arena() = default;
+
+        Arena(const Arena &) = delete;
+
+        Arena &operator=(const Arena &) = delete;
+
+        ~Arena() {
+            destroyAll();
+        }
+
+        // destroys everything allocated so far, the first chunk is kept for the next allocations
+        void clear() {
+            destroyAll();
+            finalizers = nullptr;
+            if (chunks.empty()) {
+                return;
+            }
+            chunks.resize(1);
+            current = chunks.front().data.get();
+            end = current + chunks.front().size;
+            reserved = chunks.front().size;
+        }
+
+        void swap(Arena &other) noexcept {
+            std::swap(chunks, other.chunks);
+            std::swap(current, other.current);
+            std::swap(end, other.end);
+            std::swap(reserved, other.reserved);
+            std::swap(finalizers, other.finalizers);
+        }
+
+        void *allocate(std::size_t size, std::size_t align) {
+            auto cur = reinterpret_cast<std::uintptr_t>(current);
+            std::uintptr_t aligned = (cur + align - 1) & ~(std::uintptr_t(align) - 1);
+            if (!current || aligned + size > reinterpret_cast<std::uintptr_t>(end)) {
+                newChunk(size + align);
+                cur = reinterpret_cast<std::uintptr_t>(current);
+                aligned = (cur + align - 1) & ~(std::uintptr_t(align) - 1);
+            }
+            current = reinterpret_cast<char *>(aligned + size);
+            return reinterpret_cast<void *>(aligned);
+        }
+
+        template<class T, class... Args>
+        T *make(Args &&... args) {
+            void *place = allocate(sizeof(T), alignof(T));
+            T *object = new(place) T(std::forward<Args>(args)...);
+            if constexpr (!std::is_trivially_destructible_v<T>) {
+                auto *f = static_cast<Finalizer *>(allocate(sizeof(Finalizer), alignof(Finalizer)));
+                f->destroy = [](void *p) { static_cast<T *>(p)->~T(); };
+                f->object = object;
+                f->next = finalizers;
+                finalizers = f;
+            }
+            return object;
+        }
+
+        std::size_t bytesReserved() const {
+            return reserved;
+        }
+
+    private:
+        static constexpr std::size_t kChunkSize = 64 * 1024;
+
+        struct Finalizer {
+            void (*destroy)(void *);
+            void *object;
+            Finalizer *next;
+        };
+
+        struct Chunk {
+            std::unique_ptr<char[]> data;
+            std::size_t size;
+        };
+
+        void destroyAll() {
+            // reverse order of construction, the same as for automatic objects
+            for (Finalizer *f = finalizers; f; f = f->next) {
+                f->destroy(f->object);
+            }
+        }
+
+        void newChunk(std::size_t minSize) {
+            std::size_t size = minSize > kChunkSize ? minSize : kChunkSize;
+            chunks.push_back({std::unique_ptr<char[]>(new char[size]), size});
+            current = chunks.back().data.get();
+            end = current + size;
+            reserved += size;
+        }
+
+        std::vector<Chunk> chunks;
+        char *current = nullptr;
+        char *end = nullptr;
+        std::size_t reserved = 0;
+        Finalizer *finalizers = nullptr;
+    };
+}
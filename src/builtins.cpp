@@ -0,0 +1,286 @@
+#include "builtins.hpp"
+
+#include "node.hpp"
+
+#include <llvm/IR/IRBuilder.h>
+
+#include <limits>
+
+namespace {
+    llvm::Function *Declare(llvm::Module &module, const std::string &name, unsigned arity) {
+        llvm::Type *i32 = llvm::Type::getInt32Ty(module.getContext());
+        std::vector<llvm::Type *> params(arity, i32);
+        llvm::Function *f = llvm::Function::Create(llvm::FunctionType::get(i32, params, false),
+                                                   llvm::GlobalValue::InternalLinkage, name, &module);
+        f->addFnAttr(llvm::Attribute::NoUnwind);
+        f->addFnAttr(llvm::Attribute::ReadNone);
+        f->addFnAttr(llvm::Attribute::WillReturn);
+        return f;
+    }
+
+    void DefineAbs(llvm::Function *f) {
+        llvm::IRBuilder<> b(llvm::BasicBlock::Create(f->getContext(), "entry", f));
+        llvm::Value *x = f->getArg(0);
+        b.CreateRet(b.CreateSelect(b.CreateICmpSLT(x, b.getInt32(0)), b.CreateNeg(x), x));
+    }
+
+    void DefineMinMax(llvm::Function *f, bool isMin) {
+        llvm::IRBuilder<> b(llvm::BasicBlock::Create(f->getContext(), "entry", f));
+        llvm::Value *x = f->getArg(0), *y = f->getArg(1);
+        llvm::Value *less = b.CreateICmpSLT(x, y);
+        b.CreateRet(isMin ? b.CreateSelect(less, x, y) : b.CreateSelect(less, y, x));
+    }
+
+    // exponentiation by squaring, O(log n) multiplications
+    void DefinePow(llvm::Function *f) {
+        llvm::LLVMContext &ctx = f->getContext();
+        llvm::Value *base = f->getArg(0), *exp = f->getArg(1);
+        base->setName("base");
+        exp->setName("exp");
+
+        auto *entry = llvm::BasicBlock::Create(ctx, "entry", f);
+        auto *negative = llvm::BasicBlock::Create(ctx, "negative", f);
+        auto *loop = llvm::BasicBlock::Create(ctx, "loop", f);
+        auto *done = llvm::BasicBlock::Create(ctx, "done", f);
+
+        llvm::IRBuilder<> b(entry);
+        b.CreateCondBr(b.CreateICmpSLT(exp, b.getInt32(0)), negative, loop);
+
+        // 1 / base^exp: +-1 for base +-1, 0 for everything else
+        b.SetInsertPoint(negative);
+        llvm::Value *odd = b.CreateICmpNE(b.CreateAnd(exp, 1), b.getInt32(0));
+        llvm::Value *minusOne = b.CreateSelect(odd, b.getInt32(-1), b.getInt32(1));
+        llvm::Value *inverse = b.CreateSelect(b.CreateICmpEQ(base, b.getInt32(1)), b.getInt32(1),
+                                              b.CreateSelect(b.CreateICmpEQ(base, b.getInt32(-1)), minusOne,
+                                                             b.getInt32(0)));
+        b.CreateRet(inverse);
+
+        // result *= square for every set bit of the exponent, from the lowest one
+        b.SetInsertPoint(loop);
+        llvm::PHINode *result = b.CreatePHI(b.getInt32Ty(), 2, "result");
+        llvm::PHINode *square = b.CreatePHI(b.getInt32Ty(), 2, "square");
+        llvm::PHINode *bits = b.CreatePHI(b.getInt32Ty(), 2, "bits");
+        llvm::Value *setBit = b.CreateICmpNE(b.CreateAnd(bits, 1), b.getInt32(0));
+        llvm::Value *nextResult = b.CreateSelect(setBit, b.CreateMul(result, square), result, "next.result");
+        llvm::Value *nextSquare = b.CreateMul(square, square, "next.square");
+        llvm::Value *nextBits = b.CreateLShr(bits, 1, "next.bits");
+        b.CreateCondBr(b.CreateICmpEQ(nextBits, b.getInt32(0)), done, loop);
+        result->addIncoming(b.getInt32(1), entry);
+        result->addIncoming(nextResult, loop);
+        square->addIncoming(base, entry);
+        square->addIncoming(nextSquare, loop);
+        bits->addIncoming(exp, entry);
+        bits->addIncoming(nextBits, loop);
+
+        b.SetInsertPoint(done);
+        // exp = 0 runs the loop once with no bit set and returns 1
+        b.CreateRet(nextResult);
+    }
+
+    const char *KernelName(builtins::Kernel kernel) {
+        using builtins::Kernel;
+        switch (kernel) {
+            case Kernel::Add:
+                return "lol.array.add";
+            case Kernel::Sub:
+                return "lol.array.sub";
+            case Kernel::Mul:
+                return "lol.array.mul";
+            case Kernel::AddScalar:
+                return "lol.array.add.scalar";
+            case Kernel::SubScalar:
+                return "lol.array.sub.scalar";
+            case Kernel::ScalarSub:
+                return "lol.array.scalar.sub";
+            case Kernel::MulScalar:
+                return "lol.array.mul.scalar";
+            case Kernel::Sum:
+                return "lol.array.sum";
+            case Kernel::Min:
+                return "lol.array.min";
+            case Kernel::Max:
+                return "lol.array.max";
+            case Kernel::Fill:
+                return "lol.array.fill";
+        }
+        llvm_unreachable("KernelName: unknown kernel!");
+    }
+
+    // for (i = 0; i < n; ++i) acc = step(i, acc); returns acc, which is null for kernels without a result
+    void DefineLoop(llvm::Function *f, llvm::Value *n, llvm::Value *init,
+                    llvm::function_ref<llvm::Value *(llvm::IRBuilder<> &, llvm::Value *, llvm::Value *)> step) {
+        llvm::LLVMContext &ctx = f->getContext();
+        auto *entry = llvm::BasicBlock::Create(ctx, "entry", f);
+        auto *loop = llvm::BasicBlock::Create(ctx, "loop", f);
+        auto *done = llvm::BasicBlock::Create(ctx, "done", f);
+
+        llvm::IRBuilder<> b(entry);
+        b.CreateCondBr(b.CreateICmpEQ(n, b.getInt64(0)), done, loop);
+
+        b.SetInsertPoint(loop);
+        llvm::PHINode *i = b.CreatePHI(b.getInt64Ty(), 2, "i");
+        llvm::PHINode *acc = init ? b.CreatePHI(init->getType(), 2, "acc") : nullptr;
+        llvm::Value *next = step(b, i, acc);
+        llvm::Value *nextI = b.CreateNUWAdd(i, b.getInt64(1), "next.i");
+        b.CreateCondBr(b.CreateICmpEQ(nextI, n), done, loop);
+        i->addIncoming(b.getInt64(0), entry);
+        i->addIncoming(nextI, loop);
+        if (acc) {
+            acc->addIncoming(init, entry);
+            acc->addIncoming(next, loop);
+        }
+
+        b.SetInsertPoint(done);
+        if (!init) {
+            b.CreateRetVoid();
+            return;
+        }
+        llvm::PHINode *result = b.CreatePHI(init->getType(), 2, "result");
+        result->addIncoming(init, entry);
+        result->addIncoming(next, loop);
+        b.CreateRet(result);
+    }
+
+    llvm::Value *Element(llvm::IRBuilder<> &b, llvm::Value *base, llvm::Value *i) {
+        return b.CreateInBoundsGEP(b.getInt32Ty(), base, i);
+    }
+
+    llvm::Value *Load(llvm::IRBuilder<> &b, llvm::Value *base, llvm::Value *i) {
+        return b.CreateAlignedLoad(b.getInt32Ty(), Element(b, base, i), llvm::MaybeAlign(4));
+    }
+
+    void Store(llvm::IRBuilder<> &b, llvm::Value *v, llvm::Value *base, llvm::Value *i) {
+        b.CreateAlignedStore(v, Element(b, base, i), llvm::MaybeAlign(4));
+    }
+}
+
+namespace builtins {
+    llvm::Function *Get(llvm::Module &module, AST::Builtin fn) {
+        std::string name = std::string("lol.") + AST::BuiltinName(fn);
+        if (llvm::Function *f = module.getFunction(name)) {
+            return f;
+        }
+        llvm::Function *f = Declare(module, name, fn == AST::Builtin::Abs ? 1 : 2);
+        switch (fn) {
+            case AST::Builtin::Abs:
+                DefineAbs(f);
+                break;
+            case AST::Builtin::Min:
+                DefineMinMax(f, true);
+                break;
+            case AST::Builtin::Max:
+                DefineMinMax(f, false);
+                break;
+            case AST::Builtin::Pow:
+                f->addFnAttr(llvm::Attribute::InlineHint);
+                DefinePow(f);
+                break;
+        }
+        if (fn != AST::Builtin::Pow) {
+            f->addFnAttr(llvm::Attribute::AlwaysInline);
+        }
+        return f;
+    }
+
+    llvm::Function *GetKernel(llvm::Module &module, Kernel kernel) {
+        const char *name = KernelName(kernel);
+        if (llvm::Function *f = module.getFunction(name)) {
+            return f;
+        }
+        llvm::LLVMContext &ctx = module.getContext();
+        llvm::Type *i32 = llvm::Type::getInt32Ty(ctx), *i64 = llvm::Type::getInt64Ty(ctx);
+        llvm::Type *ptr = i32->getPointerTo();
+
+        bool reduction = kernel == Kernel::Sum || kernel == Kernel::Min || kernel == Kernel::Max;
+        std::vector<llvm::Type *> params;
+        switch (kernel) {
+            case Kernel::Add:
+            case Kernel::Sub:
+            case Kernel::Mul:
+                params = {ptr, ptr, ptr, i64};
+                break;
+            case Kernel::AddScalar:
+            case Kernel::SubScalar:
+            case Kernel::ScalarSub:
+            case Kernel::MulScalar:
+                params = {ptr, ptr, i32, i64};
+                break;
+            case Kernel::Sum:
+            case Kernel::Min:
+            case Kernel::Max:
+                params = {ptr, i64};
+                break;
+            case Kernel::Fill:
+                params = {ptr, i32, i64};
+                break;
+        }
+        llvm::Type *result = reduction ? i32 : llvm::Type::getVoidTy(ctx);
+        llvm::Function *f = llvm::Function::Create(llvm::FunctionType::get(result, params, false),
+                                                   llvm::GlobalValue::InternalLinkage, name, &module);
+        f->addFnAttr(llvm::Attribute::NoUnwind);
+        f->addFnAttr(llvm::Attribute::WillReturn);
+        f->addFnAttr(llvm::Attribute::ArgMemOnly);
+        f->addFnAttr(llvm::Attribute::InlineHint);
+        // the elements of every array start at a 64-byte boundary (lol_array_new), the destination is a new array
+        // or the only operand
+        for (llvm::Argument &arg: f->args()) {
+            if (arg.getType()->isPointerTy()) {
+                arg.addAttr(llvm::Attribute::NoCapture);
+                arg.addAttr(llvm::Attribute::getWithAlignment(ctx, llvm::Align(64)));
+                arg.addAttr(arg.getArgNo() == 0 && !reduction ? llvm::Attribute::NoAlias : llvm::Attribute::ReadOnly);
+            }
+        }
+
+        llvm::Value *n = f->getArg(f->arg_size() - 1);
+        llvm::Value *dst = f->getArg(0);
+        switch (kernel) {
+            case Kernel::Add:
+            case Kernel::Sub:
+            case Kernel::Mul:
+                DefineLoop(f, n, nullptr, [&](llvm::IRBuilder<> &b, llvm::Value *i, llvm::Value *) {
+                    llvm::Value *x = Load(b, f->getArg(1), i), *y = Load(b, f->getArg(2), i);
+                    llvm::Value *v = kernel == Kernel::Add ? b.CreateAdd(x, y) :
+                                     kernel == Kernel::Sub ? b.CreateSub(x, y) : b.CreateMul(x, y);
+                    Store(b, v, dst, i);
+                    return nullptr;
+                });
+                break;
+            case Kernel::AddScalar:
+            case Kernel::SubScalar:
+            case Kernel::ScalarSub:
+            case Kernel::MulScalar:
+                DefineLoop(f, n, nullptr, [&](llvm::IRBuilder<> &b, llvm::Value *i, llvm::Value *) {
+                    llvm::Value *x = Load(b, f->getArg(1), i), *y = f->getArg(2);
+                    llvm::Value *v = kernel == Kernel::AddScalar ? b.CreateAdd(x, y) :
+                                     kernel == Kernel::SubScalar ? b.CreateSub(x, y) :
+                                     kernel == Kernel::ScalarSub ? b.CreateSub(y, x) : b.CreateMul(x, y);
+                    Store(b, v, dst, i);
+                    return nullptr;
+                });
+                break;
+            case Kernel::Sum:
+                DefineLoop(f, n, llvm::ConstantInt::get(i32, 0), [&](llvm::IRBuilder<> &b, llvm::Value *i, llvm::Value *acc) {
+                    return b.CreateAdd(acc, Load(b, dst, i));
+                });
+                break;
+            case Kernel::Min:
+            case Kernel::Max: {
+                bool isMin = kernel == Kernel::Min;
+                auto init = isMin ? std::numeric_limits<std::int32_t>::max() : std::numeric_limits<std::int32_t>::min();
+                DefineLoop(f, n, llvm::ConstantInt::get(i32, init, true), [&](llvm::IRBuilder<> &b, llvm::Value *i, llvm::Value *acc) {
+                    llvm::Value *x = Load(b, dst, i);
+                    llvm::Value *better = isMin ? b.CreateICmpSLT(x, acc) : b.CreateICmpSGT(x, acc);
+                    return b.CreateSelect(better, x, acc);
+                });
+                break;
+            }
+            case Kernel::Fill:
+                DefineLoop(f, n, nullptr, [&](llvm::IRBuilder<> &b, llvm::Value *i, llvm::Value *) {
+                    Store(b, f->getArg(1), dst, i);
+                    return nullptr;
+                });
+                break;
+        }
+        return f;
+    }
+}
@@ -0,0 +1,43 @@
+/*
+    Runtime library of L: the builtin functions abs, min, max and pow (also behind the ^ operator)
+
+    The functions are defined in LLVM IR, in every module that uses them, the first time they are needed.
+    They have internal linkage, so the JIT, object files and executables all get the same code without
+    linking anything, and the optimizer inlines and specializes them like the code of the program.
+
+    Semantics, shared with the constant folder and the bytecode VM (eval::Pow, eval::CallBuiltin in fold.hpp):
+    Int wraps around; pow(x, n) for n < 0 is 1/x^n rounded toward zero, that is 1 or -1 for x = 1 or -1
+    and 0 otherwise (0 for x = 0 too, there is no trap); abs(-2^31) is -2^31.
+
+    The whole-array operations of Int[] (elementwise +, -, *, sum, min, max, fill) are kernels defined the same way:
+    plain counted loops over the elements with a noalias destination and 64-byte aligned pointers, which the loop
+    vectorizer turns into SIMD code at -O2 and above. min and max of an empty array are 2^31-1 and -2^31.
+*/
+#pragma once
+
+#include "decl.hpp"
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+
+namespace builtins {
+    // the definition of fn in module, emitted on first use
+    llvm::Function *Get(llvm::Module &module, AST::Builtin fn);
+
+    enum class Kernel {
+        Add,       // void (i32 *dst, i32 *a, i32 *b, i64 n): dst[i] = a[i] + b[i]
+        Sub,
+        Mul,
+        AddScalar, // void (i32 *dst, i32 *a, i32 x, i64 n): dst[i] = a[i] + x
+        SubScalar, // dst[i] = a[i] - x
+        ScalarSub, // dst[i] = x - a[i]
+        MulScalar,
+        Sum,       // i32 (i32 *a, i64 n)
+        Min,
+        Max,
+        Fill       // void (i32 *dst, i32 x, i64 n)
+    };
+
+    // the definition of the kernel in module, emitted on first use
+    llvm::Function *GetKernel(llvm::Module &module, Kernel kernel);
+}
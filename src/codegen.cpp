@@ -2,6 +2,9 @@
 #include "codegen.hpp"
 
 #include "node.hpp"
+#include "flat_ast.hpp"
+#include "builtins.hpp"
+#include "trace.hpp"
 #include <llvm/IR/Value.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Type.h>
@@ -9,9 +12,29 @@
 #include <llvm/IR/GlobalValue.h>
 #include <llvm/ExecutionEngine/GenericValue.h>
 #include <llvm/IR/LegacyPassManager.h>
-#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
 #include <llvm/IR/Operator.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/ProfileData/InstrProf.h>
+#include <llvm/ProfileData/ProfileCommon.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Transforms/Scalar/InductiveRangeCheckElimination.h>
 #include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Analysis/AssumptionCache.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/Transforms/Utils/CodeExtractor.h>
+#include <llvm/Transforms/Utils/PromoteMemToReg.h>
+#include <llvm/Transforms/Utils/SplitModule.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/FileUtilities.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/raw_os_ostream.h>
 
@@ -20,78 +43,450 @@
 #include <vector>
 #include <cassert>
 #include <unordered_map>
+#include <thread>
+#include <algorithm>
+#include <limits>
 
-using GlobalStringPool = std::unordered_map<std::string, llvm::Value *>;
+namespace {
+    using codegen::unwrap;
+
+    // the runtime (lolrt.h) is linked into the compiler, the JIT finds it among the symbols of the process
+    void AddProcessSymbols(llvm::orc::LLJIT &jit) {
+        jit.getMainJITDylib().addGenerator(unwrap(
+                llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+                        jit.getDataLayout().getGlobalPrefix())));
+    }
+
+    // liblolrt.a is built next to the compiler
+    std::string RuntimeLibrary() {
+        static int anchor;
+        llvm::SmallString<128> path(llvm::sys::path::parent_path(llvm::sys::fs::getMainExecutable(nullptr, &anchor)));
+        llvm::sys::path::append(path, "liblolrt.a");
+        if (!llvm::sys::fs::exists(path)) {
+            throw std::runtime_error("Can't find the runtime library " + path.str().str());
+        }
+        return path.str().str();
+    }
+
+    llvm::Type *getType(AST::DataType type, llvm::LLVMContext &ctx) {
+        if (type == AST::DataType::Int) {
+            return llvm::Type::getInt32Ty(ctx);
+        }
+        if (type == AST::DataType::Bool) {
+            return llvm::Type::getInt1Ty(ctx);
+        }
+        if (type == AST::DataType::String || AST::details::IsArray(type)) {
+            return llvm::Type::getInt8PtrTy(ctx);
+        }
+        throw std::runtime_error("[internal error] Unknown data type!");
+    }
+
+    // the new-PassManager default pipeline for -O<optLevel>, no-op for -O0
+    void RunPipeline(llvm::Module &module, llvm::TargetMachine *targetMachine, unsigned optLevel,
+                     llvm::PassInstrumentationCallbacks *instrumentation) {
+        if (optLevel == 0) {
+            return;
+        }
+
+        static const llvm::OptimizationLevel levels[] = {
+                llvm::OptimizationLevel::O0,
+                llvm::OptimizationLevel::O1,
+                llvm::OptimizationLevel::O2,
+                llvm::OptimizationLevel::O3,
+        };
+        assert(optLevel < 4);
+
+        llvm::LoopAnalysisManager lam;
+        llvm::FunctionAnalysisManager fam;
+        llvm::CGSCCAnalysisManager cgam;
+        llvm::ModuleAnalysisManager mam;
+
+        llvm::PassBuilder pb(targetMachine, llvm::PipelineTuningOptions(), llvm::None, instrumentation);
+        pb.registerModuleAnalyses(mam);
+        pb.registerCGSCCAnalyses(cgam);
+        pb.registerFunctionAnalyses(fam);
+        pb.registerLoopAnalyses(lam);
+        pb.crossRegisterProxies(lam, fam, cgam, mam);
+
+        // the bounds checks of array accesses in a loop over the indices are moved into pre- and post-loops,
+        // which leaves the main loop free of them for the vectorizer
+        pb.registerVectorizerStartEPCallback([](llvm::FunctionPassManager &fpm, llvm::OptimizationLevel) {
+            fpm.addPass(llvm::IRCEPass());
+        });
+
+        // mem2reg/SROA, instcombine, GVN, LICM, loop passes etc. are all part of the default pipeline
+        llvm::ModulePassManager mpm = pb.buildPerModuleDefaultPipeline(levels[optLevel]);
+        mpm.run(module, mam);
+    }
+
+    void EmitObject(llvm::Module &module, llvm::TargetMachine &targetMachine, const std::string &output_fname) {
+        std::error_code ec;
+        llvm::raw_fd_ostream out(output_fname, ec, llvm::sys::fs::OF_None);
+        if (ec) {
+            throw std::runtime_error("Can't open " + output_fname + ": " + ec.message());
+        }
+
+        // the backend still runs on the legacy pass manager
+        llvm::legacy::PassManager pm;
+        if (targetMachine.addPassesToEmitFile(pm, out, nullptr, llvm::CGFT_ObjectFile)) {
+            throw std::runtime_error("[internal error] Target can't emit object files");
+        }
+        pm.run(module);
+    }
+
+    // runs the system C compiler driver with args, output is what it produces
+    void RunLinker(std::vector<llvm::StringRef> args, const std::string &output_fname) {
+        llvm::ErrorOr<std::string> linker = llvm::sys::findProgramByName("cc");
+        if (!linker) {
+            linker = llvm::sys::findProgramByName("clang");
+        }
+        if (!linker) {
+            throw std::runtime_error("Can't find a C compiler driver (cc or clang) to link with");
+        }
+
+        args.insert(args.begin(), *linker);
+        args.push_back("-o");
+        args.push_back(output_fname);
+        std::string errMsg;
+        if (llvm::sys::ExecuteAndWait(*linker, args, llvm::None, {}, 0, 0, &errMsg) != 0) {
+            throw std::runtime_error("Linking " + output_fname + " failed " + errMsg);
+        }
+    }
+}
 
 namespace codegen {
-    CodeGenContext::CodeGenContext() : module(new llvm::Module("main", llvmCtx)) {
+    CodeGenContext::CodeGenContext() : tsCtx(std::make_unique<llvm::LLVMContext>()),
+                                       llvmCtx(*tsCtx.getContext()),
+                                       module(new llvm::Module("main", llvmCtx)) {
+    }
+
+    void CodeGenContext::initTarget(const std::string &cpu, const std::string &features) {
+        std::string triple = llvm::sys::getDefaultTargetTriple();
+        std::string error;
+        const llvm::Target *target = llvm::TargetRegistry::lookupTarget(triple, error);
+        if (!target) {
+            throw std::runtime_error("[internal error] " + error);
+        }
+
+        llvm::SubtargetFeatures targetFeatures(features);
+        if (features.empty()) {
+            llvm::StringMap<bool> hostFeatures;
+            if (llvm::sys::getHostCPUFeatures(hostFeatures)) {
+                for (auto &feature: hostFeatures) {
+                    targetFeatures.AddFeature(feature.first(), feature.second);
+                }
+            }
+        }
+        std::string targetCpu = cpu.empty() ? llvm::sys::getHostCPUName().str() : cpu;
+
+        // PIC, so that objects can be linked into the default (PIE) executables
+        targetMachine.reset(target->createTargetMachine(triple, targetCpu, targetFeatures.getString(),
+                                                        llvm::TargetOptions(), llvm::Reloc::PIC_));
+        module->setTargetTriple(triple);
+        module->setDataLayout(targetMachine->createDataLayout());
     }
 
     void CodeGenContext::generateCode() {
-        std::cout << "Start generating code...\n";
+        beginMain();
+
+        assert(astBlock);
+
+        TRACE(Codegen, Info) << "AST block size = " << astBlock->statements.size();
+
+        if (useFlatAst) {
+            AST::flat::Tree tree = AST::flat::Flatten(*astBlock);
+            AST::flat::CodeGen(tree, *this);
+        } else {
+            astBlock->CodeGen(*this);
+        }
+
+        finishMain();
+    }
+
+    void CodeGenContext::beginMain() {
+        TRACE(Codegen, Info) << "Start generating code...";
         std::vector<llvm::Type *> argTypes;
 
-        builder = new llvm::IRBuilder<>(llvmCtx);
+        builder = std::make_unique<llvm::IRBuilder<>>(llvmCtx);
 
         llvm::FunctionType *ftype = llvm::FunctionType::get(llvm::Type::getInt32Ty(llvmCtx),
                                                             llvm::makeArrayRef(argTypes), false);
-        mainFunction = llvm::Function::Create(ftype, llvm::GlobalValue::ExternalLinkage, "main", module);
+        mainFunction = llvm::Function::Create(ftype, llvm::GlobalValue::ExternalLinkage, "main", module.get());
         basicBlock = llvm::BasicBlock::Create(llvmCtx, "entry", mainFunction);
         builder->SetInsertPoint(basicBlock);
+    }
 
-        fmtInt = builder->CreateGlobalStringPtr("%d\n", "fmtInt"); // fmt for int
-        fmtStr = builder->CreateGlobalStringPtr("%s\n", "fmtStr");
-        // creating printIntF
+    void CodeGenContext::finishMain() {
+        finishProfile();
+        if (profileLines) {
+            builder->CreateCall(runtimeFunction("lol_line_profile_report", builder->getVoidTy(),
+                                                {builder->getInt8PtrTy()}),
+                                {builder->CreateGlobalStringPtr(profileSource, "lol.profile.source")});
+            // the counters are allocated once the number of lines is known
+            llvm::IRBuilder<> entry(&mainFunction->getEntryBlock(), mainFunction->getEntryBlock().begin());
+            entry.CreateCall(runtimeFunction("lol_line_profile_begin", builder->getVoidTy(), {builder->getInt32Ty()}),
+                             {entry.getInt32(maxLine + 1)});
+        }
+        builder->CreateCall(runtimeFunction("lol_finish", builder->getVoidTy(), {}));
+        auto *resp = builder->getInt32(0);
+        builder->CreateRet(resp);
+
+        TRACE(Codegen, Info) << "Code generated..";
+    }
 
-        // llvm::FunctionType * printFunctionType = llvm::FunctionType::get(builder->getInt32Ty(), false);
-        // this->printIntFunc = llvm::Function::Create(printFunctionType, llvm::Function::ExternalLinkage, "print", module);
+    void CodeGenContext::dumpCode(std::ostream &out) const {
+        llvm::raw_os_ostream os(out);
+        module->print(os, nullptr);
+    }
 
-        // decl printf
+    llvm::FunctionCallee CodeGenContext::runtimeFunction(const char *name, llvm::Type *result,
+                                                         llvm::ArrayRef<llvm::Type *> params) {
+        llvm::FunctionCallee f = module->getOrInsertFunction(name, llvm::FunctionType::get(result, params, false));
+        if (auto *function = llvm::dyn_cast<llvm::Function>(f.getCallee())) {
+            function->addFnAttr(llvm::Attribute::NoUnwind);
+        }
+        return f;
+    }
 
-        std::vector<llvm::Type *> printf_arg_types;
-        printf_arg_types.push_back(llvm::Type::getInt8PtrTy(llvmCtx)); // char*
+    llvm::Function *CodeGenContext::generateLoop(const std::string &name, AST::WhileLoop &loop,
+                                                 const std::vector<AST::Identifier *> &slotVariables) {
+        TRACE(Jit, Info) << "Generating loop function " << name;
+        builder = std::make_unique<llvm::IRBuilder<>>(llvmCtx);
+
+        llvm::Type *slotsType = llvm::Type::getInt64PtrTy(llvmCtx);
+        llvm::FunctionType *ftype = llvm::FunctionType::get(llvm::Type::getVoidTy(llvmCtx), {slotsType}, false);
+        llvm::Function *function = llvm::Function::Create(ftype, llvm::GlobalValue::ExternalLinkage, name,
+                                                          module.get());
+        llvm::Argument *slots = function->getArg(0);
+        slots->setName("slots");
+        slots->addAttr(llvm::Attribute::NoAlias);
+        basicBlock = llvm::BasicBlock::Create(llvmCtx, "entry", function);
+        builder->SetInsertPoint(basicBlock);
 
-        std::vector<llvm::Type *> printfArgsTypes({builder->getInt8PtrTy()});
-        llvm::FunctionType *printfType = llvm::FunctionType::get(builder->getInt32Ty(), printfArgsTypes, true);
-        // printfCallee = module->getOrInsertFunction("printf", printfType); // buggy
+        // every variable lives in its slot, so emitDeclare never allocates
+        for (std::size_t i = 0; i < slotVariables.size(); ++i) {
+            AST::Identifier *ident = slotVariables[i];
+            llvm::Value *slot = builder->CreateConstInBoundsGEP1_64(builder->getInt64Ty(), slots, i);
+            variable(ident) = builder->CreateBitCast(
+                    slot, getType(ident->type, llvmCtx)->getPointerTo(), ident->name);
+        }
 
-        llvm::FunctionType *printf_type =
-                llvm::FunctionType::get(
-                        llvm::Type::getInt32Ty(llvmCtx), printf_arg_types, true);
+        loop.CodeGen(*this);
+        builder->CreateRetVoid();
+        return function;
+    }
 
-        llvm::Function *func = llvm::Function::Create(
-                printf_type, llvm::Function::ExternalLinkage,
-                llvm::Twine("printf"),
-                module);
-        func->setCallingConv(llvm::CallingConv::C);
+    void CodeGenContext::optimize(unsigned optLevel, llvm::PassInstrumentationCallbacks *instrumentation) {
+        if (llvm::verifyModule(*module, &llvm::errs())) {
+            throw std::runtime_error("[internal error] Generated module is broken");
+        }
+        RunPipeline(*module, targetMachine.get(), optLevel, instrumentation);
+    }
 
-        printfF = func;
+    unsigned CodeGenContext::outlineRegions(unsigned minInstructions) {
+        assert(mainFunction);
+        llvm::Function &function = *mainFunction;
+
+        // the allocas are left alone in the entry block, which is never outlined
+        llvm::BasicBlock &entry = function.getEntryBlock();
+        auto body = std::find_if(entry.begin(), entry.end(), [](llvm::Instruction &inst) {
+            return !llvm::isa<llvm::AllocaInst>(inst);
+        });
+        entry.splitBasicBlock(body, "body");
+
+        // the variables become values, so the outlined code gets them as arguments instead of their addresses
+        // and can still keep them in registers
+        llvm::DominatorTree dt(function);
+        llvm::AssumptionCache ac(function);
+        std::vector<llvm::AllocaInst *> allocas;
+        for (llvm::Instruction &inst: entry) {
+            if (auto *alloca = llvm::dyn_cast<llvm::AllocaInst>(&inst); alloca && llvm::isAllocaPromotable(alloca)) {
+                allocas.push_back(alloca);
+            }
+        }
+        if (!allocas.empty()) {
+            llvm::PromoteMemToReg(allocas, dt, &ac);
+        }
 
-        assert(astBlock);
+        // every path from the entry to the return of main goes through the blocks that dominate the return, the
+        // spine of main; the blocks dominated by one of them and not by the next one are the code of a top-level
+        // statement (a loop, an if, straight-line code), entered at the first and left to the next one or to
+        // a noreturn call of the runtime. Runs of them are outlined once they are big enough, so that both a big
+        // loop and a long sequence of small statements are split
+        llvm::BasicBlock *returnBlock = nullptr;
+        for (llvm::BasicBlock &block: function) {
+            if (llvm::isa<llvm::ReturnInst>(block.getTerminator())) {
+                returnBlock = &block;
+            }
+        }
+        assert(returnBlock);
+        std::vector<llvm::DomTreeNode *> spine;
+        for (llvm::DomTreeNode *node = dt.getNode(returnBlock); node; node = node->getIDom()) {
+            spine.push_back(node);
+        }
+        std::reverse(spine.begin(), spine.end());
+
+        // the entry with the allocas and the piece that returns stay in main
+        std::vector<std::vector<llvm::BasicBlock *>> regions;
+        std::vector<llvm::BasicBlock *> blocks;
+        std::size_t instructions = 0;
+        for (std::size_t i = 1; i + 1 < spine.size(); ++i) {
+            std::vector<llvm::DomTreeNode *> stack{spine[i]};
+            while (!stack.empty()) {
+                llvm::DomTreeNode *node = stack.back();
+                stack.pop_back();
+                blocks.push_back(node->getBlock());
+                instructions += node->getBlock()->size();
+                for (llvm::DomTreeNode *child: node->children()) {
+                    if (child != spine[i + 1]) {
+                        stack.push_back(child);
+                    }
+                }
+            }
+            if (instructions >= minInstructions) {
+                regions.push_back(std::move(blocks));
+                blocks.clear();
+                instructions = 0;
+            }
+        }
 
-        std::cout << "AST block size = " << astBlock->statements.size() << '\n';
+        unsigned outlined = 0;
+        llvm::CodeExtractorAnalysisCache cache(function); // stays valid for the blocks left in main
+        for (const std::vector<llvm::BasicBlock *> &blocks: regions) {
+            llvm::CodeExtractor extractor(blocks, &dt, false, nullptr, nullptr, nullptr, false, false, "region");
+            if (!extractor.isEligible()) {
+                continue;
+            }
+            if (llvm::Function *region = extractor.extractCodeRegion(cache)) {
+                // inlined back, it would be optimized and compiled together with main again
+                region->addFnAttr(llvm::Attribute::NoInline);
+                TRACE(Codegen, Info) << "Outlined " << region->getName().str() << ": " << region->getInstructionCount()
+                                     << " instruction(s)";
+                ++outlined;
+            }
+        }
+        return outlined;
+    }
 
-        astBlock->CodeGen(*this);
+    void CodeGenContext::saveSplit(unsigned partitions, unsigned optLevel, const std::string &object_fname,
+                                   const std::string &executable_fname) {
+        assert(targetMachine && partitions > 0);
+        if (llvm::verifyModule(*module, &llvm::errs())) {
+            throw std::runtime_error("[internal error] Generated module is broken");
+        }
 
-        auto *resp = builder->getInt32(0);
-        builder->CreateRet(resp);
+        const llvm::Target &target = targetMachine->getTarget();
+        std::string triple = targetMachine->getTargetTriple().str();
+        std::string cpu = targetMachine->getTargetCPU().str();
+        std::string features = targetMachine->getTargetFeatureString().str();
+        llvm::TargetOptions targetOptions = targetMachine->Options;
+
+        // indexed by partition, sized up front since the threads use them while SplitModule goes on
+        std::vector<llvm::SmallVector<char, 0>> bitcode(partitions);
+        std::vector<llvm::SmallString<128>> objects(partitions);
+        std::vector<std::unique_ptr<llvm::FileRemover>> removers;
+        std::vector<std::string> errors(partitions);
+        std::vector<std::thread> threads;
+
+        auto compile = [&](unsigned k) {
+            try {
+                llvm::LLVMContext context;
+                std::unique_ptr<llvm::Module> part = unwrap(llvm::parseBitcodeFile(
+                        llvm::MemoryBufferRef(llvm::StringRef(bitcode[k].data(), bitcode[k].size()), "partition"),
+                        context));
+                std::unique_ptr<llvm::TargetMachine> machine(
+                        target.createTargetMachine(triple, cpu, features, targetOptions, llvm::Reloc::PIC_));
+                RunPipeline(*part, machine.get(), optLevel, nullptr);
+                EmitObject(*part, *machine, objects[k].str().str());
+            } catch (std::exception &e) {
+                errors[k] = e.what();
+            }
+        };
+
+        try {
+            // the locals are made external, so that any function can go to any partition
+            llvm::SplitModule(*module, partitions, [&](std::unique_ptr<llvm::Module> part) {
+                unsigned k = threads.size();
+                TRACE(Codegen, Info) << "Partition " << k << ": " << part->getInstructionCount() << " instruction(s)";
+                if (auto ec = llvm::sys::fs::createTemporaryFile("lol", "o", objects[k])) {
+                    throw std::runtime_error("Can't create temporary object file: " + ec.message());
+                }
+                removers.push_back(std::make_unique<llvm::FileRemover>(objects[k]));
+                // every thread has an LLVMContext of its own, the partition gets there as bitcode
+                llvm::raw_svector_ostream out(bitcode[k]);
+                llvm::WriteBitcodeToFile(*part, out);
+                threads.emplace_back(compile, k);
+            }, false);
+        } catch (...) {
+            for (std::thread &t: threads) {
+                t.join();
+            }
+            throw;
+        }
+        for (std::thread &t: threads) {
+            t.join();
+        }
+        for (const std::string &error: errors) {
+            if (!error.empty()) {
+                throw std::runtime_error(error);
+            }
+        }
 
-        llvm::raw_os_ostream out(std::cout);
-        module->print(out, nullptr);
+        std::vector<llvm::StringRef> inputs;
+        for (std::size_t k = 0; k < threads.size(); ++k) {
+            inputs.push_back(objects[k]);
+        }
+        if (!object_fname.empty()) {
+            // one relocatable object, as without partitions
+            std::vector<llvm::StringRef> args = inputs;
+            args.insert(args.begin(), {"-r", "-nostdlib"});
+            RunLinker(args, object_fname);
+        }
+        if (!executable_fname.empty()) {
+            std::string runtime = RuntimeLibrary();
+            std::vector<llvm::StringRef> args = inputs;
+            args.push_back(runtime);
+            args.push_back("-pthread");
+            RunLinker(args, executable_fname);
+        }
+    }
 
-        std::cout << "Code generated..\n";
+    llvm::GenericValue CodeGenContext::runCode() {
+        TRACE(Jit, Info) << "Running code";
+        auto jtmb = unwrap(llvm::orc::JITTargetMachineBuilder::detectHost());
+        std::unique_ptr<llvm::orc::LLLazyJIT> jit = unwrap(
+                llvm::orc::LLLazyJITBuilder()
+                        .setJITTargetMachineBuilder(std::move(jtmb))
+                        .setNumCompileThreads(std::max(1u, std::thread::hardware_concurrency()))
+                        .create());
+        AddProcessSymbols(*jit);
+
+        unwrap(jit->addLazyIRModule(llvm::orc::ThreadSafeModule(std::move(module), tsCtx)));
+
+        auto mainSym = unwrap(jit->lookup("main"));
+        auto *mainPtr = reinterpret_cast<int (*)()>(mainSym.getAddress());
+        int ret = mainPtr();
+        TRACE(Jit, Info) << "Code was run.";
+
+        llvm::GenericValue v;
+        v.IntVal = llvm::APInt(32, ret, true);
+        return v;
     }
 
-    llvm::GenericValue CodeGenContext::runCode() const {
-        std::cout << "Running code\n";
-        llvm::ExecutionEngine *ee = llvm::EngineBuilder(std::unique_ptr<llvm::Module>(module)).create();
-        ee->finalizeObject();
-        std::cout << "After finalize.." << std::endl;
-        std::vector<llvm::GenericValue> noargs;
-        llvm::GenericValue v = ee->runFunction(mainFunction, noargs);
-        std::cout << "After run func.." << std::endl;
-        std::cout << "Code was run.\n";
-        return {};
+    int CodeGenContext::runIn(llvm::orc::LLJIT &jit, llvm::function_ref<int(int (*)())> run) {
+        TRACE(Jit, Info) << "Running code on the shared JIT";
+        llvm::orc::ResourceTrackerSP tracker = jit.getMainJITDylib().createResourceTracker();
+        unwrap(jit.addIRModule(tracker, llvm::orc::ThreadSafeModule(std::move(module), tsCtx)));
+        int ret;
+        try {
+            auto mainSym = unwrap(jit.lookup("main"));
+            ret = run(reinterpret_cast<int (*)()>(mainSym.getAddress()));
+        } catch (...) {
+            unwrap(tracker->remove());
+            throw;
+        }
+        unwrap(tracker->remove());
+        return ret;
     }
 
     void CodeGenContext::saveCode(const std::string &output_fname) const {
@@ -100,276 +495,864 @@ namespace codegen {
         module->print(text_write, nullptr);
     }
 
-}
-
-namespace {
-    llvm::Type *getType(AST::Identifier *id, llvm::LLVMContext &ctx) {
-        if (id->type == AST::DataType::Int) {
-            return llvm::Type::getInt32Ty(ctx);
+    void CodeGenContext::saveBitcode(const std::string &output_fname) const {
+        std::error_code ec;
+        llvm::raw_fd_ostream out(output_fname + ".bc", ec, llvm::sys::fs::OF_None);
+        if (ec) {
+            throw std::runtime_error("Can't open " + output_fname + ".bc: " + ec.message());
         }
-        if (id->type == AST::DataType::Bool) {
-            return llvm::Type::getInt1Ty(ctx);
-        }
-        if (id->type == AST::DataType::String) {
-            return llvm::Type::getInt8PtrTy(ctx);
-        }
-        throw std::runtime_error("[internal error] Unknown data type!");
+        llvm::WriteBitcodeToFile(*module, out);
     }
-}
 
-namespace AST {
-    llvm::Value *CodeBlock::CodeGen(codegen::CodeGenContext &context) {
-        std::cout << "Generating block...\n";
-        llvm::Value *last = nullptr;
-        int i = 0;
-        for (auto &st: statements) {
-            std::cout << ++i << " statement:\n";
-            last = st->CodeGen(context);
-        }
-        return context.builder->getInt1(true);
+    void CodeGenContext::saveObject(const std::string &output_fname) const {
+        assert(targetMachine);
+        EmitObject(*module, *targetMachine, output_fname);
     }
 
-    // expressions
-    llvm::Value *ConstantInt::CodeGen(codegen::CodeGenContext &context) {
-        std::cout << "Generating constant i32...\n";
-        return context.builder->getInt32(val);
+    void CodeGenContext::saveExecutable(const std::string &output_fname) const {
+        llvm::SmallString<128> objPath;
+        if (auto ec = llvm::sys::fs::createTemporaryFile("lol", "o", objPath)) {
+            throw std::runtime_error("Can't create temporary object file: " + ec.message());
+        }
+        llvm::FileRemover objRemover(objPath);
+        saveObject(objPath.str().str());
+
+        std::string runtime = RuntimeLibrary();
+        RunLinker({objPath.str(), runtime, "-pthread"}, output_fname);
     }
 
-    llvm::Value *ConstantBool::CodeGen(codegen::CodeGenContext &context) {
-        std::cout << "Generating constant i1...\n";
-        return context.builder->getInt1(val);
+    void unwrap(llvm::Error err) {
+        if (err) {
+            throw std::runtime_error("[internal error] " + llvm::toString(std::move(err)));
+        }
     }
 
-    llvm::Value *ConstantString::CodeGen(codegen::CodeGenContext &context) {
-        std::cout << "Generating constant string...\n";
+    std::unique_ptr<llvm::orc::LLJIT> CreateHostJIT() {
+        std::unique_ptr<llvm::orc::LLJIT> jit = unwrap(
+                llvm::orc::LLJITBuilder()
+                        .setJITTargetMachineBuilder(unwrap(llvm::orc::JITTargetMachineBuilder::detectHost()))
+                        .create());
+        AddProcessSymbols(*jit);
+        return jit;
+    }
+}
 
-        static GlobalStringPool globs;
-        auto iter = globs.find(val);
-        if (iter == globs.end()) {
-            iter = globs.emplace(val, context.builder->CreateGlobalStringPtr(llvm::StringRef(val))).first;
+namespace codegen {
+    llvm::Value *CodeGenContext::emitString(const std::string &val) {
+        auto iter = stringPool.find(val);
+        if (iter == stringPool.end()) {
+            llvm::Type *i8ptr = builder->getInt8PtrTy();
+            auto *descriptorType = llvm::StructType::get(i8ptr, builder->getInt64Ty(), i8ptr);
+            auto *descriptor = llvm::ConstantStruct::get(
+                    descriptorType,
+                    {builder->CreateGlobalStringPtr(llvm::StringRef(val), "str.data"), builder->getInt64(val.size()),
+                     llvm::ConstantPointerNull::get(builder->getInt8PtrTy())});
+            auto *global = new llvm::GlobalVariable(*module, descriptorType, true, llvm::GlobalValue::PrivateLinkage,
+                                                    descriptor, "str");
+            iter = stringPool.emplace(val, llvm::ConstantExpr::getBitCast(global, i8ptr)).first;
         }
-
         return iter->second;
     }
 
-    llvm::Value *Identifier::CodeGen(codegen::CodeGenContext &context) {
-        if (context.variables.find(name) != context.variables.end()) {
-            std::cout << "Extracting " << name << "...\n";
-            return context.builder->CreateLoad(context.variables[name]);
+    llvm::Value *&CodeGenContext::variable(const AST::Identifier *ident) {
+        if (ident->slot >= variables.size()) {
+            variables.resize(ident->slot + 1);
         }
-        std::cout << "Generating Ident with name \"" << name << "\"...\n";
-        llvm::AllocaInst *alloca = context.builder->CreateAlloca(getType(this, context.llvmCtx), nullptr, name);
-        context.variables[name] = alloca;
-        return alloca;
+        return variables[ident->slot];
+    }
+
+    llvm::Value *CodeGenContext::emitDeclare(AST::Identifier *ident) {
+        llvm::Value *&var = variable(ident);
+        llvm::Type *type = getType(ident->type, llvmCtx);
+        // with --stream the slot of a closed block is taken by the blocks after it, its alloca is reused
+        // when the type is the same
+        if (var && var->getType() == type->getPointerTo()) {
+            return var;
+        }
+        // allocas live in the entry block, otherwise mem2reg/SROA can't promote them to registers
+        llvm::BasicBlock &entry = builder->GetInsertBlock()->getParent()->getEntryBlock();
+        llvm::IRBuilder<> entryBuilder(&entry, entry.begin());
+        var = entryBuilder.CreateAlloca(type, nullptr, ident->name);
+        return var;
+    }
+
+    llvm::Value *CodeGenContext::emitIdentifier(AST::Identifier *ident) {
+        // the declaration may have been removed as dead code, the value is undefined then
+        llvm::Value *var = emitDeclare(ident);
+        return builder->CreateLoad(getType(ident->type, llvmCtx), var);
     }
 
     // NOTE: type checking done during ast building
-    llvm::Value *UnaryOp::CodeGen(codegen::CodeGenContext &context) {
-        std::cout << "Generating unary op...\n";
-        llvm::Value *expr_v = expr.CodeGen(context);
+    llvm::Value *CodeGenContext::emitUnaryOp(AST::UnaryOpType op, llvm::Value *v) {
         switch (op) {
-            case AST::UnaryOpType::Minus:
+            case AST::UnaryOpType::Minus: {
+                return builder->CreateNeg(v);
+            }
             case AST::UnaryOpType::Neg: {
-                return context.builder->CreateNeg(expr_v);
+                return builder->CreateNot(v);
             }
         }
         return nullptr;
     }
 
     // NOTE: type checking done during ast building
-    llvm::Value *BinaryOp::CodeGen(codegen::CodeGenContext &context) {
-        std::cout << "Generating binary op...\n";
-        llvm::Value *lhs_v = lhs.CodeGen(context);
-        llvm::Value *rhs_v = rhs.CodeGen(context);
+    llvm::Value *CodeGenContext::emitBinaryOp(AST::BinaryOpType op, AST::DataType operandsType,
+                                              llvm::Value *lhs_v, llvm::Value *rhs_v) {
         assert(lhs_v);
         assert(rhs_v);
         switch (op) {
-            case BinaryOpType::Pow: {
-                // TODO change, now is right assoc mult
-                return context.builder->CreateMul(lhs_v, rhs_v);
+            case AST::BinaryOpType::Pow: {
+                return emitCall(AST::Builtin::Pow, {lhs_v, rhs_v});
             }
                 // for ints
-            case BinaryOpType::Mult: {
-                return context.builder->CreateMul(lhs_v, rhs_v);
+            case AST::BinaryOpType::Mult: {
+                return builder->CreateMul(lhs_v, rhs_v);
             }
-            case BinaryOpType::Div: {
-                return context.builder->CreateUDiv(lhs_v, rhs_v);
+            case AST::BinaryOpType::Div: {
+                // sdiv by zero and of INT_MIN by -1 is undefined, the program ends with lol_division_error instead
+                auto *divisor = llvm::dyn_cast<llvm::ConstantInt>(rhs_v);
+                if (!divisor || divisor->isZero() || divisor->isMinusOne()) {
+                    llvm::Value *overflow = builder->CreateAnd(
+                            builder->CreateICmpEQ(lhs_v, builder->getInt32(std::numeric_limits<std::int32_t>::min())),
+                            builder->CreateICmpEQ(rhs_v, builder->getInt32(-1)));
+                    llvm::Value *undefined = builder->CreateOr(builder->CreateICmpEQ(rhs_v, builder->getInt32(0)),
+                                                               overflow);
+                    emitCheck(builder->CreateNot(undefined, "divisible"), "lol_division_error", {lhs_v, rhs_v});
+                }
+                return builder->CreateSDiv(lhs_v, rhs_v);
             }
-            case BinaryOpType::Sub: {
-                return context.builder->CreateSub(lhs_v, rhs_v);
+            case AST::BinaryOpType::Sub: {
+                return builder->CreateSub(lhs_v, rhs_v);
             }
-            case BinaryOpType::Leq: {
-                return context.builder->CreateICmpSLE(lhs_v, rhs_v);
+            case AST::BinaryOpType::Leq: {
+                return builder->CreateICmpSLE(lhs_v, rhs_v);
             }
-            case BinaryOpType::Les: {
-                return context.builder->CreateICmpSLT(lhs_v, rhs_v);
+            case AST::BinaryOpType::Les: {
+                return builder->CreateICmpSLT(lhs_v, rhs_v);
             }
-            case BinaryOpType::Geq: {
-                return context.builder->CreateICmpSGE(lhs_v, rhs_v);
+            case AST::BinaryOpType::Geq: {
+                return builder->CreateICmpSGE(lhs_v, rhs_v);
             }
-            case BinaryOpType::Gre: {
-                return context.builder->CreateICmpSGT(lhs_v, rhs_v);
+            case AST::BinaryOpType::Gre: {
+                return builder->CreateICmpSGT(lhs_v, rhs_v);
             }
 
-            case BinaryOpType::Sum: {
-                if (lhs.type == DataType::String) {
-                    throw std::runtime_error("[internal error] Concat is not supported");
+            case AST::BinaryOpType::Sum: {
+                if (operandsType == AST::DataType::String) {
+                    llvm::Type *str = builder->getInt8PtrTy();
+                    return builder->CreateCall(runtimeFunction("lol_string_concat", str, {str, str}), {lhs_v, rhs_v});
                 }
-                return context.builder->CreateAdd(lhs_v, rhs_v);
+                return builder->CreateAdd(lhs_v, rhs_v);
             }
 
                 // all
-            case BinaryOpType::Eq: {
-                if (lhs.type == DataType::Int || lhs.type == DataType::Bool) {
-                    return context.builder->CreateICmpEQ(lhs_v, rhs_v);
+            case AST::BinaryOpType::Eq: {
+                if (operandsType == AST::DataType::Int || operandsType == AST::DataType::Bool) {
+                    return builder->CreateICmpEQ(lhs_v, rhs_v);
                 } else {
-                    auto *casted_l = context.builder->CreatePtrToInt(lhs_v, context.builder->getInt32Ty());
-                    auto *casted_r = context.builder->CreatePtrToInt(rhs_v, context.builder->getInt32Ty());
-                    return context.builder->CreateICmpEQ(casted_l, casted_r);
+                    llvm::Type *str = builder->getInt8PtrTy();
+                    llvm::Value *equal = builder->CreateCall(
+                            runtimeFunction("lol_string_equal", builder->getInt32Ty(), {str, str}), {lhs_v, rhs_v});
+                    return builder->CreateICmpNE(equal, builder->getInt32(0));
                 }
             }
 
-            case BinaryOpType::Neq: {
-                if (lhs.type == DataType::Int || lhs.type == DataType::Bool) {
-                    return context.builder->CreateICmpNE(lhs_v, rhs_v);
+            case AST::BinaryOpType::Neq: {
+                if (operandsType == AST::DataType::Int || operandsType == AST::DataType::Bool) {
+                    return builder->CreateICmpNE(lhs_v, rhs_v);
                 } else {
-                    auto *casted_l = context.builder->CreatePtrToInt(lhs_v, context.builder->getInt32Ty());
-                    auto *casted_r = context.builder->CreatePtrToInt(rhs_v, context.builder->getInt32Ty());
-                    return context.builder->CreateICmpNE(casted_l, casted_r);
+                    llvm::Type *str = builder->getInt8PtrTy();
+                    llvm::Value *equal = builder->CreateCall(
+                            runtimeFunction("lol_string_equal", builder->getInt32Ty(), {str, str}), {lhs_v, rhs_v});
+                    return builder->CreateICmpEQ(equal, builder->getInt32(0));
                 }
             }
                 // bool
-            case BinaryOpType::And: {
-                return context.builder->CreateAnd(lhs_v, rhs_v);
+            case AST::BinaryOpType::And: {
+                return builder->CreateAnd(lhs_v, rhs_v);
             }
-            case BinaryOpType::Or: {
-                return context.builder->CreateOr(lhs_v, rhs_v);
+            case AST::BinaryOpType::Or: {
+                return builder->CreateOr(lhs_v, rhs_v);
             }
         }
         throw std::runtime_error("Unknown bin op!");
     }
 
-    // statements
-    llvm::Value *Skip::CodeGen(codegen::CodeGenContext &context) {
-        return context.builder->getInt1(true);
+    llvm::Value *CodeGenContext::emitAssign(AST::Identifier *ident, llvm::Value *v) {
+        llvm::Value *var = variable(ident);
+        if (!var) {
+            throw std::runtime_error("[internal error] Variable is not in scope");
+        }
+        return builder->CreateStore(v, var, false);
     }
 
-    llvm::Value *VarDecl::CodeGen(codegen::CodeGenContext &context) {
-        std::cout << "Generating declaration for " << ident->name << "...\n";
-        ident->CodeGen(context);
+    llvm::Value *CodeGenContext::arrayLength(llvm::Value *array) {
+        llvm::Type *i64 = builder->getInt64Ty();
+        llvm::Value *field = builder->CreateBitCast(array, i64->getPointerTo());
+        llvm::LoadInst *length = builder->CreateAlignedLoad(i64, field, llvm::MaybeAlign(8), "len");
+        length->setMetadata(llvm::LLVMContext::MD_invariant_load, llvm::MDNode::get(llvmCtx, {}));
+        return length;
+    }
 
-        VarAssign va(ident, expr);
-        return va.CodeGen(context);
+    llvm::Value *CodeGenContext::arrayData(AST::DataType arrayType, llvm::Value *array) {
+        llvm::Type *element = arrayType == AST::DataType::IntArray ? builder->getInt32Ty() : builder->getInt8Ty();
+        llvm::Type *ptr = element->getPointerTo();
+        llvm::Value *field = builder->CreateConstInBoundsGEP1_64(
+                ptr, builder->CreateBitCast(array, ptr->getPointerTo()), 1);
+        llvm::LoadInst *data = builder->CreateAlignedLoad(ptr, field, llvm::MaybeAlign(8), "data");
+        data->setMetadata(llvm::LLVMContext::MD_invariant_load, llvm::MDNode::get(llvmCtx, {}));
+        data->setMetadata(llvm::LLVMContext::MD_nonnull, llvm::MDNode::get(llvmCtx, {}));
+        data->setMetadata(llvm::LLVMContext::MD_align, llvm::MDNode::get(
+                llvmCtx, llvm::ConstantAsMetadata::get(builder->getInt64(64))));
+        return data;
     }
 
-    llvm::Value *VarAssign::CodeGen(codegen::CodeGenContext &context) {
-        std::cout << "Generating assignment for " << ident->name << "...\n";
-        auto iter = context.variables.find(ident->name);
-        if (iter == context.variables.end()) {
-            throw std::runtime_error("[internal error] Variable is not in scope");
+    void CodeGenContext::emitCheck(llvm::Value *ok, const char *error, llvm::ArrayRef<llvm::Value *> args) {
+        llvm::Function *function = builder->GetInsertBlock()->getParent();
+        llvm::BasicBlock *okBB = llvm::BasicBlock::Create(llvmCtx, "check.ok", function);
+        llvm::BasicBlock *failBB = llvm::BasicBlock::Create(llvmCtx, "check.fail", function);
+        builder->CreateCondBr(ok, okBB, failBB, llvm::MDBuilder(llvmCtx).createBranchWeights(
+                std::numeric_limits<std::int32_t>::max(), 1));
+
+        builder->SetInsertPoint(failBB);
+        std::vector<llvm::Type *> params;
+        for (llvm::Value *arg: args) {
+            params.push_back(arg->getType());
         }
+        llvm::FunctionCallee f = runtimeFunction(error, builder->getVoidTy(), params);
+        if (auto *errorFunction = llvm::dyn_cast<llvm::Function>(f.getCallee())) {
+            errorFunction->addFnAttr(llvm::Attribute::NoReturn);
+            errorFunction->addFnAttr(llvm::Attribute::Cold);
+        }
+        builder->CreateCall(f, args);
+        builder->CreateUnreachable();
 
-        llvm::Value *var = iter->second;
-        llvm::Value *expr_val = expr.CodeGen(context);
+        builder->SetInsertPoint(okBB);
+    }
 
-        // wanna print value
-        auto *resp = context.builder->CreateStore(expr_val, var, false);
+    llvm::Value *CodeGenContext::emitNewArray(AST::DataType arrayType, llvm::Value *length) {
+        llvm::Type *i64 = builder->getInt64Ty();
+        llvm::FunctionCallee arrayNew = runtimeFunction("lol_array_new", builder->getInt8PtrTy(), {i64, i64});
+        if (auto *function = llvm::dyn_cast<llvm::Function>(arrayNew.getCallee())) {
+            function->addRetAttr(llvm::Attribute::NoAlias);
+            function->addRetAttr(llvm::Attribute::NonNull);
+        }
+        std::uint64_t elementSize = arrayType == AST::DataType::IntArray ? 4 : 1;
+        return builder->CreateCall(arrayNew, {builder->CreateSExt(length, i64), builder->getInt64(elementSize)});
+    }
 
-        if (ident->type == DataType::Int) {
-            llvm::Value *v = ident->CodeGen(context);
-            std::cout << "Int!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n";
-            // std::vector<llvm::Value *> args = {context.fmt, v};
+    llvm::Value *CodeGenContext::emitArrayLiteral(AST::DataType arrayType, llvm::ArrayRef<llvm::Value *> elements) {
+        llvm::Value *array = emitNewArray(arrayType, builder->getInt32(elements.size()));
+        llvm::Value *data = arrayData(arrayType, array);
+        for (std::size_t i = 0; i < elements.size(); ++i) {
+            llvm::Value *v = elements[i];
+            if (arrayType == AST::DataType::BoolArray) {
+                v = builder->CreateZExt(v, builder->getInt8Ty());
+            }
+            builder->CreateStore(v, builder->CreateConstInBoundsGEP1_64(v->getType(), data, i));
+        }
+        return array;
+    }
+
+    llvm::Value *CodeGenContext::emitElementAddress(AST::DataType arrayType, llvm::Value *array, llvm::Value *index) {
+        llvm::Value *length = arrayLength(array);
+        llvm::Value *inBounds = builder->CreateICmpULT(index, builder->CreateTrunc(length, builder->getInt32Ty()),
+                                                       "inbounds");
+        emitCheck(inBounds, "lol_array_index_error", {builder->CreateSExt(index, builder->getInt64Ty()), length});
+        llvm::Value *data = arrayData(arrayType, array);
+        llvm::Type *element = arrayType == AST::DataType::IntArray ? builder->getInt32Ty() : builder->getInt8Ty();
+        return builder->CreateInBoundsGEP(element, data, builder->CreateZExt(index, builder->getInt64Ty()));
+    }
 
-            // context.builder->CreateCall(context.printfF, makeArrayRef(args), "print");
-            // context.builder->CreateCall(context.printfCallee, args, "call");
+    llvm::Value *CodeGenContext::emitIndex(AST::DataType arrayType, llvm::Value *array, llvm::Value *index) {
+        llvm::Value *address = emitElementAddress(arrayType, array, index);
+        if (arrayType == AST::DataType::IntArray) {
+            return builder->CreateAlignedLoad(builder->getInt32Ty(), address, llvm::MaybeAlign(4));
         }
+        return builder->CreateTrunc(builder->CreateLoad(builder->getInt8Ty(), address), builder->getInt1Ty());
+    }
 
-        return resp;
+    llvm::Value *CodeGenContext::emitIndexAssign(AST::Identifier *ident, llvm::Value *index, llvm::Value *v) {
+        llvm::Value *address = emitElementAddress(ident->type, emitIdentifier(ident), index);
+        if (ident->type == AST::DataType::BoolArray) {
+            return builder->CreateStore(builder->CreateZExt(v, builder->getInt8Ty()), address);
+        }
+        return builder->CreateAlignedStore(v, address, llvm::MaybeAlign(4));
     }
 
-    llvm::Value *IfStatement::CodeGen(codegen::CodeGenContext &context) {
-        llvm::Value *cond_v = expr.CodeGen(context);
-        cond_v = context.builder->CreateICmpEQ(
-                cond_v, context.builder->getInt1(true), "ifcond");
+    llvm::Value *CodeGenContext::emitArrayBinaryOp(AST::BinaryOpType op, AST::DataType lhsType, AST::DataType rhsType,
+                                                   llvm::Value *lhs, llvm::Value *rhs) {
+        using builtins::Kernel;
+        const AST::DataType arrays = AST::DataType::IntArray;
+        llvm::Value *length = arrayLength(lhsType == arrays ? lhs : rhs);
+        if (lhsType == arrays && rhsType == arrays) {
+            llvm::Value *rhsLength = arrayLength(rhs);
+            emitCheck(builder->CreateICmpEQ(length, rhsLength), "lol_array_length_error", {length, rhsLength});
+        }
 
-        llvm::BasicBlock *thenBB = llvm::BasicBlock::Create(context.llvmCtx, "then", context.mainFunction);
-        llvm::BasicBlock *elseBB = llvm::BasicBlock::Create(context.llvmCtx, "else");
-        llvm::BasicBlock *mergeBB = llvm::BasicBlock::Create(context.llvmCtx, "merge");
+        Kernel kernel;
+        llvm::Value *a, *b;
+        if (lhsType == arrays && rhsType == arrays) {
+            kernel = op == AST::BinaryOpType::Sum ? Kernel::Add : op == AST::BinaryOpType::Sub ? Kernel::Sub : Kernel::Mul;
+            a = arrayData(arrays, lhs);
+            b = arrayData(arrays, rhs);
+        } else if (lhsType == arrays) {
+            kernel = op == AST::BinaryOpType::Sum ? Kernel::AddScalar :
+                     op == AST::BinaryOpType::Sub ? Kernel::SubScalar : Kernel::MulScalar;
+            a = arrayData(arrays, lhs);
+            b = rhs;
+        } else {
+            kernel = op == AST::BinaryOpType::Sum ? Kernel::AddScalar :
+                     op == AST::BinaryOpType::Sub ? Kernel::ScalarSub : Kernel::MulScalar;
+            a = arrayData(arrays, rhs);
+            b = lhs;
+        }
+        llvm::Value *result = emitNewArray(arrays, builder->CreateTrunc(length, builder->getInt32Ty()));
+        builder->CreateCall(builtins::GetKernel(*module, kernel), {arrayData(arrays, result), a, b, length});
+        return result;
+    }
 
-        context.builder->CreateCondBr(cond_v, thenBB, elseBB);
+    llvm::Value *CodeGenContext::emitProcedure(AST::Procedure proc, AST::DataType arrayType, llvm::Value *target,
+                                               llvm::Value *value) {
+        llvm::Value *length = arrayLength(target);
+        llvm::Value *data = arrayData(arrayType, target);
+        if (proc == AST::Procedure::Fill) {
+            if (arrayType == AST::DataType::BoolArray) {
+                return builder->CreateMemSet(data, builder->CreateZExt(value, builder->getInt8Ty()), length,
+                                             llvm::MaybeAlign(64));
+            }
+            return builder->CreateCall(builtins::GetKernel(*module, builtins::Kernel::Fill), {data, value, length});
+        }
 
-        context.builder->SetInsertPoint(thenBB);
-        llvm::Value *thenGen = on_if.CodeGen(context);
+        llvm::Value *sourceLength = arrayLength(value);
+        emitCheck(builder->CreateICmpEQ(length, sourceLength), "lol_array_length_error", {length, sourceLength});
 
-        context.builder->CreateBr(mergeBB);
-        thenBB = context.builder->GetInsertBlock();
+        // copy(a, a) copies an array onto itself
+        std::uint64_t elementSize = arrayType == AST::DataType::IntArray ? 4 : 1;
+        return builder->CreateMemMove(data, llvm::MaybeAlign(64), arrayData(arrayType, value), llvm::MaybeAlign(64),
+                                      builder->CreateMul(length, builder->getInt64(elementSize)));
+    }
 
-        context.mainFunction->getBasicBlockList().push_back(elseBB);
-        context.builder->SetInsertPoint(elseBB);
+    llvm::Value *CodeGenContext::emitIf(int line, std::size_t statements, llvm::Value *cond_v,
+                                        llvm::function_ref<llvm::Value *()> onIf,
+                                        llvm::function_ref<llvm::Value *()> onElse) {
+        llvm::Function *function = builder->GetInsertBlock()->getParent();
+        cond_v = builder->CreateICmpEQ(cond_v, builder->getInt1(true), "ifcond");
 
-        llvm::Value *elseGen = nullptr;
+        llvm::BasicBlock *thenBB = llvm::BasicBlock::Create(llvmCtx, "then", function);
+        llvm::BasicBlock *elseBB = llvm::BasicBlock::Create(llvmCtx, "else");
+        llvm::BasicBlock *mergeBB = llvm::BasicBlock::Create(llvmCtx, "merge");
 
-        if (on_else) {
-            elseGen = on_else->CodeGen(context);
-        } else {
-            elseGen = AST::Skip{}.CodeGen(context);
-        }
-        std::cout << "B4 assert: " << intptr_t(elseGen) << std::endl;
+        unsigned site = beginBranchSite('I', line, statements);
+        countBranch(2 * site);
+        weighBranch(builder->CreateCondBr(cond_v, thenBB, elseBB), site);
+
+        ++branchDepth;
+        builder->SetInsertPoint(thenBB);
+        countBranch(2 * site + 1);
+        llvm::Value *thenGen = onIf();
+
+        builder->CreateBr(mergeBB);
+        thenBB = builder->GetInsertBlock();
+
+        function->getBasicBlockList().push_back(elseBB);
+        builder->SetInsertPoint(elseBB);
+
+        llvm::Value *elseGen = onElse();
         assert(elseGen);
-        context.builder->CreateBr(mergeBB);
-        elseBB = context.builder->GetInsertBlock();
+        --branchDepth;
+        builder->CreateBr(mergeBB);
+        elseBB = builder->GetInsertBlock();
 
-        context.mainFunction->getBasicBlockList().push_back(mergeBB);
-        context.builder->SetInsertPoint(mergeBB);
-        llvm::PHINode *PN = context.builder->CreatePHI(context.builder->getInt1Ty(), 2, "iftmp");
+        function->getBasicBlockList().push_back(mergeBB);
+        builder->SetInsertPoint(mergeBB);
+        llvm::PHINode *PN = builder->CreatePHI(builder->getInt1Ty(), 2, "iftmp");
 
         PN->addIncoming(thenGen, thenBB);
         PN->addIncoming(elseGen, elseBB);
         return PN;
     }
 
-    llvm::Value *WhileLoop::CodeGen(codegen::CodeGenContext &context) {
-        llvm::BasicBlock *condBB = llvm::BasicBlock::Create(context.llvmCtx, "condloop", context.mainFunction);
-        llvm::BasicBlock *afterBB =
-                llvm::BasicBlock::Create(context.llvmCtx, "afterloop", context.mainFunction);
-        llvm::BasicBlock *loopBB =
-                llvm::BasicBlock::Create(context.llvmCtx, "loop", context.mainFunction);
+    llvm::Value *CodeGenContext::emitWhile(int line, std::size_t statements, bool counted,
+                                           const AST::LoopHints &hints,
+                                           llvm::function_ref<llvm::Value *()> cond,
+                                           llvm::function_ref<llvm::Value *()> body) {
+        llvm::Function *function = builder->GetInsertBlock()->getParent();
+        unsigned site = beginBranchSite('W', line, statements);
+
+        // both forms are one branch site, however many times they test the condition
+        auto test = [&](llvm::BasicBlock *loopBB, llvm::BasicBlock *afterBB) {
+            emitLine(line);
+            auto *end_cond_v = cond();
+            assert(end_cond_v);
+            end_cond_v = builder->CreateICmpNE(end_cond_v, builder->getInt1(false), "loopcond");
+            countBranch(2 * site);
+            llvm::BranchInst *branch = builder->CreateCondBr(end_cond_v, loopBB, afterBB);
+            weighBranch(branch, site);
+            return branch;
+        };
+        auto emitBody = [&]() {
+            ++branchDepth;
+            countBranch(2 * site + 1);
+            auto *body_v = body();
+            assert(body_v);
+            --branchDepth;
+        };
+
+        llvm::Instruction *latch;
+        llvm::BasicBlock *afterBB;
+        if (counted) {
+            // rotated: a guard, a dedicated preheader and the test at the bottom, in the latch
+            llvm::BasicBlock *preheaderBB = llvm::BasicBlock::Create(llvmCtx, "loop.preheader", function);
+            llvm::BasicBlock *loopBB = llvm::BasicBlock::Create(llvmCtx, "loop");
+            afterBB = llvm::BasicBlock::Create(llvmCtx, "afterloop");
+            test(preheaderBB, afterBB);
+
+            builder->SetInsertPoint(preheaderBB);
+            builder->CreateBr(loopBB);
+
+            function->getBasicBlockList().push_back(loopBB);
+            builder->SetInsertPoint(loopBB);
+            emitBody();
+            latch = test(loopBB, afterBB);
+            function->getBasicBlockList().push_back(afterBB);
+        } else {
+            llvm::BasicBlock *condBB = llvm::BasicBlock::Create(llvmCtx, "condloop", function);
+            afterBB = llvm::BasicBlock::Create(llvmCtx, "afterloop", function);
+            llvm::BasicBlock *loopBB = llvm::BasicBlock::Create(llvmCtx, "loop", function);
 
-        context.builder->CreateBr(condBB);
-        context.builder->SetInsertPoint(condBB);
+            builder->CreateBr(condBB);
+            builder->SetInsertPoint(condBB);
+            test(loopBB, afterBB);
 
-        auto *end_cond_v = expr.CodeGen(context);
-        assert(end_cond_v);
-        end_cond_v = context.builder->CreateICmpNE(
-                end_cond_v, context.builder->getInt1(false), "loopcond");
+            builder->SetInsertPoint(loopBB);
+            emitBody();
+            latch = builder->CreateBr(condBB);
+        }
+        if (llvm::MDNode *loopID = loopMetadata(hints)) {
+            latch->setMetadata(llvm::LLVMContext::MD_loop, loopID);
+        }
 
-        assert(end_cond_v);
+        builder->SetInsertPoint(afterBB);
+        return builder->getInt1(true);
+    }
 
-        context.builder->CreateCondBr(end_cond_v, loopBB, afterBB);
+    llvm::MDNode *CodeGenContext::loopMetadata(const AST::LoopHints &hints) {
+        llvm::SmallVector<llvm::Metadata *, 4> ops{nullptr}; // the node itself, loop IDs are distinct
+        auto add = [&](const char *name, llvm::Constant *value) {
+            ops.push_back(llvm::MDNode::get(llvmCtx, {llvm::MDString::get(llvmCtx, name),
+                                                      llvm::ConstantAsMetadata::get(value)}));
+        };
+        if (hints.unrollFull) {
+            ops.push_back(llvm::MDNode::get(llvmCtx, llvm::MDString::get(llvmCtx, "llvm.loop.unroll.full")));
+        } else if (hints.unroll == 0) {
+            ops.push_back(llvm::MDNode::get(llvmCtx, llvm::MDString::get(llvmCtx, "llvm.loop.unroll.disable")));
+        } else if (hints.unroll > 0) {
+            add("llvm.loop.unroll.count", builder->getInt32(hints.unroll));
+        }
+        if (hints.vectorize >= 0) {
+            add("llvm.loop.vectorize.enable", builder->getInt1(hints.vectorize == 1));
+        }
+        if (hints.vectorizeWidth > 0) {
+            add("llvm.loop.vectorize.width", builder->getInt32(hints.vectorizeWidth));
+        }
+        if (hints.interleaveCount > 0) {
+            add("llvm.loop.interleave.count", builder->getInt32(hints.interleaveCount));
+        }
+        if (ops.size() == 1) {
+            return nullptr;
+        }
+        llvm::MDNode *loopID = llvm::MDNode::getDistinct(llvmCtx, ops);
+        loopID->replaceOperandWith(0, loopID);
+        return loopID;
+    }
 
-        context.builder->SetInsertPoint(loopBB);
-        auto *body_v = code_block.CodeGen(context);
-        assert(body_v);
+    llvm::Value *CodeGenContext::emitParallelFor(const AST::ParallelFor &loop, llvm::Value *begin, llvm::Value *end,
+                                                 llvm::function_ref<llvm::Value *()> body) {
+        llvm::Type *i64 = builder->getInt64Ty();
+        llvm::Type *bytePtr = builder->getInt8PtrTy();
 
-        context.builder->CreateBr(condBB);
+        std::vector<llvm::Type *> fields;
+        for (AST::Identifier *ident: loop.shared) {
+            fields.push_back(getType(ident->type, llvmCtx));
+        }
+        for (const AST::Reduction &reduction: loop.reductions) {
+            fields.push_back(getType(reduction.ident->type, llvmCtx)->getPointerTo());
+        }
+        llvm::StructType *contextType = llvm::StructType::get(llvmCtx, fields);
+
+        llvm::BasicBlock &callerEntry = builder->GetInsertBlock()->getParent()->getEntryBlock();
+        llvm::AllocaInst *context = llvm::IRBuilder<>(&callerEntry, callerEntry.begin())
+                .CreateAlloca(contextType, nullptr, "parallel.context");
+        unsigned field = 0;
+        for (AST::Identifier *ident: loop.shared) {
+            builder->CreateStore(emitIdentifier(ident), builder->CreateStructGEP(contextType, context, field++));
+        }
+        for (const AST::Reduction &reduction: loop.reductions) {
+            builder->CreateStore(emitDeclare(reduction.ident), builder->CreateStructGEP(contextType, context, field++));
+        }
 
-        context.builder->SetInsertPoint(afterBB);
-        return Skip{}.CodeGen(context);
+        llvm::FunctionType *bodyType = llvm::FunctionType::get(builder->getVoidTy(), {bytePtr, i64, i64}, false);
+        llvm::Function *function = llvm::Function::Create(bodyType, llvm::GlobalValue::InternalLinkage,
+                                                          "lol.parallel", module.get());
+        function->addFnAttr(llvm::Attribute::NoUnwind);
+        llvm::IRBuilderBase::InsertPoint callerIP = builder->saveIP();
+        std::vector<llvm::Value *> callerVariables = std::move(variables);
+        variables.clear();
+
+        builder->SetInsertPoint(llvm::BasicBlock::Create(llvmCtx, "entry", function));
+        llvm::Value *contextArg = builder->CreateBitCast(function->getArg(0), contextType->getPointerTo());
+        field = 0;
+        for (AST::Identifier *ident: loop.shared) {
+            llvm::Value *value = builder->CreateLoad(fields[field], builder->CreateStructGEP(contextType, contextArg,
+                                                                                            field));
+            ++field;
+            builder->CreateStore(value, emitDeclare(ident));
+        }
+        std::vector<llvm::Value *> results;
+        for (const AST::Reduction &reduction: loop.reductions) {
+            results.push_back(builder->CreateLoad(fields[field], builder->CreateStructGEP(contextType, contextArg,
+                                                                                         field)));
+            ++field;
+            llvm::Value *identity = nullptr;
+            switch (reduction.op) {
+                case AST::ReductionOp::Sum: identity = builder->getInt32(0); break;
+                case AST::ReductionOp::Mult: identity = builder->getInt32(1); break;
+                case AST::ReductionOp::Min: identity = builder->getInt32(INT32_MAX); break;
+                case AST::ReductionOp::Max: identity = builder->getInt32(INT32_MIN); break;
+                case AST::ReductionOp::And: identity = builder->getInt1(true); break;
+                case AST::ReductionOp::Or: identity = builder->getInt1(false); break;
+            }
+            builder->CreateStore(identity, emitDeclare(reduction.ident));
+        }
+        llvm::Value *index = emitDeclare(loop.index);
+
+        llvm::Value *first = function->getArg(1), *last = function->getArg(2);
+        llvm::BasicBlock *preheaderBB = builder->GetInsertBlock();
+        llvm::BasicBlock *loopBB = llvm::BasicBlock::Create(llvmCtx, "loop", function);
+        llvm::BasicBlock *afterBB = llvm::BasicBlock::Create(llvmCtx, "afterloop");
+        builder->CreateCondBr(builder->CreateICmpSLT(first, last), loopBB, afterBB);
+        builder->SetInsertPoint(loopBB);
+        llvm::PHINode *i = builder->CreatePHI(i64, 2, "i");
+        i->addIncoming(first, preheaderBB);
+        builder->CreateStore(builder->CreateTrunc(i, builder->getInt32Ty()), index);
+        body();
+        llvm::Value *next = builder->CreateAdd(i, builder->getInt64(1), "i.next", true, true);
+        i->addIncoming(next, builder->GetInsertBlock());
+        builder->CreateCondBr(builder->CreateICmpSLT(next, last), loopBB, afterBB);
+
+        function->getBasicBlockList().push_back(afterBB);
+        builder->SetInsertPoint(afterBB);
+        if (!loop.reductions.empty()) {
+            builder->CreateCall(runtimeFunction("lol_parallel_lock", builder->getVoidTy(), {}));
+            for (std::size_t k = 0; k < loop.reductions.size(); ++k) {
+                const AST::Reduction &reduction = loop.reductions[k];
+                llvm::Type *type = getType(reduction.ident->type, llvmCtx);
+                llvm::Value *total = builder->CreateLoad(type, results[k]);
+                llvm::Value *part = builder->CreateLoad(type, variable(reduction.ident));
+                llvm::Value *sum = nullptr;
+                switch (reduction.op) {
+                    case AST::ReductionOp::Sum: sum = builder->CreateAdd(total, part); break;
+                    case AST::ReductionOp::Mult: sum = builder->CreateMul(total, part); break;
+                    case AST::ReductionOp::Min:
+                        sum = builder->CreateSelect(builder->CreateICmpSLT(part, total), part, total);
+                        break;
+                    case AST::ReductionOp::Max:
+                        sum = builder->CreateSelect(builder->CreateICmpSGT(part, total), part, total);
+                        break;
+                    case AST::ReductionOp::And: sum = builder->CreateAnd(total, part); break;
+                    case AST::ReductionOp::Or: sum = builder->CreateOr(total, part); break;
+                }
+                builder->CreateStore(sum, results[k]);
+            }
+            builder->CreateCall(runtimeFunction("lol_parallel_unlock", builder->getVoidTy(), {}));
+        }
+        builder->CreateRetVoid();
+
+        variables = std::move(callerVariables);
+        builder->restoreIP(callerIP);
+        bool counters = profileLines || !pgoGenerate.empty();
+        builder->CreateCall(
+                runtimeFunction("lol_parallel_for", builder->getVoidTy(),
+                                {i64, i64, i64, builder->getInt32Ty(), bodyType->getPointerTo(), bytePtr}),
+                {builder->CreateSExt(begin, i64), builder->CreateSExt(end, i64), builder->getInt64(parallelGrain),
+                 builder->getInt32(counters ? 1 : parallelThreads), function,
+                 builder->CreateBitCast(context, bytePtr)});
+        // the index is left at the end of the range, or at its start when the range is empty
+        builder->CreateStore(builder->CreateSelect(builder->CreateICmpSLT(begin, end), end, begin),
+                             emitDeclare(loop.index));
+        return builder->getInt1(true);
     }
 
-    llvm::Value *PrintStatement::CodeGen(codegen::CodeGenContext &context) {
-        std::cout << "Inside PrintStatement codegen" << std::endl;
-        auto *v = e->CodeGen(context);
-        std::cout << "value to be printed is calculated" << std::endl;
+    void CodeGenContext::emitLine(int line) {
+        if (!profileLines || line <= 0) {
+            return;
+        }
+        maxLine = std::max(maxLine, line);
+        builder->CreateCall(runtimeFunction("lol_line_profile_hit", builder->getVoidTy(), {builder->getInt32Ty()}),
+                            {builder->getInt32(line)});
+    }
+
+    unsigned CodeGenContext::beginBranchSite(char kind, int line, std::size_t statements) {
+        branchHash = pgo::MixSite(branchHash, kind, branchDepth, unsigned(line), statements);
+        return branchSites++;
+    }
+
+    void CodeGenContext::countBranch(unsigned counter) {
+        if (pgoGenerate.empty()) {
+            return;
+        }
+        llvm::Type *i64 = builder->getInt64Ty();
+        if (!pgoCounters) {
+            pgoCounters = new llvm::GlobalVariable(*module, i64, false, llvm::GlobalValue::ExternalLinkage, nullptr,
+                                                   "lol.pgo.counters.tmp");
+        }
+        llvm::Value *address = builder->CreateConstInBoundsGEP1_64(i64, pgoCounters, counter);
+        builder->CreateStore(builder->CreateAdd(builder->CreateLoad(i64, address), builder->getInt64(1)), address);
+    }
+
+    void CodeGenContext::weighBranch(llvm::BranchInst *branch, unsigned site) {
+        if (!pgoProfile || 2 * site + 1 >= pgoProfile->counters.size()) {
+            return; // a mismatch is reported by finishProfile
+        }
+        std::uint64_t evaluated = pgoProfile->counters[2 * site];
+        std::uint64_t taken = std::min(pgoProfile->counters[2 * site + 1], evaluated);
+        if (evaluated == 0) {
+            return; // never reached, the defaults are as good as anything
+        }
+        // weights are 32-bit, only their ratio matters
+        std::uint64_t scale = evaluated / std::numeric_limits<std::uint32_t>::max() + 1;
+        branch->setMetadata(llvm::LLVMContext::MD_prof, llvm::MDBuilder(llvmCtx).createBranchWeights(
+                std::uint32_t(taken / scale), std::uint32_t((evaluated - taken) / scale)));
+    }
+
+    void CodeGenContext::finishProfile() {
+        if (!pgoGenerate.empty()) {
+            llvm::Type *i64 = builder->getInt64Ty();
+            llvm::Type *i64ptr = i64->getPointerTo();
+            llvm::Value *counters = llvm::ConstantPointerNull::get(llvm::PointerType::getUnqual(i64));
+            if (pgoCounters) {
+                auto *arrayType = llvm::ArrayType::get(i64, 2 * branchSites);
+                auto *array = new llvm::GlobalVariable(*module, arrayType, false, llvm::GlobalValue::InternalLinkage,
+                                                       llvm::ConstantAggregateZero::get(arrayType), "lol.pgo.counters");
+                counters = llvm::ConstantExpr::getBitCast(array, i64ptr);
+                pgoCounters->replaceAllUsesWith(counters);
+                pgoCounters->eraseFromParent();
+                pgoCounters = nullptr;
+            }
+            builder->CreateCall(
+                    runtimeFunction("lol_profile_write", builder->getVoidTy(),
+                                    {builder->getInt8PtrTy(), i64, i64ptr, i64}),
+                    {builder->CreateGlobalStringPtr(pgoGenerate, "lol.pgo.path"), builder->getInt64(branchHash),
+                     counters, builder->getInt64(2 * branchSites)});
+        }
+        if (pgoProfile) {
+            if (pgoProfile->hash != branchHash || pgoProfile->counters.size() != 2 * branchSites) {
+                throw std::runtime_error("The profile does not match the program, it has changed since the profile "
+                                         "was collected (or was compiled with other options)");
+            }
+            mainFunction->setEntryCount(pgoProfile->runs);
+            std::vector<std::uint64_t> counts{pgoProfile->runs};
+            for (std::size_t i = 0; i < pgoProfile->counters.size(); i += 2) {
+                counts.push_back(pgoProfile->counters[i + 1]);
+                counts.push_back(pgoProfile->counters[i] - std::min(pgoProfile->counters[i + 1], pgoProfile->counters[i]));
+            }
+            llvm::InstrProfSummaryBuilder summary(llvm::ProfileSummaryBuilder::DefaultCutoffs);
+            summary.addRecord(llvm::InstrProfRecord(std::move(counts)));
+            module->setProfileSummary(summary.getSummary()->getMD(llvmCtx), llvm::ProfileSummary::PSK_Instr);
+        }
+    }
+
+    llvm::Value *CodeGenContext::emitPrint(AST::DataType type, llvm::Value *v) {
         assert(v);
-        std::vector<llvm::Value *> args;
-        if (e->type == DataType::String) {
-            args.push_back(context.fmtStr);
+        switch (type) {
+            case AST::DataType::Int:
+                return builder->CreateCall(
+                        runtimeFunction("lol_print_int", builder->getVoidTy(), {builder->getInt32Ty()}), {v});
+            case AST::DataType::Bool:
+                return builder->CreateCall(
+                        runtimeFunction("lol_print_bool", builder->getVoidTy(), {builder->getInt32Ty()}),
+                        {builder->CreateZExt(v, builder->getInt32Ty())});
+            case AST::DataType::IntArray:
+                return builder->CreateCall(
+                        runtimeFunction("lol_print_int_array", builder->getVoidTy(), {builder->getInt8PtrTy()}), {v});
+            case AST::DataType::BoolArray:
+                return builder->CreateCall(
+                        runtimeFunction("lol_print_bool_array", builder->getVoidTy(), {builder->getInt8PtrTy()}), {v});
+            default:
+                return builder->CreateCall(
+                        runtimeFunction("lol_print_string", builder->getVoidTy(), {builder->getInt8PtrTy()}), {v});
+        }
+    }
+
+    llvm::Value *CodeGenContext::emitCall(AST::Builtin fn, llvm::ArrayRef<llvm::Value *> args) {
+        if (fn == AST::Builtin::Len) {
+            return builder->CreateTrunc(arrayLength(args[0]), builder->getInt32Ty());
+        }
+        if (fn == AST::Builtin::Sum || args.size() == 1 && (fn == AST::Builtin::Min || fn == AST::Builtin::Max)) {
+            auto kernel = fn == AST::Builtin::Sum ? builtins::Kernel::Sum :
+                          fn == AST::Builtin::Min ? builtins::Kernel::Min : builtins::Kernel::Max;
+            return builder->CreateCall(builtins::GetKernel(*module, kernel),
+                                       {arrayData(AST::DataType::IntArray, args[0]), arrayLength(args[0])});
+        }
+        auto *exponent = fn == AST::Builtin::Pow ? llvm::dyn_cast<llvm::ConstantInt>(args[1]) : nullptr;
+        if (exponent && !exponent->isNegative()) {
+            // square-and-multiply unrolled for the bits of the exponent
+            std::uint32_t bits = exponent->getZExtValue();
+            llvm::Value *result = builder->getInt32(1);
+            llvm::Value *square = args[0];
+            bool first = true;
+            for (; bits; bits >>= 1) {
+                if (bits & 1) {
+                    result = first ? square : builder->CreateMul(result, square);
+                    first = false;
+                }
+                if (bits > 1) {
+                    square = builder->CreateMul(square, square);
+                }
+            }
+            return result;
+        }
+        return builder->CreateCall(builtins::Get(*module, fn), args);
+    }
+}
+
+namespace AST {
+    llvm::Value *CodeBlock::CodeGen(codegen::CodeGenContext &context) {
+        TRACE(Codegen, Debug) << "Generating block...";
+        int i = 0;
+        for (auto &st: statements) {
+            TRACE(Codegen, Debug) << ++i << " statement:";
+            if (!dynamic_cast<WhileLoop *>(st)) {
+                context.emitLine(st->line);
+            }
+            st->CodeGen(context);
+        }
+        return context.builder->getInt1(true);
+    }
+
+    // expressions
+    llvm::Value *ConstantInt::CodeGen(codegen::CodeGenContext &context) {
+        TRACE(Codegen, Debug) << "Generating constant i32...";
+        return context.builder->getInt32(val);
+    }
+
+    llvm::Value *ConstantBool::CodeGen(codegen::CodeGenContext &context) {
+        TRACE(Codegen, Debug) << "Generating constant i1...";
+        return context.builder->getInt1(val);
+    }
+
+    llvm::Value *ConstantString::CodeGen(codegen::CodeGenContext &context) {
+        TRACE(Codegen, Debug) << "Generating constant string...";
+        return context.emitString(val);
+    }
+
+    llvm::Value *Identifier::CodeGen(codegen::CodeGenContext &context) {
+        if (context.variable(this)) {
+            TRACE(Codegen, Debug) << "Extracting " << name << "...";
         } else {
-            args.push_back(context.fmtInt);
+            TRACE(Codegen, Debug) << "Generating Ident with name \"" << name << "\"...";
+        }
+        return context.emitIdentifier(this);
+    }
+
+    llvm::Value *UnaryOp::CodeGen(codegen::CodeGenContext &context) {
+        TRACE(Codegen, Debug) << "Generating unary op...";
+        return context.emitUnaryOp(op, expr->CodeGen(context));
+    }
+
+    llvm::Value *NewArray::CodeGen(codegen::CodeGenContext &context) {
+        return context.emitNewArray(type, length->CodeGen(context));
+    }
+
+    llvm::Value *ArrayLiteral::CodeGen(codegen::CodeGenContext &context) {
+        std::vector<llvm::Value *> values;
+        for (Expression *e: elements) {
+            values.push_back(e->CodeGen(context));
+        }
+        return context.emitArrayLiteral(type, values);
+    }
+
+    llvm::Value *Index::CodeGen(codegen::CodeGenContext &context) {
+        llvm::Value *array_v = array->CodeGen(context);
+        llvm::Value *index_v = index->CodeGen(context);
+        return context.emitIndex(array->type, array_v, index_v);
+    }
+
+    llvm::Value *Call::CodeGen(codegen::CodeGenContext &context) {
+        TRACE(Codegen, Debug) << "Generating call of " << BuiltinName(fn) << "...";
+        std::vector<llvm::Value *> values;
+        for (Expression *arg: args) {
+            values.push_back(arg->CodeGen(context));
         }
-        args.push_back(v);
-        return context.builder->CreateCall(context.printfF, makeArrayRef(args), "print");
+        return context.emitCall(fn, values);
+    }
+
+    llvm::Value *BinaryOp::CodeGen(codegen::CodeGenContext &context) {
+        TRACE(Codegen, Debug) << "Generating binary op...";
+        llvm::Value *lhs_v = lhs->CodeGen(context);
+        llvm::Value *rhs_v = rhs->CodeGen(context);
+        if (type == DataType::IntArray) {
+            return context.emitArrayBinaryOp(op, lhs->type, rhs->type, lhs_v, rhs_v);
+        }
+        return context.emitBinaryOp(op, lhs->type, lhs_v, rhs_v);
+    }
+
+    // statements
+    llvm::Value *Skip::CodeGen(codegen::CodeGenContext &context) {
+        return context.builder->getInt1(true);
+    }
+
+    llvm::Value *VarDecl::CodeGen(codegen::CodeGenContext &context) {
+        TRACE(Codegen, Debug) << "Generating declaration for " << ident->name << "...";
+        context.emitDeclare(ident);
+
+        VarAssign va(ident, expr);
+        return va.CodeGen(context);
+    }
+
+    llvm::Value *VarAssign::CodeGen(codegen::CodeGenContext &context) {
+        TRACE(Codegen, Debug) << "Generating assignment for " << ident->name << "...";
+        return context.emitAssign(ident, expr->CodeGen(context));
+    }
+
+    llvm::Value *IndexAssign::CodeGen(codegen::CodeGenContext &context) {
+        TRACE(Codegen, Debug) << "Generating element assignment for " << ident->name << "...";
+        llvm::Value *index_v = index->CodeGen(context);
+        return context.emitIndexAssign(ident, index_v, expr->CodeGen(context));
+    }
+
+    llvm::Value *ProcedureCall::CodeGen(codegen::CodeGenContext &context) {
+        llvm::Value *target_v = target->CodeGen(context);
+        return context.emitProcedure(proc, target->type, target_v, value->CodeGen(context));
+    }
+
+    llvm::Value *IfStatement::CodeGen(codegen::CodeGenContext &context) {
+        std::size_t statements = on_if->statements.size() + (on_else ? on_else->statements.size() : 0);
+        return context.emitIf(
+                line, statements, expr->CodeGen(context),
+                [&]() { return on_if->CodeGen(context); },
+                [&]() { return on_else ? on_else->CodeGen(context) : AST::Skip{}.CodeGen(context); });
+    }
+
+    llvm::Value *WhileLoop::CodeGen(codegen::CodeGenContext &context) {
+        return context.emitWhile(
+                line, code_block->statements.size(), isCounted(), hints,
+                [&]() { return expr->CodeGen(context); },
+                [&]() { return code_block->CodeGen(context); });
+    }
+
+    llvm::Value *ParallelFor::CodeGen(codegen::CodeGenContext &context) {
+        llvm::Value *begin_v = begin->CodeGen(context);
+        llvm::Value *end_v = end->CodeGen(context);
+        return context.emitParallelFor(*this, begin_v, end_v, [&]() { return body->CodeGen(context); });
+    }
+
+    llvm::Value *PrintStatement::CodeGen(codegen::CodeGenContext &context) {
+        TRACE(Codegen, Debug) << "Inside PrintStatement codegen";
+        auto *v = e->CodeGen(context);
+        TRACE(Codegen, Debug) << "value to be printed is calculated";
+        return context.emitPrint(e->type, v);
     }
 
 }
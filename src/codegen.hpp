@@ -1,6 +1,7 @@
 #pragma once
 
 #include "decl.hpp"
+#include "pgo.hpp"
 
 #include <llvm/IR/Value.h>
 #include <llvm/IR/Module.h>
@@ -9,36 +10,227 @@
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/ExecutionEngine/GenericValue.h>
 #include <llvm/IR/LLVMContext.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/ADT/STLFunctionalExtras.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/IR/PassInstrumentation.h>
+#include <llvm/Support/Error.h>
 
+namespace llvm::orc {
+    class LLJIT;
+}
+
+#include <memory>
+#include <ostream>
+#include <stdexcept>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 namespace codegen {
     struct CodeGenContext {
 
-        llvm::LLVMContext llvmCtx;
-        llvm::Module *module;
-        llvm::IRBuilder<> *builder{};
+        llvm::orc::ThreadSafeContext tsCtx; // shared with the JIT, which compiles on its own threads
+        llvm::LLVMContext &llvmCtx;
+        std::unique_ptr<llvm::Module> module; // moved to the JIT by runCode
+        std::unique_ptr<llvm::IRBuilder<>> builder;
         llvm::BasicBlock *basicBlock{}; // sequence of inst
-        std::unordered_map<std::string, llvm::Value *> variables;
+        std::vector<llvm::Value *> variables; // address of every variable by Identifier::slot, null until declared
         llvm::Function *mainFunction = nullptr;
         AST::CodeBlock *astBlock = nullptr; // ast is here
+        bool useFlatAst = false; // generate code from the flat layout of astBlock (flat_ast.hpp)
 
         llvm::BasicBlock *printBlock = nullptr;
 
-        llvm::Value *fmtInt = nullptr;
-        llvm::Value *fmtStr = nullptr;
-        llvm::FunctionCallee printfCallee;
+        // String constants already emitted: lol_string descriptors (runtime/lolrt.h) as i8*
+        std::unordered_map<std::string, llvm::Value *> stringPool;
+
+        std::unique_ptr<llvm::TargetMachine> targetMachine; // host triple, used by the optimizer and object emission
+
+        // profile-guided optimization (pgo.hpp), set before generateCode: with pgoGenerate the branch sites of
+        // emitIf/emitWhile count their outcomes and main writes the profile to that file, with pgoProfile
+        // the counts become branch weights
+        std::string pgoGenerate;
+        const pgo::Profile *pgoProfile = nullptr;
+        unsigned branchSites = 0;
+        unsigned branchDepth = 0; // of the site being emitted
+        std::uint64_t branchHash = pgo::kEmptyHash;
+        llvm::GlobalVariable *pgoCounters = nullptr; // an i64 placeholder until the number of counters is known
 
-        llvm::Function *printfF;
+        // --profile: every statement reports its line to the runtime, which prints the time and hits
+        // of every line of profileSource when main ends
+        bool profileLines = false;
+        std::string profileSource;
+        int maxLine = 0;
+
+        // parallel for: the threads and the grain passed to lol_parallel_for (runtime/lolrt.h), 0 lets the runtime
+        // choose; the loops run on one thread with --profile and --pgo-gen, whose counters are not atomic
+        unsigned parallelThreads = 0;
+        std::uint64_t parallelGrain = 0;
 
         CodeGenContext();
 
+        // empty cpu/features mean the ones of the host
+        void initTarget(const std::string &cpu = "", const std::string &features = "");
+
         void generateCode();
 
+        // generateCode in parts, for a body generated statement by statement (--stream, parsing_context.hpp):
+        // beginMain creates main and puts the builder at its entry, finishMain ends it
+        void beginMain();
+
+        void finishMain();
+
+        // generates `void name(i64 *slots)` that runs loop to completion, the variable slotVariables[i]
+        // lives in slots[i] instead of an alloca (used by the bytecode VM to promote hot loops, vm.hpp)
+        llvm::Function *generateLoop(const std::string &name, AST::WhileLoop &loop,
+                                     const std::vector<AST::Identifier *> &slotVariables);
+
+        // numbers a new branch site of the given kind ('I' or 'W')
+        unsigned beginBranchSite(char kind, int line, std::size_t statements);
+
+        // increments the counter at the insert point (--pgo-gen)
+        void countBranch(unsigned counter);
+
+        // attaches the weights of the site from the profile (--pgo-use)
+        void weighBranch(llvm::BranchInst *branch, unsigned site);
+
+        // the end of main: the profile is written (--pgo-gen), or checked against the program and its
+        // entry count and summary are attached (--pgo-use)
+        void finishProfile();
+
+        // declaration of a function of runtime/lolrt.h
+        llvm::FunctionCallee runtimeFunction(const char *name, llvm::Type *result, llvm::ArrayRef<llvm::Type *> params);
+
+        // prints the textual IR of the module
+        void dumpCode(std::ostream &out) const;
+
+        // runs the new-PassManager default pipeline for -O<optLevel>, no-op for -O0;
+        // instrumentation, if any, is notified about every pass (timing.hpp)
+        void optimize(unsigned optLevel, llvm::PassInstrumentationCallbacks *instrumentation = nullptr);
+
+        // moves runs of the top-level statements of main (the code between two blocks that dominate its return)
+        // into functions of their own, `main.region`, once they have at least minInstructions instructions; the
+        // variables of main are promoted to registers first, so that they are passed by value. Returns how many
+        // runs were outlined
+        unsigned outlineRegions(unsigned minInstructions);
+
+        // splits the module into partitions (llvm::SplitModule), every one of which is optimized for -O<optLevel>
+        // and compiled to an object file on a thread of its own, in an LLVMContext of its own; the objects are
+        // linked into object_fname (a relocatable object) and/or executable_fname, unless they are empty.
+        // The locals of the module are made external
+        void saveSplit(unsigned partitions, unsigned optLevel, const std::string &object_fname,
+                       const std::string &executable_fname);
+
         void saveCode(const std::string &output_fname) const;
 
-        llvm::GenericValue runCode() const;
+        void saveBitcode(const std::string &output_fname) const;
+
+        void saveObject(const std::string &output_fname) const;
+
+        // emits a temporary object file and links it with the runtime library (liblolrt.a next to the compiler)
+        // using the system C compiler driver
+        void saveExecutable(const std::string &output_fname) const;
+
+        // IR emission for every kind of node, shared by the virtual CodeGen of the tree
+        // and by the codegen over the flat layout (flat_ast.hpp); operands are already generated
+        llvm::Value *emitString(const std::string &val);
+
+        // the entry of variables for ident, which grows to cover its slot
+        llvm::Value *&variable(const AST::Identifier *ident);
+
+        // allocates the variable (once) and returns its address
+        llvm::Value *emitDeclare(AST::Identifier *ident);
+
+        // loads the value of the variable
+        llvm::Value *emitIdentifier(AST::Identifier *ident);
+
+        llvm::Value *emitUnaryOp(AST::UnaryOpType op, llvm::Value *v);
+
+        llvm::Value *emitBinaryOp(AST::BinaryOpType op, AST::DataType operandsType, llvm::Value *lhs, llvm::Value *rhs);
+
+        llvm::Value *emitAssign(AST::Identifier *ident, llvm::Value *v);
+
+        // arrays (runtime/lolrt.h): the fields of the header are loaded as invariant, so they are hoisted
+        // out of loops; the length is i64, the data is i32* for Int[] and i8* for Bool[]
+        llvm::Value *arrayLength(llvm::Value *array);
+
+        llvm::Value *arrayData(AST::DataType arrayType, llvm::Value *array);
+
+        // continues if ok is true, calls the noreturn function error of the runtime with args otherwise;
+        // the branch is weighted as almost always taken
+        void emitCheck(llvm::Value *ok, const char *error, llvm::ArrayRef<llvm::Value *> args);
+
+        // length is an Int
+        llvm::Value *emitNewArray(AST::DataType arrayType, llvm::Value *length);
+
+        llvm::Value *emitArrayLiteral(AST::DataType arrayType, llvm::ArrayRef<llvm::Value *> elements);
+
+        // address of array[index] after a bounds check: a branch that is likely to be taken, on an unsigned
+        // comparison of the Int index with the length, to a cold call of lol_array_index_error. In a loop over
+        // the indices the check is removed from the main part of the loop by IRCE (see optimize)
+        llvm::Value *emitElementAddress(AST::DataType arrayType, llvm::Value *array, llvm::Value *index);
+
+        llvm::Value *emitIndex(AST::DataType arrayType, llvm::Value *array, llvm::Value *index);
+
+        llvm::Value *emitIndexAssign(AST::Identifier *ident, llvm::Value *index, llvm::Value *v);
+
+        // elementwise +, -, * with an Int[] operand, into a new array by a kernel of builtins.hpp
+        llvm::Value *emitArrayBinaryOp(AST::BinaryOpType op, AST::DataType lhsType, AST::DataType rhsType,
+                                       llvm::Value *lhs, llvm::Value *rhs);
+
+        // fill(target, value) and copy(target, value)
+        llvm::Value *emitProcedure(AST::Procedure proc, AST::DataType arrayType, llvm::Value *target,
+                                   llvm::Value *value);
+
+        llvm::Value *emitIf(int line, std::size_t statements, llvm::Value *cond,
+                            llvm::function_ref<llvm::Value *()> onIf, llvm::function_ref<llvm::Value *()> onElse);
+
+        // line is reported every time the condition is evaluated, so emitLine isn't called for loops;
+        // a counted loop (WhileLoop::isCounted) is emitted rotated, the hints go to the llvm.loop of the latch
+        llvm::Value *emitWhile(int line, std::size_t statements, bool counted, const AST::LoopHints &hints,
+                               llvm::function_ref<llvm::Value *()> cond, llvm::function_ref<llvm::Value *()> body);
+
+        // llvm.loop metadata with the hints, nullptr if there are none
+        llvm::MDNode *loopMetadata(const AST::LoopHints &hints);
+
+        // the body is outlined into `void lol.parallel(i8 *context, i64 begin, i64 end)` running the iterations
+        // [begin, end) with its own copies of loop.shared and of the reduction variables, which start at the
+        // identity of their operation and are added to the variables of the caller under lol_parallel_lock; the
+        // context holds the values of loop.shared and the addresses of the reduction variables
+        llvm::Value *emitParallelFor(const AST::ParallelFor &loop, llvm::Value *begin, llvm::Value *end,
+                                     llvm::function_ref<llvm::Value *()> body);
+
+        llvm::Value *emitPrint(AST::DataType type, llvm::Value *v);
+
+        // the statement of line starts here (--profile)
+        void emitLine(int line);
+
+        // call of a builtin function (builtins.hpp); pow with a constant exponent is expanded into multiplications,
+        // len, sum and min, max of one argument work on the array given
+        llvm::Value *emitCall(AST::Builtin fn, llvm::ArrayRef<llvm::Value *> args);
+
+        // runs main on an ORC LLJIT session, functions are compiled lazily on first call
+        llvm::GenericValue runCode();
+
+        // adds the code to a JIT that outlives this context (the compile server) and passes main to run, the code is
+        // removed from it afterwards; returns what run returned
+        int runIn(llvm::orc::LLJIT &jit, llvm::function_ref<int(int (*)())> run);
     };
 
+    // errors of LLVM the compiler can't recover from, as exceptions
+    template<class T>
+    T unwrap(llvm::Expected<T> value) {
+        if (!value) {
+            throw std::runtime_error("[internal error] " + llvm::toString(value.takeError()));
+        }
+        return std::move(*value);
+    }
+
+    void unwrap(llvm::Error err);
+
+    // a JIT for the host on which the runtime (lolrt.h) is resolved against the symbols of the process itself,
+    // for the VM, the compile server and the benchmarks
+    std::unique_ptr<llvm::orc::LLJIT> CreateHostJIT();
+
 } // namespace codegen
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <vector>
 
 namespace codegen {
@@ -9,6 +10,9 @@ namespace AST {
     enum class DataType;
     enum class UnaryOpType;
     enum class BinaryOpType;
+    enum class Builtin;
+    enum class Procedure;
+    enum class ReductionOp;
 
     struct Node;
     struct Expression;
@@ -20,12 +24,25 @@ namespace AST {
     struct Constant;
     struct UnaryOp;
     struct BinaryOp;
+    struct NewArray;
+    struct ArrayLiteral;
+    struct Index;
+    struct Call;
 
     struct Skip;
     struct VarDecl;
     struct VarAssign;
+    struct IndexAssign;
+    struct ProcedureCall;
     struct WhileLoop;
     struct IfStatement;
+    struct ParallelFor;
+
+    struct LoopHints;
+    struct Reduction;
 
     using StatementList = std::vector<Statement *>;
+
+    // an interned name: equal names of a file have the same number (parsingcontext::SymbolTable)
+    using Symbol = std::uint32_t;
 }
\ No newline at end of file
@@ -0,0 +1,304 @@
+#include "driver.hpp"
+
+#include "node.hpp"
+#include "codegen.hpp"
+#include "parsing_context.hpp"
+#include "fold.hpp"
+#include "peval.hpp"
+#include "pgo.hpp"
+#include "vm.hpp"
+#include "flat_ast.hpp"
+#include "timing.hpp"
+#include "trace.hpp"
+
+#include <llvm/Support/FileSystem.h>
+
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+namespace {
+    void CountNodes(const AST::CodeBlock &root, timing::TimeReport &report) {
+        AST::flat::Tree tree = AST::flat::Flatten(root);
+        for (const AST::flat::Expr &e: tree.exprs) {
+            report.count(std::string("ast.") + AST::flat::KindName(e.kind), 1);
+        }
+        for (const AST::flat::Stmt &st: tree.stmts) {
+            report.count(std::string("ast.") + AST::flat::KindName(st.kind), 1);
+        }
+        report.count("ast.CodeBlock", tree.blocks.size());
+    }
+
+    void CountIR(const llvm::Module &module, const std::string &prefix, timing::TimeReport &report) {
+        std::size_t blocks = 0, instructions = 0;
+        for (const llvm::Function &f: module) {
+            blocks += f.size();
+            instructions += f.getInstructionCount();
+        }
+        report.count(prefix + ".blocks", blocks);
+        report.count(prefix + ".instructions", instructions);
+    }
+
+    // reports of the files of a batch are written one at a time
+    std::mutex reportMutex;
+
+    void PrintReport(const options::CompilerOptions &opts, const timing::TimeReport &report) {
+        if (!report.isEnabled()) {
+            return;
+        }
+        bool json = opts.timeReport == options::TimeReport::Json;
+        std::lock_guard<std::mutex> lock(reportMutex);
+        if (opts.timeReportFile.empty()) {
+            report.print(std::cerr, json);
+            return;
+        }
+        std::ofstream out(opts.timeReportFile, std::ios_base::app);
+        if (!out) {
+            throw std::runtime_error("Can't open " + opts.timeReportFile);
+        }
+        report.print(out, json);
+    }
+
+    // the numbers go to --time-report, the list of what was removed to --trace=ast
+    void ReportFolding(const AST::FoldReport &folding, timing::TimeReport &report) {
+        report.count("fold.expressions", folding.foldedExpressions);
+        report.count("fold.removedStatements", folding.removedStatements);
+        TRACE(Ast, Info) << "Folding: " << folding.foldedExpressions << " expression(s) folded, "
+                         << folding.removedStatements << " dead statement(s) removed";
+        for (auto &what: folding.removed) {
+            TRACE(Ast, Info) << "    removed " << what;
+        }
+    }
+
+    // the settings of codegen that don't depend on the tree; profile is the one of --pgo-use
+    void SetUpCodeGen(const options::CompilerOptions &opts, const std::string &input, codegen::CodeGenContext &codegen,
+                      pgo::Profile &profile, timing::TimeReport &report) {
+        {
+            auto phase = report.phase("target");
+            codegen.initTarget(opts.cpu, opts.features);
+        }
+        if (!opts.pgoUse.empty()) {
+            auto phase = report.phase("read-profile");
+            profile = pgo::Read(opts.pgoUse);
+            codegen.pgoProfile = &profile;
+        }
+        codegen.pgoGenerate = opts.pgoGenerate;
+        codegen.parallelThreads = opts.threads;
+        codegen.parallelGrain = opts.grain;
+        if (opts.profile) {
+            // an executable may run in another directory
+            llvm::SmallString<128> source(input);
+            llvm::sys::fs::make_absolute(source);
+            codegen.profileLines = true;
+            codegen.profileSource = source.str().str();
+        }
+    }
+
+    // --stream: main is generated while the file is parsed, one statement at a time. Only the nodes of a statement
+    // are released after it; its IR stays in main until the whole module is done
+    void StreamFile(const options::CompilerOptions &opts, const std::string &input, codegen::CodeGenContext &codegen,
+                    parsingcontext::ParsingContext &parsing, timing::TimeReport &report) {
+        AST::FoldReport folding;
+        parsing.onStatement = [&](AST::Statement *st) {
+            // a block of its own, so that folding can remove the statement or replace it by its branch
+            AST::CodeBlock block(AST::StatementList{st});
+            if (opts.fold) {
+                AST::FoldReport part = AST::FoldConstants(block, parsing.arena);
+                folding.foldedExpressions += part.foldedExpressions;
+                folding.removedStatements += part.removedStatements;
+                folding.removed.insert(folding.removed.end(), part.removed.begin(), part.removed.end());
+            }
+            if (report.isEnabled()) {
+                CountNodes(block, report);
+            }
+            block.CodeGen(codegen);
+        };
+        {
+            auto phase = report.phase("parse+codegen");
+            codegen.beginMain();
+            codegen.astBlock = parsingcontext::ParseFile(input, parsing);
+            codegen.finishMain();
+        }
+        report.count("tokens", parsing.tokens);
+        if (opts.fold) {
+            ReportFolding(folding, report);
+        }
+    }
+}
+
+namespace driver {
+    void CompileFile(const options::CompilerOptions &opts, const std::string &input, const std::string &output) {
+        timing::TimeReport report(input, opts.timeReport != options::TimeReport::None);
+        parsingcontext::ParsingContext parsing;
+        codegen::CodeGenContext codegen;
+        pgo::Profile profile;
+
+        if (opts.stream) {
+            SetUpCodeGen(opts, input, codegen, profile, report);
+            StreamFile(opts, input, codegen, parsing, report);
+        } else {
+            {
+                auto phase = report.phase("parse");
+                codegen.astBlock = parsingcontext::ParseFile(input, parsing);
+            }
+            report.count("tokens", parsing.tokens);
+
+            if (opts.fold) {
+                auto phase = report.phase("fold");
+                ReportFolding(AST::FoldConstants(*codegen.astBlock, parsing.arena), report);
+            }
+            if (opts.peval) {
+                AST::EvalBudget budget;
+                budget.fuel = opts.pevalFuel;
+                budget.memory = opts.pevalMemory;
+                auto phase = report.phase("peval");
+                AST::PartialEvalReport evaluation = AST::PartiallyEvaluate(*codegen.astBlock, parsing.arena, budget);
+                report.count("peval.steps", evaluation.steps);
+                TRACE(Ast, Info) << "Partial evaluation: " << evaluation.steps << " step(s), " << evaluation.bytes
+                                 << " byte(s), " << evaluation.prints << " print(s) of constants";
+                if (!evaluation.complete) {
+                    TRACE(Ast, Info) << "    stopped (" << evaluation.reason << "), " << evaluation.statementsLeft
+                                     << " statement(s) left from line " << evaluation.line;
+                }
+            }
+            codegen.useFlatAst = opts.flatAst;
+            if (report.isEnabled()) {
+                CountNodes(*codegen.astBlock, report);
+            }
+
+            if (opts.vm) {
+                vm::Program program;
+                {
+                    auto phase = report.phase("bytecode");
+                    program = vm::Compile(*codegen.astBlock);
+                }
+                report.count("bytecode.instructions", program.code.size());
+                vm::RunOptions runOpts;
+                runOpts.jitThreshold = opts.jitThreshold;
+                runOpts.optLevel = std::max(opts.optLevel, 2u); // only hot loops get there
+                runOpts.cpu = opts.cpu;
+                runOpts.features = opts.features;
+                runOpts.threads = opts.threads;
+                runOpts.grain = opts.grain;
+                {
+                    auto phase = report.phase("vm");
+                    vm::Run(program, runOpts);
+                }
+                PrintReport(opts, report);
+                return;
+            }
+
+            SetUpCodeGen(opts, input, codegen, profile, report);
+            {
+                auto phase = report.phase("codegen");
+                codegen.generateCode();
+            }
+        }
+        if (opts.split > 1) {
+            auto phase = report.phase("outline");
+            report.count("outlined", codegen.outlineRegions(opts.outline));
+        }
+        if (opts.dumpIr) {
+            auto phase = report.phase("print-ir");
+            codegen.dumpCode(std::cout);
+        }
+        CountIR(*codegen.module, "ir", report);
+
+        // the objects are optimized and compiled by partitions, the other outputs need the whole module
+        bool split = opts.split > 1 && (opts.emit & (options::EmitObj | options::EmitExe));
+        if (split) {
+            {
+                auto phase = report.phase("split-codegen");
+                codegen.saveSplit(opts.split, opts.optLevel, opts.emit & options::EmitObj ? output + ".o" : "",
+                                  opts.emit & options::EmitExe ? output : "");
+            }
+            if (!(opts.emit & (options::EmitLL | options::EmitBC)) && !opts.exec) {
+                PrintReport(opts, report);
+                return;
+            }
+        }
+
+        if (opts.optLevel > 0) {
+            llvm::PassInstrumentationCallbacks instrumentation;
+            report.instrument(instrumentation);
+            {
+                auto phase = report.phase("optimize");
+                codegen.optimize(opts.optLevel, &instrumentation);
+            }
+            CountIR(*codegen.module, "ir.optimized", report);
+        } else {
+            auto phase = report.phase("verify");
+            codegen.optimize(0);
+        }
+
+        if (opts.emit & options::EmitLL) {
+            auto phase = report.phase("emit-ll");
+            codegen.saveCode(output);
+        }
+        if (opts.emit & options::EmitBC) {
+            auto phase = report.phase("emit-bc");
+            codegen.saveBitcode(output);
+        }
+        if ((opts.emit & options::EmitObj) && !split) {
+            auto phase = report.phase("emit-obj");
+            codegen.saveObject(output + ".o");
+        }
+        if ((opts.emit & options::EmitExe) && !split) {
+            auto phase = report.phase("emit-exe");
+            codegen.saveExecutable(output);
+        }
+
+        if (opts.exec) {
+            auto phase = report.phase("jit-run");
+            codegen.runCode();
+        }
+        PrintReport(opts, report);
+    }
+
+    std::size_t CompileBatch(const options::CompilerOptions &opts) {
+        const std::vector<std::string> &inputs = opts.inputs;
+        std::vector<std::string> errors(inputs.size());
+        std::atomic<std::size_t> next{0};
+
+        auto worker = [&]() {
+            for (std::size_t i = next++; i < inputs.size(); i = next++) {
+                try {
+                    CompileFile(opts, inputs[i], OutputName(inputs[i]));
+                } catch (std::exception &e) {
+                    errors[i] = e.what();
+                }
+            }
+        };
+
+        std::size_t threadsCount = std::min<std::size_t>(opts.jobs, inputs.size());
+        std::vector<std::thread> threads;
+        for (std::size_t i = 0; i + 1 < threadsCount; ++i) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto &t: threads) {
+            t.join();
+        }
+
+        std::size_t failed = 0;
+        for (std::size_t i = 0; i < inputs.size(); ++i) {
+            if (!errors[i].empty()) {
+                std::cout << inputs[i] << ": " << errors[i] << std::endl;
+                ++failed;
+            }
+        }
+        return failed;
+    }
+
+    std::string OutputName(const std::string &input) {
+        const std::string suffix = ".lang";
+        if (input.size() > suffix.size() && input.compare(input.size() - suffix.size(), suffix.size(), suffix) == 0) {
+            return input.substr(0, input.size() - suffix.size());
+        }
+        return input;
+    }
+}
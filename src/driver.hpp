@@ -0,0 +1,24 @@
+/*
+    Compilation of whole files: one file at a time or a batch of files on a pool of threads
+
+    Every file gets its own ParsingContext and CodeGenContext (and thus its own LLVMContext),
+    nothing is shared between files except the LLVM target registry.
+*/
+#pragma once
+
+#include "options.hpp"
+
+#include <string>
+
+namespace driver {
+    // parses, generates, optimizes and emits input according to opts, runs it if opts.exec is set;
+    // all errors are reported with exceptions
+    void CompileFile(const options::CompilerOptions &opts, const std::string &input, const std::string &output);
+
+    // compiles opts.inputs on opts.jobs threads, reports errors to std::cout,
+    // returns the number of files that failed
+    std::size_t CompileBatch(const options::CompilerOptions &opts);
+
+    // a.lang -> a
+    std::string OutputName(const std::string &input);
+}
@@ -0,0 +1,450 @@
+/*
+    Hand-written scanner, a drop-in replacement of the one generated from lexer.l
+
+    lexer.l stays the reference: the same tokens, the same line/column bookkeeping and the same error messages
+    (run_tests.sh compares the two when flex is installed). The source file is memory-mapped and scanned in
+    place, string literals reach the parser as spans into the mapping and identifiers as their interned symbols
+    (ParsingContext::symbols), so nothing is allocated or copied per token. Keywords are recognized with a
+    perfect hash, whitespace is skipped 16 bytes at a time with SSE2 and comments with memchr.
+*/
+#include "node.hpp"
+#include "parsing_context.hpp"
+#include "parser.hpp"
+#include "trace.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <array>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace {
+    struct Keyword {
+        std::string_view text;
+        int token;
+    };
+
+    // lowercase keywords only: a word starting with an uppercase letter is always (a prefix) keyword, see upperWord
+    constexpr Keyword kKeywords[] = {
+            {"main",  MAIN},
+            {"if",    IF},
+            {"else",  ELSE},
+            {"while", WHILE},
+            {"skip",  SKIP},
+            {"print", PRINT},
+            {"parallel", PARALLEL},
+            {"for", FOR},
+            {"in", IN},
+            {"reduce", REDUCE},
+    };
+
+    constexpr std::size_t kKeywordSlots = 16;
+
+    constexpr std::size_t KeywordHash(const char *word, std::size_t size) {
+        return (static_cast<unsigned char>(word[0]) * 8u + static_cast<unsigned char>(word[size - 1]) + size) %
+               kKeywordSlots;
+    }
+
+    // slot -> index in kKeywords + 1, 0 for empty slots
+    constexpr std::array<unsigned char, kKeywordSlots> BuildKeywordTable() {
+        std::array<unsigned char, kKeywordSlots> table{};
+        for (std::size_t i = 0; i < std::size(kKeywords); ++i) {
+            table[KeywordHash(kKeywords[i].text.data(), kKeywords[i].text.size())] = i + 1;
+        }
+        return table;
+    }
+
+    constexpr std::array<unsigned char, kKeywordSlots> kKeywordTable = BuildKeywordTable();
+
+    constexpr bool IsPerfect() {
+        for (std::size_t i = 0; i < std::size(kKeywords); ++i) {
+            if (kKeywordTable[KeywordHash(kKeywords[i].text.data(), kKeywords[i].text.size())] != i + 1) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static_assert(IsPerfect(), "keywords collide in the hash, change KeywordHash");
+
+    constexpr bool IsLower(char c) {
+        return c >= 'a' && c <= 'z';
+    }
+
+    constexpr bool IsDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    constexpr bool IsWordChar(char c) {
+        return IsLower(c) || (c >= 'A' && c <= 'Z') || IsDigit(c) || c == '_';
+    }
+
+    struct Scanner {
+        parsingcontext::ParsingContext *ctx;
+
+        const char *cur = nullptr;
+        const char *end = nullptr;
+        const char *text = nullptr; // of the last token, for tracing
+
+        void *mapping = nullptr;
+        std::size_t mappingSize = 0;
+        std::string buffer; // contents of an input that can't be mapped (a pipe, an empty file)
+
+        int line = 1; // yylineno
+        int column = 0; // yycolumn
+        int tokenLine = 1; // where the last token starts, its column is tokenColumn + 1
+        int tokenColumn = 0;
+
+        explicit Scanner(parsingcontext::ParsingContext *ctx_) : ctx(ctx_) {}
+
+        ~Scanner() {
+            if (mapping) {
+                munmap(mapping, mappingSize);
+            }
+        }
+
+        void open(FILE *in);
+
+        int next(YYSTYPE *lval);
+
+    private:
+        int token(int kind, std::size_t size) {
+            tokenLine = line;
+            tokenColumn = column;
+            text = cur;
+            cur += size;
+            column += size;
+            return kind;
+        }
+
+        int symbol(YYSTYPE *lval, int kind) {
+            lval->sym = *cur;
+            return token(kind, 1);
+        }
+
+        int word(YYSTYPE *lval);
+
+        int upperWord(YYSTYPE *lval);
+
+        int number(YYSTYPE *lval);
+
+        int string(YYSTYPE *lval);
+
+        // the text after loop of a "//# loop ..." comment line, up to eol; null if the comment isn't a pragma
+        const char *pragma(const char *eol) const;
+
+        void skipBlanks();
+
+        [[noreturn]] void error(const std::string &symbol) const {
+            throw std::runtime_error("ERROR in line " + std::to_string(line) + ", pos " +
+                                     std::to_string(column + 1) + ", symbol " + symbol);
+        }
+    };
+
+    void Scanner::open(FILE *in) {
+        int fd = fileno(in);
+        struct stat st{};
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                madvise(p, st.st_size, MADV_SEQUENTIAL);
+                mapping = p;
+                mappingSize = st.st_size;
+                cur = static_cast<const char *>(p);
+                end = cur + mappingSize;
+                return;
+            }
+        }
+        char chunk[1 << 16];
+        std::size_t n;
+        while ((n = std::fread(chunk, 1, sizeof(chunk), in)) > 0) {
+            buffer.append(chunk, n);
+        }
+        cur = buffer.data();
+        end = cur + buffer.size();
+    }
+
+    void Scanner::skipBlanks() {
+#if defined(__SSE2__)
+        const __m128i space = _mm_set1_epi8(' ');
+        const __m128i tab = _mm_set1_epi8('\t');
+        const __m128i cr = _mm_set1_epi8('\r');
+        const __m128i lf = _mm_set1_epi8('\n');
+        while (end - cur >= 16) {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(cur));
+            __m128i newlines = _mm_cmpeq_epi8(chunk, lf);
+            __m128i blanks = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, tab)),
+                                          _mm_or_si128(_mm_cmpeq_epi8(chunk, cr), newlines));
+            unsigned blankMask = _mm_movemask_epi8(blanks);
+            // the blanks in front of the first non-blank byte, all 16 if there is none
+            unsigned run = blankMask == 0xFFFF ? 16 : __builtin_ctz(~blankMask);
+            unsigned newlineMask = _mm_movemask_epi8(newlines) & ((1u << run) - 1);
+            if (newlineMask) {
+                line += __builtin_popcount(newlineMask);
+                column = run - 1 - (31 - __builtin_clz(newlineMask));
+            } else {
+                column += run;
+            }
+            cur += run;
+            if (run < 16) {
+                return;
+            }
+        }
+#endif
+        for (; cur != end; ++cur) {
+            if (*cur == '\n') {
+                ++line;
+                column = 0;
+            } else if (*cur == ' ' || *cur == '\t' || *cur == '\r') {
+                ++column;
+            } else {
+                return;
+            }
+        }
+    }
+
+    int Scanner::next(YYSTYPE *lval) {
+        for (;;) {
+            skipBlanks();
+            if (cur == end) {
+                return 0;
+            }
+            if (*cur != '/' || end - cur < 2 || cur[1] != '/') {
+                break;
+            }
+            auto eol = static_cast<const char *>(std::memchr(cur, '\n', end - cur));
+            if (!eol) {
+                eol = end;
+            }
+            if (const char *hints = pragma(eol)) {
+                lval->word = {hints, std::size_t(eol - hints)};
+                return token(PRAGMA, eol - cur);
+            }
+            column += eol - cur;
+            cur = eol;
+        }
+
+        char c = *cur;
+        char after = end - cur > 1 ? cur[1] : '\0';
+        if (IsLower(c)) {
+            return word(lval);
+        }
+        if (c >= 'A' && c <= 'Z') {
+            return upperWord(lval);
+        }
+        if (IsDigit(c)) {
+            return number(lval);
+        }
+        switch (c) {
+            case '\'':
+            case '"':
+                return string(lval);
+            case ';':
+                return symbol(lval, SEP);
+            case ',':
+                return symbol(lval, COMMA);
+            case ':':
+                return symbol(lval, COLON);
+            case '.':
+                if (after == '.') {
+                    return token(RANGE, 2);
+                }
+                break;
+            case '+':
+                return symbol(lval, PLUS);
+            case '-':
+                return symbol(lval, MINUS);
+            case '*':
+                return symbol(lval, MUL);
+            case '/':
+                return symbol(lval, DIV);
+            case '(':
+                return symbol(lval, LP);
+            case ')':
+                return symbol(lval, RP);
+            case '{':
+                return symbol(lval, LB);
+            case '}':
+                return symbol(lval, RB);
+            case '[':
+                return symbol(lval, LSB);
+            case ']':
+                return symbol(lval, RSB);
+            case '^':
+                return symbol(lval, POW);
+            case '=':
+                return after == '=' ? token(EQ, 2) : symbol(lval, ASSIGN);
+            case '!':
+                return after == '=' ? token(NEQ, 2) : token(NOT, 1);
+            case '<':
+                return after == '=' ? token(LE, 2) : token(LT, 1);
+            case '>':
+                return after == '=' ? token(GE, 2) : token(GT, 1);
+            case '&':
+                if (after == '&') {
+                    return token(AND, 2);
+                }
+                break;
+            case '|':
+                if (after == '|') {
+                    return token(OR, 2);
+                }
+                break;
+            default:
+                break;
+        }
+        error(std::string(1, c));
+    }
+
+    int Scanner::word(YYSTYPE *lval) {
+        const char *p = cur + 1;
+        while (p != end && IsWordChar(*p)) {
+            ++p;
+        }
+        std::size_t size = p - cur;
+        if (unsigned char k = kKeywordTable[KeywordHash(cur, size)]) {
+            const Keyword &keyword = kKeywords[k - 1];
+            if (keyword.text == std::string_view(cur, size)) {
+                return token(keyword.token, size);
+            }
+        }
+        AST::Symbol symbol = ctx->symbols.intern({cur, size});
+        std::string_view name = ctx->symbols.name(symbol);
+        lval->name = {{name.data(), name.size()}, symbol};
+        return token(VAR, size);
+    }
+
+    // identifiers start with a lowercase letter, so like in lexer.l an uppercase word is split after the
+    // keyword it starts with: "Integer" is INT_TYPE followed by the identifier "eger"
+    int Scanner::upperWord(YYSTYPE *lval) {
+        auto startsWith = [this](std::string_view keyword) {
+            return std::size_t(end - cur) >= keyword.size() && std::memcmp(cur, keyword.data(), keyword.size()) == 0;
+        };
+        switch (*cur) {
+            case 'I':
+                if (startsWith("Int")) {
+                    return token(INT_TYPE, 3);
+                }
+                break;
+            case 'B':
+                if (startsWith("Bool")) {
+                    return token(BOOL_TYPE, 4);
+                }
+                break;
+            case 'S':
+                if (startsWith("String")) {
+                    return token(STRING_TYPE, 6);
+                }
+                break;
+            case 'T':
+                if (startsWith("True")) {
+                    lval->boolean = true;
+                    return token(TRUE_VAL, 4);
+                }
+                break;
+            case 'F':
+                if (startsWith("False")) {
+                    lval->boolean = false;
+                    return token(FALSE_VAL, 5);
+                }
+                break;
+            default:
+                break;
+        }
+        error(std::string(1, *cur));
+    }
+
+    int Scanner::number(YYSTYPE *lval) {
+        const char *p = cur;
+        int base = 10;
+        if (*p == '0' && end - p > 2 && p[1] == 'b' && (p[2] == '0' || p[2] == '1')) {
+            base = 2;
+            p += 2;
+        }
+        const char *digits = p;
+        while (p != end && (base == 2 ? *p == '0' || *p == '1' : IsDigit(*p))) {
+            ++p;
+        }
+        long long value = 0;
+        for (const char *d = digits; d != p; ++d) {
+            value = value * base + (*d - '0');
+            if (value > INT_MAX) {
+                error(std::string(cur, p) + " (the integer literal is too large)");
+            }
+        }
+        lval->num = int(value);
+        return token(INT, p - cur);
+    }
+
+    const char *Scanner::pragma(const char *eol) const {
+        const char *p = cur + 2;
+        if (p == eol || *p++ != '#') {
+            return nullptr;
+        }
+        while (p != eol && (*p == ' ' || *p == '\t')) {
+            ++p;
+        }
+        if (eol - p < 4 || std::memcmp(p, "loop", 4) != 0) {
+            return nullptr;
+        }
+        p += 4;
+        return p == eol || *p == ' ' || *p == '\t' ? p : nullptr;
+    }
+
+    // no escapes, a literal ends at the first quote of either kind, which must be the opening one
+    int Scanner::string(YYSTYPE *lval) {
+        char quote = *cur;
+        const char *p = cur + 1;
+        int newlines = 0;
+        while (p != end && *p != '\'' && *p != '"') {
+            newlines += *p == '\n';
+            ++p;
+        }
+        if (p == end || *p != quote) {
+            error(std::string(1, quote));
+        }
+        std::size_t size = p + 1 - cur;
+        lval->word = {cur, size};
+        int kind = token(STRING, size);
+        line += newlines; // yycolumn isn't reset by newlines inside a token in lexer.l either
+        return kind;
+    }
+}
+
+int yylex_init_extra(parsingcontext::ParsingContext *extra, yyscan_t *scanner) {
+    *scanner = new Scanner(extra);
+    return 0;
+}
+
+int yylex_destroy(yyscan_t scanner) {
+    delete static_cast<Scanner *>(scanner);
+    return 0;
+}
+
+void yyset_in(FILE *in, yyscan_t scanner) {
+    static_cast<Scanner *>(scanner)->open(in);
+}
+
+int yylex(YYSTYPE *lval, YYLTYPE *lloc, yyscan_t scanner) {
+    auto s = static_cast<Scanner *>(scanner);
+    int token = s->next(lval);
+    lloc->first_line = s->tokenLine;
+    lloc->first_column = s->tokenColumn + 1;
+    lloc->last_line = s->line;
+    lloc->last_column = s->column;
+    if (token) {
+        ++s->ctx->tokens;
+        TRACE(Lexer, Debug) << "line " << s->line << ": token " << token << " '"
+                            << std::string_view(s->text, s->cur - s->text) << "'";
+    }
+    return token;
+}
@@ -0,0 +1,332 @@
+#include "flat_ast.hpp"
+#include "codegen.hpp"
+
+#include <stdexcept>
+#include <unordered_map>
+
+namespace AST::flat {
+    namespace {
+        class Flattener {
+        public:
+            Tree tree;
+
+            Index block(const CodeBlock &block) {
+                auto first = Index(tree.stmts.size());
+                auto size = Index(block.statements.size());
+                Index b = Index(tree.blocks.size());
+                tree.blocks.push_back({first, size});
+                tree.stmts.resize(first + size);
+                for (Index i = 0; i < size; ++i) {
+                    // nested blocks are appended behind the statements of this one
+                    Stmt st = statement(*block.statements[i]);
+                    st.line = std::uint32_t(block.statements[i]->line);
+                    tree.stmts[first + i] = st;
+                }
+                return b;
+            }
+
+        private:
+            std::unordered_map<const Identifier *, Index> identifiers;
+
+            Stmt statement(const Statement &node) {
+                if (dynamic_cast<const Skip *>(&node)) {
+                    return {StmtKind::Skip, kNone, kNone, kNone};
+                }
+                if (auto *decl = dynamic_cast<const VarDecl *>(&node)) {
+                    return {StmtKind::VarDecl, identifier(decl->ident), expression(*decl->expr), kNone};
+                }
+                if (auto *assign = dynamic_cast<const VarAssign *>(&node)) {
+                    return {StmtKind::VarAssign, identifier(assign->ident), expression(*assign->expr), kNone};
+                }
+                if (auto *loop = dynamic_cast<const WhileLoop *>(&node)) {
+                    Index cond = expression(*loop->expr);
+                    auto info = Index(tree.loops.size());
+                    tree.loops.push_back({loop->isCounted(), loop->hints});
+                    return {StmtKind::WhileLoop, cond, block(*loop->code_block), info};
+                }
+                if (auto *ifSt = dynamic_cast<const IfStatement *>(&node)) {
+                    Index cond = expression(*ifSt->expr);
+                    Index onIf = block(*ifSt->on_if);
+                    Index onElse = ifSt->on_else ? block(*ifSt->on_else) : kNone;
+                    return {StmtKind::IfStatement, cond, onIf, onElse};
+                }
+                if (auto *print = dynamic_cast<const PrintStatement *>(&node)) {
+                    return {StmtKind::PrintStatement, expression(*print->e), kNone, kNone};
+                }
+                if (auto *assign = dynamic_cast<const IndexAssign *>(&node)) {
+                    Index index = expression(*assign->index);
+                    return {StmtKind::IndexAssign, identifier(assign->ident), index, expression(*assign->expr)};
+                }
+                if (auto *call = dynamic_cast<const ProcedureCall *>(&node)) {
+                    Index target = expression(*call->target);
+                    return {call->proc == Procedure::Fill ? StmtKind::Fill : StmtKind::Copy, target,
+                            expression(*call->value), kNone};
+                }
+                if (auto *loop = dynamic_cast<const ParallelFor *>(&node)) {
+                    identifier(loop->index);
+                    Index begin = expression(*loop->begin);
+                    auto info = Index(tree.parallels.size());
+                    tree.parallels.push_back({loop, expression(*loop->end)});
+                    return {StmtKind::ParallelFor, begin, block(*loop->body), info};
+                }
+                throw std::runtime_error("[internal error] Unknown statement in Flatten");
+            }
+
+            Index expression(const Expression &node) {
+                Expr e{};
+                e.type = node.type;
+                if (auto *c = dynamic_cast<const ConstantInt *>(&node)) {
+                    e.kind = ExprKind::ConstantInt;
+                    e.a = Index(c->val);
+                } else if (auto *c = dynamic_cast<const ConstantBool *>(&node)) {
+                    e.kind = ExprKind::ConstantBool;
+                    e.a = c->val;
+                } else if (auto *c = dynamic_cast<const ConstantString *>(&node)) {
+                    e.kind = ExprKind::ConstantString;
+                    e.a = Index(tree.strings.size());
+                    tree.strings.push_back(c->val);
+                } else if (auto *id = dynamic_cast<const Identifier *>(&node)) {
+                    e.kind = ExprKind::Identifier;
+                    e.a = identifier(id);
+                } else if (auto *op = dynamic_cast<const UnaryOp *>(&node)) {
+                    e.kind = ExprKind::UnaryOp;
+                    e.op = std::uint8_t(op->op);
+                    e.a = expression(*op->expr);
+                } else if (auto *op = dynamic_cast<const BinaryOp *>(&node)) {
+                    e.kind = ExprKind::BinaryOp;
+                    e.op = std::uint8_t(op->op);
+                    e.a = expression(*op->lhs);
+                    e.b = expression(*op->rhs);
+                } else if (auto *call = dynamic_cast<const Call *>(&node)) {
+                    e.kind = ExprKind::Call;
+                    e.op = std::uint8_t(call->fn);
+                    e.a = expression(*call->args[0]);
+                    e.b = call->args.size() > 1 ? expression(*call->args[1]) : kNone;
+                } else if (auto *array = dynamic_cast<const NewArray *>(&node)) {
+                    e.kind = ExprKind::NewArray;
+                    e.a = expression(*array->length);
+                } else if (auto *literal = dynamic_cast<const ArrayLiteral *>(&node)) {
+                    e.kind = ExprKind::ArrayLiteral;
+                    std::vector<Index> elements;
+                    for (const Expression *element: literal->elements) {
+                        elements.push_back(expression(*element));
+                    }
+                    // the elements of nested literals are appended first
+                    e.a = Index(tree.elements.size());
+                    e.b = Index(elements.size());
+                    tree.elements.insert(tree.elements.end(), elements.begin(), elements.end());
+                } else if (auto *index = dynamic_cast<const AST::Index *>(&node)) {
+                    e.kind = ExprKind::Index;
+                    e.a = expression(*index->array);
+                    e.b = expression(*index->index);
+                } else {
+                    throw std::runtime_error("[internal error] Unknown expression in Flatten");
+                }
+                tree.exprs.push_back(e);
+                return Index(tree.exprs.size() - 1);
+            }
+
+            Index identifier(const Identifier *id) {
+                auto [iter, inserted] = identifiers.emplace(id, Index(tree.identifiers.size()));
+                if (inserted) {
+                    tree.identifiers.push_back(const_cast<Identifier *>(id));
+                }
+                return iter->second;
+            }
+        };
+
+        class CodeGenVisitor : public Visitor<CodeGenVisitor, llvm::Value *> {
+        public:
+            CodeGenVisitor(const Tree &tree_, codegen::CodeGenContext &context_) : Visitor(tree_), context(context_) {}
+
+            llvm::Value *visitConstantInt(const Expr &e) {
+                return context.builder->getInt32(e.a);
+            }
+
+            llvm::Value *visitConstantBool(const Expr &e) {
+                return context.builder->getInt1(e.a);
+            }
+
+            llvm::Value *visitConstantString(const Expr &e) {
+                return context.emitString(tree.strings[e.a]);
+            }
+
+            llvm::Value *visitIdentifier(const Expr &e) {
+                return context.emitIdentifier(tree.identifiers[e.a]);
+            }
+
+            llvm::Value *visitUnaryOp(const Expr &e) {
+                return context.emitUnaryOp(UnaryOpType(e.op), visitExpr(e.a));
+            }
+
+            llvm::Value *visitBinaryOp(const Expr &e) {
+                llvm::Value *lhs = visitExpr(e.a);
+                llvm::Value *rhs = visitExpr(e.b);
+                if (e.type == DataType::IntArray) {
+                    return context.emitArrayBinaryOp(BinaryOpType(e.op), tree.exprs[e.a].type, tree.exprs[e.b].type,
+                                                     lhs, rhs);
+                }
+                return context.emitBinaryOp(BinaryOpType(e.op), tree.exprs[e.a].type, lhs, rhs);
+            }
+
+            llvm::Value *visitCall(const Expr &e) {
+                if (e.b == kNone) {
+                    return context.emitCall(Builtin(e.op), {visitExpr(e.a)});
+                }
+                llvm::Value *first = visitExpr(e.a);
+                llvm::Value *second = visitExpr(e.b);
+                return context.emitCall(Builtin(e.op), {first, second});
+            }
+
+            llvm::Value *visitNewArray(const Expr &e) {
+                return context.emitNewArray(e.type, visitExpr(e.a));
+            }
+
+            llvm::Value *visitArrayLiteral(const Expr &e) {
+                std::vector<llvm::Value *> values;
+                for (Index i = e.a; i < e.a + e.b; ++i) {
+                    values.push_back(visitExpr(tree.elements[i]));
+                }
+                return context.emitArrayLiteral(e.type, values);
+            }
+
+            llvm::Value *visitIndex(const Expr &e) {
+                llvm::Value *array = visitExpr(e.a);
+                llvm::Value *index = visitExpr(e.b);
+                return context.emitIndex(tree.exprs[e.a].type, array, index);
+            }
+
+            llvm::Value *visitSkip(const Stmt &) {
+                return context.builder->getInt1(true);
+            }
+
+            llvm::Value *visitVarDecl(const Stmt &st) {
+                context.emitDeclare(tree.identifiers[st.a]);
+                return visitVarAssign(st);
+            }
+
+            llvm::Value *visitVarAssign(const Stmt &st) {
+                return context.emitAssign(tree.identifiers[st.a], visitExpr(st.b));
+            }
+
+            llvm::Value *visitWhileLoop(const Stmt &st) {
+                const Loop &loop = tree.loops[st.c];
+                return context.emitWhile(
+                        int(st.line), tree.blocks[st.b].size, loop.counted, loop.hints,
+                        [&]() { return visitExpr(st.a); },
+                        [&]() { return block(st.b); });
+            }
+
+            llvm::Value *visitIfStatement(const Stmt &st) {
+                std::size_t statements = tree.blocks[st.b].size + (st.c != kNone ? tree.blocks[st.c].size : 0);
+                return context.emitIf(
+                        int(st.line), statements, visitExpr(st.a),
+                        [&]() { return block(st.b); },
+                        [&]() { return st.c != kNone ? block(st.c) : context.builder->getInt1(true); });
+            }
+
+            llvm::Value *visitPrintStatement(const Stmt &st) {
+                return context.emitPrint(tree.exprs[st.a].type, visitExpr(st.a));
+            }
+
+            llvm::Value *visitIndexAssign(const Stmt &st) {
+                llvm::Value *index = visitExpr(st.b);
+                return context.emitIndexAssign(tree.identifiers[st.a], index, visitExpr(st.c));
+            }
+
+            llvm::Value *visitProcedureCall(const Stmt &st) {
+                llvm::Value *target = visitExpr(st.a);
+                return context.emitProcedure(st.kind == StmtKind::Fill ? Procedure::Fill : Procedure::Copy,
+                                             tree.exprs[st.a].type, target, visitExpr(st.b));
+            }
+
+            llvm::Value *visitParallelFor(const Stmt &st) {
+                const Parallel &loop = tree.parallels[st.c];
+                llvm::Value *begin = visitExpr(st.a);
+                llvm::Value *end = visitExpr(loop.end);
+                return context.emitParallelFor(*loop.loop, begin, end, [&]() { return block(st.b); });
+            }
+
+            llvm::Value *block(Index b) {
+                visitBlock(b);
+                return context.builder->getInt1(true);
+            }
+
+            // Visitor::visitBlock with the line of every statement reported to the profiler
+            void visitBlock(Index b) {
+                const Block &block = tree.blocks[b];
+                for (Index i = block.first; i < block.first + block.size; ++i) {
+                    if (tree.stmts[i].kind != StmtKind::WhileLoop) {
+                        context.emitLine(int(tree.stmts[i].line));
+                    }
+                    visitStmt(i);
+                }
+            }
+
+        private:
+            codegen::CodeGenContext &context;
+        };
+    }
+
+    Tree Flatten(const CodeBlock &root) {
+        Flattener flattener;
+        flattener.tree.root = flattener.block(root);
+        return std::move(flattener.tree);
+    }
+
+    void CodeGen(const Tree &tree, codegen::CodeGenContext &context) {
+        CodeGenVisitor visitor(tree, context);
+        visitor.visitBlock(tree.root);
+    }
+
+    const char *KindName(ExprKind kind) {
+        switch (kind) {
+            case ExprKind::ConstantInt:
+                return "ConstantInt";
+            case ExprKind::ConstantBool:
+                return "ConstantBool";
+            case ExprKind::ConstantString:
+                return "ConstantString";
+            case ExprKind::Identifier:
+                return "Identifier";
+            case ExprKind::UnaryOp:
+                return "UnaryOp";
+            case ExprKind::BinaryOp:
+                return "BinaryOp";
+            case ExprKind::Call:
+                return "Call";
+            case ExprKind::NewArray:
+                return "NewArray";
+            case ExprKind::ArrayLiteral:
+                return "ArrayLiteral";
+            case ExprKind::Index:
+                return "Index";
+        }
+        llvm_unreachable("flat::KindName: unknown expression kind!");
+    }
+
+    const char *KindName(StmtKind kind) {
+        switch (kind) {
+            case StmtKind::Skip:
+                return "Skip";
+            case StmtKind::VarDecl:
+                return "VarDecl";
+            case StmtKind::VarAssign:
+                return "VarAssign";
+            case StmtKind::WhileLoop:
+                return "WhileLoop";
+            case StmtKind::IfStatement:
+                return "IfStatement";
+            case StmtKind::PrintStatement:
+                return "PrintStatement";
+            case StmtKind::IndexAssign:
+                return "IndexAssign";
+            case StmtKind::ParallelFor:
+                return "ParallelFor";
+            case StmtKind::Fill:
+            case StmtKind::Copy:
+                return "ProcedureCall";
+        }
+        llvm_unreachable("flat::KindName: unknown statement kind!");
+    }
+}
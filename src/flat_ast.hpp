@@ -0,0 +1,181 @@
+/*
+    Flat layout of the AST
+
+    The tree from node.hpp is copied into typed arrays: nodes of one kind are stored contiguously,
+    children are addressed with 32-bit indices and the statements of a code block are adjacent.
+    Passes over this layout derive from Visitor<Derived, R> and are dispatched with a switch
+    on the node kind instead of virtual calls.
+*/
+#pragma once
+
+#include "node.hpp"
+
+#include <llvm/Support/ErrorHandling.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace AST::flat {
+    using Index = std::uint32_t;
+
+    constexpr Index kNone = ~Index(0);
+
+    enum class ExprKind : std::uint8_t {
+        ConstantInt,
+        ConstantBool,
+        ConstantString,
+        Identifier,
+        UnaryOp,
+        BinaryOp,
+        Call,
+        NewArray,
+        ArrayLiteral,
+        Index
+    };
+
+    enum class StmtKind : std::uint8_t {
+        Skip,
+        VarDecl,
+        VarAssign,
+        WhileLoop,
+        IfStatement,
+        PrintStatement,
+        IndexAssign,
+        Fill,
+        Copy,
+        ParallelFor
+    };
+
+    struct Expr {
+        ExprKind kind;
+        std::uint8_t op; // UnaryOpType, BinaryOpType or Builtin
+        DataType type;
+        Index a; // value of a constant, index in strings/identifiers, (left) operand, first argument, length of
+                 // NewArray, first element of ArrayLiteral in Tree::elements, array of Index
+        Index b; // right operand of BinaryOp, second argument of Call (kNone for one), number of elements
+                 // of ArrayLiteral, index of Index
+    };
+
+    struct Stmt {
+        StmtKind kind;
+        Index a; // identifier of VarDecl/VarAssign/IndexAssign, condition of WhileLoop/IfStatement, printed
+                 // expression, array of Fill/Copy, begin of ParallelFor
+        Index b; // assigned expression, body of WhileLoop/ParallelFor, then-branch of IfStatement, index of
+                 // IndexAssign, value of Fill/Copy
+        Index c; // else-branch of IfStatement, kNone if there is none; loop of WhileLoop in Tree::loops,
+                 // assigned expression of IndexAssign, loop of ParallelFor in Tree::parallels
+        std::uint32_t line = 0; // Statement::line
+    };
+
+    struct Loop {
+        bool counted; // WhileLoop::isCounted
+        LoopHints hints;
+    };
+
+    struct Parallel {
+        const ParallelFor *loop; // the index, the reductions and the shared variables
+        Index end;
+    };
+
+    struct Block {
+        Index first; // statements [first, first + size) in Tree::stmts
+        Index size;
+    };
+
+    struct Tree {
+        std::vector<Expr> exprs;
+        std::vector<Stmt> stmts;
+        std::vector<Block> blocks;
+        std::vector<Loop> loops;
+        std::vector<Parallel> parallels;
+        std::vector<Index> elements; // of the array literals, in exprs
+        std::vector<std::string> strings;
+        std::vector<Identifier *> identifiers; // one entry per declared variable
+        Index root = kNone; // block of main
+    };
+
+    Tree Flatten(const CodeBlock &root);
+
+    // generates the code of the whole tree at the current insert point of context
+    void CodeGen(const Tree &tree, codegen::CodeGenContext &context);
+
+    // name of the node class in node.hpp
+    const char *KindName(ExprKind kind);
+
+    const char *KindName(StmtKind kind);
+
+    template<class Derived, class R = void>
+    class Visitor {
+    public:
+        explicit Visitor(const Tree &tree_) : tree(tree_) {}
+
+        R visitExpr(Index i) {
+            const Expr &e = tree.exprs[i];
+            switch (e.kind) {
+                case ExprKind::ConstantInt:
+                    return derived().visitConstantInt(e);
+                case ExprKind::ConstantBool:
+                    return derived().visitConstantBool(e);
+                case ExprKind::ConstantString:
+                    return derived().visitConstantString(e);
+                case ExprKind::Identifier:
+                    return derived().visitIdentifier(e);
+                case ExprKind::UnaryOp:
+                    return derived().visitUnaryOp(e);
+                case ExprKind::BinaryOp:
+                    return derived().visitBinaryOp(e);
+                case ExprKind::Call:
+                    return derived().visitCall(e);
+                case ExprKind::NewArray:
+                    return derived().visitNewArray(e);
+                case ExprKind::ArrayLiteral:
+                    return derived().visitArrayLiteral(e);
+                case ExprKind::Index:
+                    return derived().visitIndex(e);
+            }
+            llvm_unreachable("flat::Visitor: unknown expression kind!");
+        }
+
+        R visitStmt(Index i) {
+            const Stmt &st = tree.stmts[i];
+            switch (st.kind) {
+                case StmtKind::Skip:
+                    return derived().visitSkip(st);
+                case StmtKind::VarDecl:
+                    return derived().visitVarDecl(st);
+                case StmtKind::VarAssign:
+                    return derived().visitVarAssign(st);
+                case StmtKind::WhileLoop:
+                    return derived().visitWhileLoop(st);
+                case StmtKind::IfStatement:
+                    return derived().visitIfStatement(st);
+                case StmtKind::PrintStatement:
+                    return derived().visitPrintStatement(st);
+                case StmtKind::IndexAssign:
+                    return derived().visitIndexAssign(st);
+                case StmtKind::Fill:
+                case StmtKind::Copy:
+                    return derived().visitProcedureCall(st);
+                case StmtKind::ParallelFor:
+                    return derived().visitParallelFor(st);
+            }
+            llvm_unreachable("flat::Visitor: unknown statement kind!");
+        }
+
+        void visitBlock(Index b) {
+            const Block &block = tree.blocks[b];
+            for (Index i = block.first; i < block.first + block.size; ++i) {
+                visitStmt(i);
+            }
+        }
+
+    protected:
+        const Tree &tree;
+
+    private:
+        Derived &derived() {
+            return static_cast<Derived &>(*this);
+        }
+    };
+}
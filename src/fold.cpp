@@ -0,0 +1,380 @@
+#include "fold.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace AST {
+    namespace eval {
+        std::optional<std::int32_t> IntOp(BinaryOpType op, std::int32_t lhs, std::int32_t rhs) {
+            auto l = std::uint32_t(lhs);
+            auto r = std::uint32_t(rhs);
+            switch (op) {
+                case BinaryOpType::Sum:
+                    return std::int32_t(l + r);
+                case BinaryOpType::Sub:
+                    return std::int32_t(l - r);
+                case BinaryOpType::Mult:
+                    return std::int32_t(l * r);
+                case BinaryOpType::Div:
+                    if (rhs == 0 || (lhs == std::numeric_limits<std::int32_t>::min() && rhs == -1)) {
+                        return std::nullopt;
+                    }
+                    return lhs / rhs;
+                case BinaryOpType::Pow:
+                    return Pow(lhs, rhs);
+                default:
+                    return std::nullopt;
+            }
+        }
+
+        std::int32_t Pow(std::int32_t base, std::int32_t exp) {
+            if (exp < 0) {
+                return base == 1 ? 1 : base == -1 ? (exp & 1 ? -1 : 1) : 0;
+            }
+            std::uint32_t result = 1, square = std::uint32_t(base);
+            for (auto bits = std::uint32_t(exp); bits; bits >>= 1) {
+                if (bits & 1) {
+                    result *= square;
+                }
+                square *= square;
+            }
+            return std::int32_t(result);
+        }
+
+        std::int32_t CallBuiltin(Builtin fn, const std::int32_t *args) {
+            switch (fn) {
+                case Builtin::Abs:
+                    return args[0] < 0 ? std::int32_t(0u - std::uint32_t(args[0])) : args[0];
+                case Builtin::Min:
+                    return std::min(args[0], args[1]);
+                case Builtin::Max:
+                    return std::max(args[0], args[1]);
+                case Builtin::Pow:
+                    return Pow(args[0], args[1]);
+                case Builtin::Len:
+                case Builtin::Sum:
+                    break; // of arrays, never constant
+            }
+            llvm_unreachable("eval::CallBuiltin: unknown builtin!");
+        }
+
+        bool Compare(BinaryOpType op, std::int32_t lhs, std::int32_t rhs) {
+            switch (op) {
+                case BinaryOpType::Leq:
+                    return lhs <= rhs;
+                case BinaryOpType::Les:
+                    return lhs < rhs;
+                case BinaryOpType::Geq:
+                    return lhs >= rhs;
+                case BinaryOpType::Gre:
+                    return lhs > rhs;
+                case BinaryOpType::Eq:
+                    return lhs == rhs;
+                case BinaryOpType::Neq:
+                    return lhs != rhs;
+                default:
+                    llvm_unreachable("eval::Compare: not a comparison!");
+            }
+        }
+    }
+
+    namespace {
+        std::optional<std::int32_t> AsInt(const Expression *e) {
+            if (auto *c = dynamic_cast<const ConstantInt *>(e)) {
+                return c->val;
+            }
+            return std::nullopt;
+        }
+
+        std::optional<bool> AsBool(const Expression *e) {
+            if (auto *c = dynamic_cast<const ConstantBool *>(e)) {
+                return c->val;
+            }
+            return std::nullopt;
+        }
+
+        const std::string *AsString(const Expression *e) {
+            if (auto *c = dynamic_cast<const ConstantString *>(e)) {
+                return &c->val;
+            }
+            return nullptr;
+        }
+
+        // whether evaluating e can stop the program: out-of-bounds reads, Int[n] with a negative n,
+        // elementwise operations on arrays of different lengths and division by zero or of INT_MIN by -1
+        bool CanTrap(const Expression *e) {
+            if (dynamic_cast<const Index *>(e) || dynamic_cast<const NewArray *>(e)) {
+                return true;
+            }
+            if (auto *op = dynamic_cast<const UnaryOp *>(e)) {
+                return CanTrap(op->expr);
+            }
+            if (auto *op = dynamic_cast<const BinaryOp *>(e)) {
+                if (op->type == DataType::IntArray || op->type == DataType::BoolArray) {
+                    return true;
+                }
+                if (op->op == BinaryOpType::Div) {
+                    auto divisor = AsInt(op->rhs);
+                    if (!divisor || *divisor == 0 || *divisor == -1) {
+                        return true;
+                    }
+                }
+                return CanTrap(op->lhs) || CanTrap(op->rhs);
+            }
+            if (auto *call = dynamic_cast<const Call *>(e)) {
+                return std::any_of(call->args.begin(), call->args.end(), CanTrap);
+            }
+            if (auto *literal = dynamic_cast<const ArrayLiteral *>(e)) {
+                return std::any_of(literal->elements.begin(), literal->elements.end(), CanTrap);
+            }
+            return false;
+        }
+
+        class Folder {
+        public:
+            Folder(Arena &arena_, FoldReport &report_) : arena(arena_), report(report_) {}
+
+            void block(CodeBlock &block) {
+                StatementList result;
+                result.reserve(block.statements.size());
+                for (Statement *st: block.statements) {
+                    statement(st, result);
+                }
+                block.statements = std::move(result);
+            }
+
+        private:
+            Arena &arena;
+            FoldReport &report;
+
+            // appends what is left of st to out
+            void statement(Statement *st, StatementList &out) {
+                if (auto *decl = dynamic_cast<VarDecl *>(st)) {
+                    decl->expr = expression(decl->expr);
+                } else if (auto *assign = dynamic_cast<VarAssign *>(st)) {
+                    assign->expr = expression(assign->expr);
+                } else if (auto *print = dynamic_cast<PrintStatement *>(st)) {
+                    print->e = expression(print->e);
+                } else if (auto *assign = dynamic_cast<IndexAssign *>(st)) {
+                    assign->index = expression(assign->index);
+                    assign->expr = expression(assign->expr);
+                } else if (auto *call = dynamic_cast<ProcedureCall *>(st)) {
+                    call->target = expression(call->target);
+                    call->value = expression(call->value);
+                } else if (auto *loop = dynamic_cast<WhileLoop *>(st)) {
+                    loop->expr = expression(loop->expr);
+                    if (AsBool(loop->expr) == false) {
+                        removed("while (False) loop with " + std::to_string(loop->code_block->statements.size()) +
+                                " statement(s)");
+                        return;
+                    }
+                    block(*loop->code_block);
+                } else if (auto *loop = dynamic_cast<ParallelFor *>(st)) {
+                    loop->begin = expression(loop->begin);
+                    loop->end = expression(loop->end);
+                    block(*loop->body);
+                } else if (auto *ifSt = dynamic_cast<IfStatement *>(st)) {
+                    ifSt->expr = expression(ifSt->expr);
+                    if (auto cond = AsBool(ifSt->expr)) {
+                        // the live branch is spliced into the enclosing block
+                        CodeBlock *live = *cond ? ifSt->on_if : ifSt->on_else;
+                        if (*cond && ifSt->on_else) {
+                            removed("else branch of if (True) with " +
+                                    std::to_string(ifSt->on_else->statements.size()) + " statement(s)");
+                        } else if (!*cond) {
+                            removed("then branch of if (False) with " +
+                                    std::to_string(ifSt->on_if->statements.size()) + " statement(s)");
+                        }
+                        if (live) {
+                            block(*live);
+                            out.insert(out.end(), live->statements.begin(), live->statements.end());
+                        }
+                        return;
+                    }
+                    block(*ifSt->on_if);
+                    if (ifSt->on_else) {
+                        block(*ifSt->on_else);
+                    }
+                }
+                out.push_back(st);
+            }
+
+            Expression *expression(Expression *e) {
+                if (auto *op = dynamic_cast<UnaryOp *>(e)) {
+                    op->expr = expression(op->expr);
+                    return unary(op);
+                }
+                if (auto *op = dynamic_cast<BinaryOp *>(e)) {
+                    op->lhs = expression(op->lhs);
+                    op->rhs = expression(op->rhs);
+                    return binary(op);
+                }
+                if (auto *call = dynamic_cast<Call *>(e)) {
+                    std::int32_t values[2];
+                    bool constant = true;
+                    for (std::size_t i = 0; i < call->args.size(); ++i) {
+                        call->args[i] = expression(call->args[i]);
+                        auto v = AsInt(call->args[i]);
+                        constant = constant && v;
+                        values[i] = v.value_or(0);
+                    }
+                    if (constant) {
+                        return folded(arena.make<ConstantInt>(eval::CallBuiltin(call->fn, values)));
+                    }
+                    return call;
+                }
+                if (auto *array = dynamic_cast<NewArray *>(e)) {
+                    array->length = expression(array->length);
+                } else if (auto *literal = dynamic_cast<ArrayLiteral *>(e)) {
+                    for (Expression *&element: literal->elements) {
+                        element = expression(element);
+                    }
+                } else if (auto *index = dynamic_cast<Index *>(e)) {
+                    index->array = expression(index->array);
+                    index->index = expression(index->index);
+                }
+                return e;
+            }
+
+            Expression *unary(UnaryOp *op) {
+                // double negation
+                if (auto *inner = dynamic_cast<UnaryOp *>(op->expr); inner && inner->op == op->op) {
+                    return folded(inner->expr);
+                }
+                switch (op->op) {
+                    case UnaryOpType::Minus:
+                        if (auto v = AsInt(op->expr)) {
+                            return folded(arena.make<ConstantInt>(std::int32_t(0u - std::uint32_t(*v))));
+                        }
+                        break;
+                    case UnaryOpType::Neg:
+                        if (auto v = AsBool(op->expr)) {
+                            return folded(arena.make<ConstantBool>(!*v));
+                        }
+                        break;
+                }
+                return op;
+            }
+
+            Expression *binary(BinaryOp *op) {
+                auto li = AsInt(op->lhs), ri = AsInt(op->rhs);
+                auto lb = AsBool(op->lhs), rb = AsBool(op->rhs);
+                auto *ls = AsString(op->lhs), *rs = AsString(op->rhs);
+
+                switch (op->op) {
+                    case BinaryOpType::Sum:
+                        if (ls && rs) {
+                            return folded(arena.make<ConstantString>(*ls + *rs));
+                        }
+                        [[fallthrough]];
+                    case BinaryOpType::Sub:
+                    case BinaryOpType::Mult:
+                    case BinaryOpType::Div:
+                    case BinaryOpType::Pow:
+                        if (li && ri) {
+                            if (auto v = eval::IntOp(op->op, *li, *ri)) {
+                                return folded(arena.make<ConstantInt>(*v));
+                            }
+                            return op;
+                        }
+                        return intIdentity(op, li, ri);
+                    case BinaryOpType::Leq:
+                    case BinaryOpType::Les:
+                    case BinaryOpType::Geq:
+                    case BinaryOpType::Gre:
+                        if (li && ri) {
+                            return folded(arena.make<ConstantBool>(eval::Compare(op->op, *li, *ri)));
+                        }
+                        return op;
+                    case BinaryOpType::Eq:
+                    case BinaryOpType::Neq:
+                        if (li && ri) {
+                            return folded(arena.make<ConstantBool>(eval::Compare(op->op, *li, *ri)));
+                        }
+                        if (lb && rb) {
+                            return folded(arena.make<ConstantBool>(eval::Compare(op->op, *lb, *rb)));
+                        }
+                        if (ls && rs) {
+                            return folded(arena.make<ConstantBool>((*ls == *rs) == (op->op == BinaryOpType::Eq)));
+                        }
+                        return op;
+                    // both operands are evaluated at run time, so the dropped one must not trap
+                    case BinaryOpType::And:
+                        if (lb && (*lb || !CanTrap(op->rhs))) {
+                            return folded(*lb ? op->rhs : op->lhs);
+                        }
+                        if (rb && (*rb || !CanTrap(op->lhs))) {
+                            return folded(*rb ? op->lhs : op->rhs);
+                        }
+                        return op;
+                    case BinaryOpType::Or:
+                        if (lb && (!*lb || !CanTrap(op->rhs))) {
+                            return folded(*lb ? op->lhs : op->rhs);
+                        }
+                        if (rb && (!*rb || !CanTrap(op->lhs))) {
+                            return folded(*rb ? op->rhs : op->lhs);
+                        }
+                        return op;
+                }
+                return op;
+            }
+
+            // x+0, 0+x, x-0, x*1, 1*x, x*0, 0*x, x/1
+            Expression *intIdentity(BinaryOp *op, std::optional<std::int32_t> li, std::optional<std::int32_t> ri) {
+                if (op->type != DataType::Int) {
+                    return op;
+                }
+                switch (op->op) {
+                    case BinaryOpType::Sum:
+                        if (li == 0) {
+                            return folded(op->rhs);
+                        }
+                        if (ri == 0) {
+                            return folded(op->lhs);
+                        }
+                        break;
+                    case BinaryOpType::Sub:
+                        if (ri == 0) {
+                            return folded(op->lhs);
+                        }
+                        break;
+                    case BinaryOpType::Mult:
+                        if (li == 1) {
+                            return folded(op->rhs);
+                        }
+                        if (ri == 1) {
+                            return folded(op->lhs);
+                        }
+                        if ((li == 0 && !CanTrap(op->rhs)) || (ri == 0 && !CanTrap(op->lhs))) {
+                            return folded(arena.make<ConstantInt>(0));
+                        }
+                        break;
+                    case BinaryOpType::Div:
+                        if (ri == 1) {
+                            return folded(op->lhs);
+                        }
+                        break;
+                    default:
+                        break;
+                }
+                return op;
+            }
+
+            Expression *folded(Expression *e) {
+                ++report.foldedExpressions;
+                return e;
+            }
+
+            void removed(std::string what) {
+                ++report.removedStatements;
+                report.removed.push_back(std::move(what));
+            }
+        };
+    }
+
+    FoldReport FoldConstants(CodeBlock &root, Arena &arena) {
+        FoldReport report;
+        Folder(arena, report).block(root);
+        return report;
+    }
+}
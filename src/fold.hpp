@@ -0,0 +1,45 @@
+/*
+    Constant folding and algebraic simplification of the AST
+
+    Runs between parsing and codegen: constant subtrees are evaluated (string concatenation and comparison
+    included), identities such as x*1, x+0, x*0 and double negation are applied, and statically dead
+    if-branches and while-loops are removed. The counts of the FoldReport are counters of --time-report, the
+    pieces of code it removed are listed by --trace=ast.
+    An operand is only dropped (as in x*0, False && x, True || x) when evaluating it can't trap: array reads,
+    Int[n], elementwise array operations and division may stop the program at run time.
+*/
+#pragma once
+
+#include "node.hpp"
+#include "arena.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace AST {
+    struct FoldReport {
+        unsigned foldedExpressions = 0;
+        unsigned removedStatements = 0;
+        std::vector<std::string> removed; // human-readable description of every removed piece of code
+    };
+
+    // new nodes are allocated in arena, root is changed in place
+    FoldReport FoldConstants(CodeBlock &root, Arena &arena);
+
+    namespace eval {
+        // the same semantics as the generated code: Int wraps around on overflow;
+        // std::nullopt when the result can only be known at run time (e.g. division by zero)
+        std::optional<std::int32_t> IntOp(BinaryOpType op, std::int32_t lhs, std::int32_t rhs);
+
+        // exponentiation by squaring, see builtins.hpp for negative exponents
+        std::int32_t Pow(std::int32_t base, std::int32_t exp);
+
+        // args holds as many values as fn takes
+        std::int32_t CallBuiltin(Builtin fn, const std::int32_t *args);
+
+        // comparison operators and ==, != on Int or Bool operands
+        bool Compare(BinaryOpType op, std::int32_t lhs, std::int32_t rhs);
+    }
+}
@@ -0,0 +1,48 @@
+#include "options.hpp"
+#include "driver.hpp"
+#include "server.hpp"
+#include "trace.hpp"
+
+#include <llvm/Support/TargetSelect.h>
+
+#include <iostream>
+
+int main(int argc, char* argv[]){
+    options::CompilerOptions opts;
+    try {
+        opts = options::ParseOptions(argc, argv);
+        trace::Configure(opts.trace);
+        if (!opts.connect.empty()) {
+            return server::Connect(opts); // the client needs no LLVM
+        }
+    } catch(std::exception & e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+
+    if (!opts.serve.empty()) {
+        try {
+            return server::Serve(opts);
+        } catch(std::exception & e) {
+            std::cout << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    if (opts.jobs) {
+        return driver::CompileBatch(opts) == 0 ? 0 : 1;
+    }
+
+    try {
+        driver::CompileFile(opts, opts.input, opts.output);
+    } catch(std::exception & e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
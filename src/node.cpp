@@ -1,19 +1,10 @@
 #include <exception>
 #include <string>
+#include <unordered_set>
 #include "node.hpp"
 #include <llvm/IR/Value.h>
 
 namespace AST {
-    std::stack<Statement *> &StackOfStatements() {
-        static std::stack<Statement *> statements;
-        return statements;
-    }
-
-    std::stack<std::size_t> &CodeBlockStart() {
-        static std::stack<std::size_t> levelStack;
-        return levelStack;
-    }
-
     namespace details {
 
         DataType GetType(int val) {
@@ -50,41 +41,59 @@ namespace AST {
                 case DataType::Bool:
                     return "Bool";
                     break;
+                case DataType::IntArray:
+                    return "Int[]";
+                    break;
+                case DataType::BoolArray:
+                    return "Bool[]";
+                    break;
                 default:
                     llvm_unreachable("ShowType: unknown DataType!");
                     break;
             }
         }
+
+        bool IsArray(DataType type) {
+            return type == DataType::IntArray || type == DataType::BoolArray;
+        }
+
+        DataType ElementType(DataType arrayType) {
+            assert(IsArray(arrayType));
+            return arrayType == DataType::IntArray ? DataType::Int : DataType::Bool;
+        }
+
+        DataType ArrayOf(DataType elementType) {
+            assert(elementType == DataType::Int || elementType == DataType::Bool);
+            return elementType == DataType::Int ? DataType::IntArray : DataType::BoolArray;
+        }
     }
 
     Node::~Node() {}
 
 
-    Identifier::Identifier(DataType type_, std::string name_) : name(std::move(name_)) {
+    Identifier::Identifier(DataType type_, std::string name_, Symbol symbol_) : name(std::move(name_)),
+                                                                                  symbol(symbol_) {
         type = std::move(type_);
-        std::cout << "Identifier " << name << " created" << '\n';
-
-        // Variables[name] = this;
-        std::cout << "[Variables] <--- " << name << std::endl;
+        TRACE(Ast, Debug) << "Identifier " << name << " created";
     }
 
     CodeBlock::CodeBlock(StatementList statements_) : statements(std::move(statements_)) {
-        std::cout << "_____CodeBlock created_____" << std::endl;
+        TRACE(Ast, Debug) << "_____CodeBlock created_____";
     }
 
-    UnaryOp::UnaryOp(UnaryOpType op_, Expression &expr_) : op(op_), expr(expr_) {
+    UnaryOp::UnaryOp(UnaryOpType op_, Expression *expr_) : op(op_), expr(expr_) {
         const char *errorMsg = "UnaryOp with wrong type";
         switch (op) {
             case UnaryOpType::Minus: {
                 type = DataType::Int;
-                if (!details::HasType(expr, DataType::Int)) {
+                if (!details::HasType(*expr, DataType::Int)) {
                     throw std::runtime_error(errorMsg);
                 }
                 break;
             }
             case UnaryOpType::Neg: {
                 type = DataType::Bool;
-                if (!details::HasType(expr, DataType::Bool)) {
+                if (!details::HasType(*expr, DataType::Bool)) {
                     throw std::runtime_error(errorMsg);
                 }
                 break;
@@ -92,9 +101,19 @@ namespace AST {
         }
     }
 
-    BinaryOp::BinaryOp(Expression &lhs_, BinaryOpType op_, Expression &rhs_) : op(op_), lhs(lhs_), rhs(rhs_) {
+    BinaryOp::BinaryOp(Expression *lhs_, BinaryOpType op_, Expression *rhs_) : op(op_), lhs(lhs_), rhs(rhs_) {
         const char *errorMsg = "BinOp with wrong types";
 
+        // +, - and * of Int[] are elementwise, with an Int operand on either side applied to every element
+        bool elementwise = (op == BinaryOpType::Sum || op == BinaryOpType::Sub || op == BinaryOpType::Mult) &&
+                           (details::HasType(*lhs, DataType::IntArray) || details::HasType(*rhs, DataType::IntArray)) &&
+                           (details::HasType(*lhs, DataType::IntArray) || details::HasType(*lhs, DataType::Int)) &&
+                           (details::HasType(*rhs, DataType::IntArray) || details::HasType(*rhs, DataType::Int));
+        if (elementwise) {
+            type = DataType::IntArray;
+            return;
+        }
+
         // type checking
         switch (op) {
             case BinaryOpType::Pow:
@@ -105,14 +124,14 @@ namespace AST {
             case BinaryOpType::Les:
             case BinaryOpType::Geq:
             case BinaryOpType::Gre: {
-                if (!details::HasType(lhs, DataType::Int) || !details::HasType(rhs, DataType::Int)) {
+                if (!details::HasType(*lhs, DataType::Int) || !details::HasType(*rhs, DataType::Int)) {
                     throw std::runtime_error(errorMsg);
                 }
                 break;
             }
             case BinaryOpType::Sum: {
-                bool bothInt = details::HasType(lhs, DataType::Int) && details::HasType(rhs, DataType::Int);
-                bool bothStr = details::HasType(lhs, DataType::String) && details::HasType(rhs, DataType::String);
+                bool bothInt = details::HasType(*lhs, DataType::Int) && details::HasType(*rhs, DataType::Int);
+                bool bothStr = details::HasType(*lhs, DataType::String) && details::HasType(*rhs, DataType::String);
                 if (!bothInt && !bothStr) {
                     throw std::runtime_error(errorMsg);
                 }
@@ -120,20 +139,20 @@ namespace AST {
             }
             case BinaryOpType::Eq:
             case BinaryOpType::Neq: {
-                if (!details::SameType(lhs, rhs)) {
+                if (!details::SameType(*lhs, *rhs) || details::IsArray(lhs->type)) {
                     throw std::runtime_error(errorMsg);
                 }
                 break;
             }
             case BinaryOpType::And:
             case BinaryOpType::Or: {
-                if (!details::HasType(lhs, DataType::Bool) || !details::HasType(lhs, DataType::Bool)) {
+                if (!details::HasType(*lhs, DataType::Bool) || !details::HasType(*lhs, DataType::Bool)) {
                     throw std::runtime_error(errorMsg);
                 }
                 break;
             }
             default:
-                std::cout << "Unknown BinOp\n";
+                TRACE(Ast, Debug) << "Unknown BinOp";
         }
 
         // calculating result type
@@ -143,8 +162,8 @@ namespace AST {
             case BinaryOpType::Div:
             case BinaryOpType::Sub:
             case BinaryOpType::Sum: {
-                type = lhs.type;
-                assert(lhs.type == rhs.type);
+                type = lhs->type;
+                assert(lhs->type == rhs->type);
                 break;
             }
             case BinaryOpType::Leq:
@@ -161,44 +180,500 @@ namespace AST {
         }
     }
 
-    VarDecl::VarDecl(Identifier *ident_, Expression &expr_) : ident(ident_),
+    Builtin FindBuiltin(const std::string &name) {
+        for (Builtin fn: {Builtin::Abs, Builtin::Min, Builtin::Max, Builtin::Pow, Builtin::Len, Builtin::Sum}) {
+            if (name == BuiltinName(fn)) {
+                return fn;
+            }
+        }
+        throw std::runtime_error("Unknown function " + name + "!");
+    }
+
+    const char *BuiltinName(Builtin fn) {
+        switch (fn) {
+            case Builtin::Abs:
+                return "abs";
+            case Builtin::Min:
+                return "min";
+            case Builtin::Max:
+                return "max";
+            case Builtin::Pow:
+                return "pow";
+            case Builtin::Len:
+                return "len";
+            case Builtin::Sum:
+                return "sum";
+        }
+        llvm_unreachable("BuiltinName: unknown builtin!");
+    }
+
+    Procedure FindProcedure(const std::string &name) {
+        for (Procedure proc: {Procedure::Fill, Procedure::Copy}) {
+            if (name == ProcedureName(proc)) {
+                return proc;
+            }
+        }
+        throw std::runtime_error("Unknown procedure " + name + "!");
+    }
+
+    const char *ProcedureName(Procedure proc) {
+        switch (proc) {
+            case Procedure::Fill:
+                return "fill";
+            case Procedure::Copy:
+                return "copy";
+        }
+        llvm_unreachable("ProcedureName: unknown procedure!");
+    }
+
+    ReductionOp FindReduction(const std::string &name) {
+        for (ReductionOp op: {ReductionOp::Min, ReductionOp::Max}) {
+            if (name == ReductionName(op)) {
+                return op;
+            }
+        }
+        throw std::runtime_error("Unknown reduction " + name + "!");
+    }
+
+    const char *ReductionName(ReductionOp op) {
+        switch (op) {
+            case ReductionOp::Sum:
+                return "+";
+            case ReductionOp::Mult:
+                return "*";
+            case ReductionOp::Min:
+                return "min";
+            case ReductionOp::Max:
+                return "max";
+            case ReductionOp::And:
+                return "&&";
+            case ReductionOp::Or:
+                return "||";
+        }
+        llvm_unreachable("ReductionName: unknown reduction!");
+    }
+
+    void ParseLoopPragma(std::string_view text, LoopHints &hints) {
+        auto error = [&](std::string_view what) {
+            return std::runtime_error("Unknown loop pragma " + std::string(what) +
+                                      " (expected unroll(N|full|disable), vectorize(enable|disable), "
+                                      "vectorize_width(N) or interleave_count(N))");
+        };
+        std::size_t pos = 0;
+        while (true) {
+            pos = text.find_first_not_of(" \t\r", pos);
+            if (pos == std::string_view::npos) {
+                return;
+            }
+            std::size_t open = text.find('(', pos), close = text.find(')', pos);
+            if (open == std::string_view::npos || close == std::string_view::npos || close < open) {
+                throw error(text.substr(pos));
+            }
+            std::string_view name = text.substr(pos, open - pos), arg = text.substr(open + 1, close - open - 1);
+            std::string_view hint = text.substr(pos, close + 1 - pos);
+            pos = close + 1;
+
+            int count = 0;
+            bool isCount = !arg.empty() && arg.size() <= 4 && arg.find_first_not_of("0123456789") == std::string_view::npos;
+            if (isCount) {
+                count = std::stoi(std::string(arg));
+            }
+            if (name == "unroll" && arg == "full") {
+                hints.unrollFull = true;
+            } else if (name == "unroll" && arg == "disable") {
+                hints.unroll = 0;
+            } else if (name == "unroll" && isCount && count > 0) {
+                hints.unroll = count;
+            } else if (name == "vectorize" && (arg == "enable" || arg == "disable")) {
+                hints.vectorize = arg == "enable";
+            } else if (name == "vectorize_width" && isCount && count > 0) {
+                hints.vectorizeWidth = count;
+            } else if (name == "interleave_count" && isCount && count > 0) {
+                hints.interleaveCount = count;
+            } else {
+                throw error(hint);
+            }
+        }
+    }
+
+    Call::Call(Builtin fn_, std::vector<Expression *> args_) : fn(fn_), args(std::move(args_)) {
+        bool reduction = (fn == Builtin::Min || fn == Builtin::Max) && args.size() == 1;
+        if (fn == Builtin::Len || fn == Builtin::Sum || reduction) {
+            if (args.size() != 1) {
+                throw std::runtime_error(std::string(BuiltinName(fn)) + " takes 1 argument(s)");
+            }
+            bool ok = fn == Builtin::Len ? details::IsArray(args[0]->type) : details::HasType(*args[0], DataType::IntArray);
+            if (!ok) {
+                throw std::runtime_error(std::string("Wrong argument of ") + BuiltinName(fn) + ": " +
+                                         details::ShowType(args[0]->type));
+            }
+            type = DataType::Int;
+            TRACE(Ast, Debug) << "Call of " << BuiltinName(fn) << " created";
+            return;
+        }
+        std::size_t arity = fn == Builtin::Abs ? 1 : 2;
+        if (args.size() != arity) {
+            throw std::runtime_error(std::string(BuiltinName(fn)) + " takes " + std::to_string(arity) +
+                                     " argument(s)");
+        }
+        for (Expression *arg: args) {
+            if (!details::HasType(*arg, DataType::Int)) {
+                throw std::runtime_error(std::string("Non-int argument of ") + BuiltinName(fn));
+            }
+        }
+        type = DataType::Int;
+        TRACE(Ast, Debug) << "Call of " << BuiltinName(fn) << " created";
+    }
+
+    NewArray::NewArray(DataType elementType, Expression *length_) : length(length_) {
+        if (!details::HasType(*length, DataType::Int)) {
+            throw std::runtime_error("Non-int length of an array");
+        }
+        type = details::ArrayOf(elementType);
+    }
+
+    ArrayLiteral::ArrayLiteral(std::vector<Expression *> elements_) : elements(std::move(elements_)) {
+        assert(!elements.empty());
+        DataType elementType = elements[0]->type;
+        if (elementType != DataType::Int && elementType != DataType::Bool) {
+            throw std::runtime_error("Arrays of " + details::ShowType(elementType) + " are not supported");
+        }
+        for (Expression *e: elements) {
+            if (!details::SameType(*e, *elements[0])) {
+                throw std::runtime_error("Mismatched types of array elements");
+            }
+        }
+        type = details::ArrayOf(elementType);
+    }
+
+    Index::Index(Expression *array_, Expression *index_) : array(array_), index(index_) {
+        if (!details::IsArray(array->type)) {
+            throw std::runtime_error("Indexing a non-array of type " + details::ShowType(array->type));
+        }
+        if (!details::HasType(*index, DataType::Int)) {
+            throw std::runtime_error("Non-int index of an array");
+        }
+        type = details::ElementType(array->type);
+    }
+
+    IndexAssign::IndexAssign(Identifier *ident_, Expression *index_, Expression *expr_) : ident(ident_),
+                                                                                          index(index_),
+                                                                                          expr(expr_) {
+        if (ident == nullptr) {
+            throw std::runtime_error("Nullptr ident in IndexAssign");
+        }
+        if (!details::IsArray(ident->type)) {
+            throw std::runtime_error("Indexing a non-array of type " + details::ShowType(ident->type));
+        }
+        if (!details::HasType(*index, DataType::Int)) {
+            throw std::runtime_error("Non-int index of an array");
+        }
+        if (!details::HasType(*expr, details::ElementType(ident->type))) {
+            throw std::runtime_error("Mismatched typed in IndexAssign");
+        }
+    }
+
+    ProcedureCall::ProcedureCall(Procedure proc_, Expression *target_, Expression *value_) : proc(proc_),
+                                                                                             target(target_),
+                                                                                             value(value_) {
+        if (!details::IsArray(target->type)) {
+            throw std::runtime_error(std::string(ProcedureName(proc)) + " of a non-array of type " +
+                                     details::ShowType(target->type));
+        }
+        DataType expected = proc == Procedure::Fill ? details::ElementType(target->type) : target->type;
+        if (!details::HasType(*value, expected)) {
+            throw std::runtime_error(std::string("Mismatched types in ") + ProcedureName(proc));
+        }
+    }
+
+    VarDecl::VarDecl(Identifier *ident_, Expression *expr_) : ident(ident_),
                                                               expr(expr_) {
         if (ident == nullptr) {
             throw std::runtime_error("Nullptr ident in VarDecl");
         }
-        if (!details::SameType(*ident, expr)) {
+        if (!details::SameType(*ident, *expr)) {
             throw std::runtime_error("Mismatched typed in VarDecl");
         }
     }
 
 
-    VarAssign::VarAssign(Identifier *ident_, Expression &expr_) : expr(expr_),
+    VarAssign::VarAssign(Identifier *ident_, Expression *expr_) : expr(expr_),
                                                                   ident(ident_) {
         if (ident == nullptr) {
             throw std::runtime_error("Nullptr ident in VarAssign");
         }
-        if (!details::SameType(*ident, expr)) {
+        if (!details::SameType(*ident, *expr)) {
             throw std::runtime_error("Mismatched typed in VarAssign");
         }
-        std::cout << ident->name << " assigned" << std::endl;
+        TRACE(Ast, Debug) << ident->name << " assigned";
     }
 
-    WhileLoop::WhileLoop(Expression &expr_, CodeBlock code_block_) : expr(expr_),
-                                                                     code_block(std::move(code_block_)) {
-        if (!details::HasType(expr, DataType::Bool)) {
+    namespace {
+        bool Assigns(const CodeBlock &block, const Identifier *ident, std::size_t statements) {
+            for (std::size_t i = 0; i < statements; ++i) {
+                Statement *st = block.statements[i];
+                if (auto *assign = dynamic_cast<VarAssign *>(st); assign && assign->ident == ident) {
+                    return true;
+                }
+                if (auto *loop = dynamic_cast<WhileLoop *>(st);
+                        loop && Assigns(*loop->code_block, ident, loop->code_block->statements.size())) {
+                    return true;
+                }
+                if (auto *ifSt = dynamic_cast<IfStatement *>(st)) {
+                    if (Assigns(*ifSt->on_if, ident, ifSt->on_if->statements.size()) ||
+                        (ifSt->on_else && Assigns(*ifSt->on_else, ident, ifSt->on_else->statements.size()))) {
+                        return true;
+                    }
+                }
+                if (auto *loop = dynamic_cast<ParallelFor *>(st);
+                        loop && (loop->index == ident || Assigns(*loop->body, ident, loop->body->statements.size()))) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // the rules of ParallelFor for its body, and the variables the body shares with the code around it
+        class ParallelBody {
+        public:
+            explicit ParallelBody(ParallelFor &loop_) : loop(loop_) {
+                for (const Reduction &r: loop.reductions) {
+                    reductionOf.emplace(r.ident->slot, r.op);
+                }
+                declared(*loop.body);
+            }
+
+            void check() {
+                block(*loop.body);
+            }
+
+        private:
+            ParallelFor &loop;
+            std::unordered_map<std::uint32_t, ReductionOp> reductionOf; // by slot
+            std::unordered_set<std::uint32_t> locals; // declared by the body
+            std::unordered_set<std::uint32_t> seen;
+
+            void declared(const CodeBlock &b) {
+                for (Statement *st: b.statements) {
+                    if (auto *decl = dynamic_cast<VarDecl *>(st)) {
+                        locals.insert(decl->ident->slot);
+                    } else if (auto *w = dynamic_cast<WhileLoop *>(st)) {
+                        declared(*w->code_block);
+                    } else if (auto *ifSt = dynamic_cast<IfStatement *>(st)) {
+                        declared(*ifSt->on_if);
+                        if (ifSt->on_else) {
+                            declared(*ifSt->on_else);
+                        }
+                    } else if (auto *inner = dynamic_cast<ParallelFor *>(st)) {
+                        locals.insert(inner->index->slot);
+                        declared(*inner->body);
+                    }
+                }
+            }
+
+            [[noreturn]] void misusedReduction(const Identifier *ident) const {
+                const std::string &name = ident->name;
+                throw std::runtime_error("Reduction variable " + name + " can only be updated as " + name + " = " +
+                                         name + " " + ReductionName(reductionOf.at(ident->slot)) + " ...");
+            }
+
+            void read(Expression *e) {
+                if (auto *ident = dynamic_cast<Identifier *>(e)) {
+                    if (reductionOf.count(ident->slot)) {
+                        misusedReduction(ident);
+                    }
+                    if (!locals.count(ident->slot) && ident != loop.index && seen.insert(ident->slot).second) {
+                        loop.shared.push_back(ident);
+                    }
+                } else if (auto *op = dynamic_cast<UnaryOp *>(e)) {
+                    read(op->expr);
+                } else if (auto *op = dynamic_cast<BinaryOp *>(e)) {
+                    read(op->lhs);
+                    read(op->rhs);
+                } else if (auto *call = dynamic_cast<Call *>(e)) {
+                    for (Expression *arg: call->args) {
+                        read(arg);
+                    }
+                } else if (auto *array = dynamic_cast<NewArray *>(e)) {
+                    read(array->length);
+                } else if (auto *literal = dynamic_cast<ArrayLiteral *>(e)) {
+                    for (Expression *element: literal->elements) {
+                        read(element);
+                    }
+                } else if (auto *index = dynamic_cast<Index *>(e)) {
+                    read(index->array);
+                    read(index->index);
+                }
+            }
+
+            // the other operand of s = s op e, s = e op s, s = min(s, e) and s = min(e, s)
+            Expression *update(const Identifier *self, ReductionOp op, Expression *e) const {
+                Expression *lhs = nullptr, *rhs = nullptr;
+                if (auto *binary = dynamic_cast<BinaryOp *>(e)) {
+                    static const std::pair<BinaryOpType, ReductionOp> operators[] = {
+                            {BinaryOpType::Sum, ReductionOp::Sum},
+                            {BinaryOpType::Mult, ReductionOp::Mult},
+                            {BinaryOpType::And, ReductionOp::And},
+                            {BinaryOpType::Or, ReductionOp::Or},
+                    };
+                    for (auto [binaryOp, reductionOp]: operators) {
+                        if (binary->op == binaryOp && op == reductionOp) {
+                            lhs = binary->lhs;
+                            rhs = binary->rhs;
+                        }
+                    }
+                } else if (auto *call = dynamic_cast<Call *>(e); call && call->args.size() == 2) {
+                    if ((call->fn == Builtin::Min && op == ReductionOp::Min) ||
+                        (call->fn == Builtin::Max && op == ReductionOp::Max)) {
+                        lhs = call->args[0];
+                        rhs = call->args[1];
+                    }
+                }
+                if (lhs && lhs == self) {
+                    return rhs;
+                }
+                if (rhs && rhs == self) {
+                    return lhs;
+                }
+                misusedReduction(self);
+            }
+
+            void assigned(Identifier *ident) {
+                if (ident == loop.index) {
+                    throw std::runtime_error("Assignment to the index " + ident->name + " of a parallel for");
+                }
+                if (!locals.count(ident->slot)) {
+                    throw std::runtime_error("Assignment to the shared variable " + ident->name +
+                                             " in a parallel for");
+                }
+            }
+
+            void block(CodeBlock &b) {
+                for (Statement *st: b.statements) {
+                    statement(st);
+                }
+            }
+
+            void statement(Statement *st) {
+                if (auto *decl = dynamic_cast<VarDecl *>(st)) {
+                    read(decl->expr);
+                } else if (auto *assign = dynamic_cast<VarAssign *>(st)) {
+                    auto r = reductionOf.find(assign->ident->slot);
+                    if (r != reductionOf.end()) {
+                        read(update(assign->ident, r->second, assign->expr));
+                        return;
+                    }
+                    assigned(assign->ident);
+                    read(assign->expr);
+                } else if (auto *assign = dynamic_cast<IndexAssign *>(st)) {
+                    // the elements of a shared array may be assigned, by different iterations
+                    read(assign->ident);
+                    read(assign->index);
+                    read(assign->expr);
+                } else if (auto *call = dynamic_cast<ProcedureCall *>(st)) {
+                    read(call->target);
+                    read(call->value);
+                } else if (auto *w = dynamic_cast<WhileLoop *>(st)) {
+                    read(w->expr);
+                    block(*w->code_block);
+                } else if (auto *ifSt = dynamic_cast<IfStatement *>(st)) {
+                    read(ifSt->expr);
+                    block(*ifSt->on_if);
+                    if (ifSt->on_else) {
+                        block(*ifSt->on_else);
+                    }
+                } else if (dynamic_cast<PrintStatement *>(st)) {
+                    throw std::runtime_error("print in a parallel for");
+                } else if (auto *inner = dynamic_cast<ParallelFor *>(st)) {
+                    read(inner->begin);
+                    read(inner->end);
+                    for (const Reduction &r: inner->reductions) {
+                        auto outer = reductionOf.find(r.ident->slot);
+                        if (outer == reductionOf.end()) {
+                            assigned(r.ident);
+                        } else if (outer->second != r.op) {
+                            misusedReduction(r.ident);
+                        }
+                    }
+                    block(*inner->body);
+                }
+            }
+        };
+    }
+
+    bool WhileLoop::isCounted() const {
+        auto *cond = dynamic_cast<const BinaryOp *>(expr);
+        if (!cond || cond->op == BinaryOpType::Eq || cond->op == BinaryOpType::And || cond->op == BinaryOpType::Or) {
+            return false;
+        }
+        auto *var = dynamic_cast<const Identifier *>(cond->lhs);
+        if (!var) {
+            var = dynamic_cast<const Identifier *>(cond->rhs);
+        }
+        const StatementList &body = code_block->statements;
+        if (!var || var->type != DataType::Int || body.empty()) {
+            return false;
+        }
+
+        // i = i + c, i = c + i or i = i - c
+        auto *step = dynamic_cast<const VarAssign *>(body.back());
+        auto *next = step && step->ident == var ? dynamic_cast<const BinaryOp *>(step->expr) : nullptr;
+        if (!next || (next->op != BinaryOpType::Sum && next->op != BinaryOpType::Sub)) {
+            return false;
+        }
+        const Expression *other = nullptr;
+        if (next->lhs == var) {
+            other = next->rhs;
+        } else if (next->op == BinaryOpType::Sum && next->rhs == var) {
+            other = next->lhs;
+        }
+        auto *constant = dynamic_cast<const ConstantInt *>(other);
+        if (!constant || constant->val == 0) {
+            return false;
+        }
+        return !Assigns(*code_block, var, body.size() - 1);
+    }
+
+    WhileLoop::WhileLoop(Expression *expr_, CodeBlock *code_block_) : expr(expr_),
+                                                                      code_block(code_block_) {
+        if (!details::HasType(*expr, DataType::Bool)) {
             throw std::runtime_error("Non-bool expr in WhileLoop");
         }
-        std::cout << "While cycle created" << std::endl;
+        TRACE(Ast, Debug) << "While cycle created";
+    }
+
+    ParallelFor::ParallelFor(Identifier *index_, Expression *begin_, Expression *end_,
+                             std::vector<Reduction> reductions_, CodeBlock *body_)
+            : index(index_), begin(begin_), end(end_), reductions(std::move(reductions_)), body(body_) {
+        if (!details::HasType(*begin, DataType::Int) || !details::HasType(*end, DataType::Int)) {
+            throw std::runtime_error("Non-int bounds of a parallel for");
+        }
+        for (std::size_t i = 0; i < reductions.size(); ++i) {
+            const Reduction &r = reductions[i];
+            DataType expected = r.op == ReductionOp::And || r.op == ReductionOp::Or ? DataType::Bool : DataType::Int;
+            if (!details::HasType(*r.ident, expected)) {
+                throw std::runtime_error(std::string("Wrong type of the reduction variable ") + r.ident->name +
+                                         " of " + ReductionName(r.op) + ": " + details::ShowType(r.ident->type));
+            }
+            if (r.ident == index) {
+                throw std::runtime_error("Assignment to the index " + index->name + " of a parallel for");
+            }
+            for (std::size_t j = 0; j < i; ++j) {
+                if (reductions[j].ident == r.ident) {
+                    throw std::runtime_error("Reduction variable " + r.ident->name + " is given twice");
+                }
+            }
+        }
+        ParallelBody(*this).check();
+        TRACE(Ast, Debug) << "Parallel for created";
     }
 
-    IfStatement::IfStatement(Expression &expr_, CodeBlock on_if_, std::optional<CodeBlock> on_else_) : expr(expr_),
-                                                                                                       on_if(std::move(
-                                                                                                               on_if_)),
-                                                                                                       on_else(std::move(
-                                                                                                               on_else_)) {
-        if (!details::HasType(expr, DataType::Bool)) {
+    IfStatement::IfStatement(Expression *expr_, CodeBlock *on_if_, CodeBlock *on_else_) : expr(expr_),
+                                                                                          on_if(on_if_),
+                                                                                          on_else(on_else_) {
+        if (!details::HasType(*expr, DataType::Bool)) {
             throw std::runtime_error("Non-bool expr in WhileLoop");
         }
-        std::cout << "If statement created" << std::endl;
+        TRACE(Ast, Debug) << "If statement created";
     }
 }
\ No newline at end of file
@@ -2,30 +2,27 @@
     A definition of AST node is here
 
     We use exceptions to detect any kind of error (such as Type Mismatch)
+
+    Nodes are allocated from the AST::Arena of the compilation unit and refer to each other
+    with plain pointers, the arena owns all of them.
 */
 #pragma once
 
 #include "decl.hpp"
+#include "trace.hpp"
 
 #include <llvm/IR/Value.h>
 
 #include <vector>
 #include <string>
-#include <iostream>
+#include <string_view>
 #include <exception>
 #include <memory>
-#include <optional>
 #include <cassert>
 #include <unordered_map>
 #include <stack>
 
 namespace AST {
-    struct Statement;
-
-    std::stack<Statement *> &StackOfStatements();
-
-    std::stack<std::size_t> &CodeBlockStart();
-
     namespace details {
         DataType GetType(int val);
 
@@ -38,6 +35,13 @@ namespace AST {
         bool SameType(const Expression &lhs, const Expression &rhs);
 
         std::string ShowType(DataType type);
+
+        bool IsArray(DataType type);
+
+        // Int for Int[], Bool for Bool[]
+        DataType ElementType(DataType arrayType);
+
+        DataType ArrayOf(DataType elementType);
     }
 
     // None must be unreachable
@@ -45,7 +49,9 @@ namespace AST {
         None,
         String,
         Int,
-        Bool
+        Bool,
+        IntArray, // Int[]
+        BoolArray // Bool[]
     };
 
     enum class UnaryOpType {
@@ -69,6 +75,60 @@ namespace AST {
         Or
     };
 
+    // functions of the runtime, see builtins.hpp; Pow also implements the ^ operator.
+    // min and max of one argument are the reductions of an Int[], len and sum take arrays only
+    enum class Builtin {
+        Abs,
+        Min,
+        Max,
+        Pow,
+        Len,
+        Sum
+    };
+
+    // statements that change the elements of an array: fill(a, x) and copy(dst, src)
+    enum class Procedure {
+        Fill,
+        Copy
+    };
+
+    // operators of the reduce clause of a parallel for: +, *, min, max on Int and &&, || on Bool
+    enum class ReductionOp {
+        Sum,
+        Mult,
+        Min,
+        Max,
+        And,
+        Or
+    };
+
+    // throws for names that are not builtins
+    Builtin FindBuiltin(const std::string &name);
+
+    const char *BuiltinName(Builtin fn);
+
+    // throws for names that are not procedures
+    Procedure FindProcedure(const std::string &name);
+
+    const char *ProcedureName(Procedure proc);
+
+    // min and max, the reductions named by a word; throws for other names
+    ReductionOp FindReduction(const std::string &name);
+
+    const char *ReductionName(ReductionOp op);
+
+    // hints of the "//# loop ..." pragma lines before a while, codegen turns them into llvm.loop metadata
+    struct LoopHints {
+        int unroll = -1; // -1 no hint, 0 disable, N unroll N times
+        bool unrollFull = false;
+        int vectorize = -1; // -1 no hint, 0 disable, 1 enable
+        int vectorizeWidth = 0; // 0 no hint
+        int interleaveCount = 0; // 0 no hint
+    };
+
+    // adds the hints of the text after "//# loop", e.g. "vectorize(enable) unroll(4)"; throws on unknown ones
+    void ParseLoopPragma(std::string_view text, LoopHints &hints);
+
     struct Node {
         virtual ~Node();
 
@@ -81,14 +141,16 @@ namespace AST {
         DataType type;
 
         virtual llvm::Value *CodeGen(codegen::CodeGenContext &context) override {
-            std::cout << "Expression base class\n";
+            TRACE(Ast, Debug) << "Expression base class";
             return nullptr;
         }
     };
 
     struct Statement : Node {
+        int line = 0; // of its first token in the source, 0 for statements the parser didn't create
+
         virtual llvm::Value *CodeGen(codegen::CodeGenContext &context) override {
-            std::cout << "Statement base class\n";
+            TRACE(Ast, Debug) << "Statement base class";
             return nullptr;
         }
     };
@@ -106,18 +168,18 @@ namespace AST {
 
         ConstantInt(int val_) : val(val_) {
             type = DataType::Int;
-            std::cout << "Constructed Constant: " << val_ << std::endl;
+            TRACE(Ast, Debug) << "Constructed Constant: " << val_;
         }
 
         virtual llvm::Value *CodeGen(codegen::CodeGenContext &context) override;
     };
 
     struct ConstantString : Expression {
-        std::string val;
+        std::string val; // the contents, without the quotes
 
         ConstantString(std::string val_) : val(val_) {
             type = DataType::String;
-            std::cout << "Constructed Constant: " << val_ << std::endl;
+            TRACE(Ast, Debug) << "Constructed Constant: " << val_;
         }
 
         virtual llvm::Value *CodeGen(codegen::CodeGenContext &context) override;
@@ -128,36 +190,79 @@ namespace AST {
 
         ConstantBool(bool val_) : val(val_) {
             type = DataType::Bool;
-            std::cout << "Constructed Constant: " << val_ << std::endl;
+            TRACE(Ast, Debug) << "Constructed Constant: " << val_;
         }
 
         virtual llvm::Value *CodeGen(codegen::CodeGenContext &context) override;
     };
 
-    // Gonna find value in context
+    // a variable; every use of it is the node of its declaration. slot numbers the declarations of the program
+    // (variables of different blocks may have the same name), codegen, the VM and the passes index their tables
+    // of variables with it
     struct Identifier : public Expression {
         std::string name;
+        Symbol symbol;
+        std::uint32_t slot = 0; // set by ParsingContext::storeIdent
 
-        Identifier(DataType type, std::string name_);
+        Identifier(DataType type, std::string name_, Symbol symbol_);
 
         virtual llvm::Value *CodeGen(codegen::CodeGenContext &context) override;
     };
 
     struct UnaryOp : public Expression {
         UnaryOpType op;
-        Expression &expr;
+        Expression *expr;
 
-        UnaryOp(UnaryOpType op_, Expression &expr_);
+        UnaryOp(UnaryOpType op_, Expression *expr_);
 
         virtual llvm::Value *CodeGen(codegen::CodeGenContext &context) override;
     };
 
     struct BinaryOp : public Expression {
         BinaryOpType op;
-        Expression &lhs;
-        Expression &rhs;
+        Expression *lhs;
+        Expression *rhs;
+
+        BinaryOp(Expression *lhs_, BinaryOpType op_, Expression *rhs_);
+
+        virtual llvm::Value *CodeGen(codegen::CodeGenContext &context) override;
+    };
 
-        BinaryOp(Expression &lhs_, BinaryOpType op_, Expression &rhs_);
+    // Int[n] and Bool[n]: a new array of n zeros (False)
+    struct NewArray : public Expression {
+        Expression *length;
+
+        NewArray(DataType elementType, Expression *length_);
+
+        virtual llvm::Value *CodeGen(codegen::CodeGenContext &context) override;
+    };
+
+    // [x, y, ...], a new array of the values, at least one
+    struct ArrayLiteral : public Expression {
+        std::vector<Expression *> elements;
+
+        ArrayLiteral(std::vector<Expression *> elements_);
+
+        virtual llvm::Value *CodeGen(codegen::CodeGenContext &context) override;
+    };
+
+    // a[i], the program ends with an error if i is out of the bounds of a
+    struct Index : public Expression {
+        Expression *array;
+        Expression *index;
+
+        Index(Expression *array_, Expression *index_);
+
+        virtual llvm::Value *CodeGen(codegen::CodeGenContext &context) override;
+    };
+
+    // abs(x), min(x, y), max(x, y), pow(x, y) take Int, min(a), max(a), sum(a) an Int[] and len(a) any array;
+    // all of them return Int
+    struct Call : public Expression {
+        Builtin fn;
+        std::vector<Expression *> args;
+
+        Call(Builtin fn_, std::vector<Expression *> args_);
 
         virtual llvm::Value *CodeGen(codegen::CodeGenContext &context) override;
     };
@@ -170,37 +275,90 @@ namespace AST {
 
     struct VarDecl : Statement {
         Identifier *ident;
-        Expression &expr;
+        Expression *expr;
 
-        VarDecl(Identifier *ident_, Expression &expr_);
+        VarDecl(Identifier *ident_, Expression *expr_);
 
         virtual llvm::Value *CodeGen(codegen::CodeGenContext &context) override;
     };
 
     struct VarAssign : Statement {
         Identifier *ident;
-        Expression &expr;
+        Expression *expr;
 
-        VarAssign(Identifier *ident_, Expression &expr_);
+        VarAssign(Identifier *ident_, Expression *expr_);
+
+        virtual llvm::Value *CodeGen(codegen::CodeGenContext &context) override;
+    };
+
+    // a[i] = x;
+    struct IndexAssign : Statement {
+        Identifier *ident;
+        Expression *index;
+        Expression *expr;
+
+        IndexAssign(Identifier *ident_, Expression *index_, Expression *expr_);
+
+        virtual llvm::Value *CodeGen(codegen::CodeGenContext &context) override;
+    };
+
+    // fill(a, x); sets every element of a to x, copy(a, b); sets the elements of a to the ones of b,
+    // which must have the same length
+    struct ProcedureCall : Statement {
+        Procedure proc;
+        Expression *target;
+        Expression *value;
+
+        ProcedureCall(Procedure proc_, Expression *target_, Expression *value_);
 
         virtual llvm::Value *CodeGen(codegen::CodeGenContext &context) override;
     };
 
     struct WhileLoop : Statement {
-        Expression &expr;
-        CodeBlock code_block;
+        Expression *expr;
+        CodeBlock *code_block;
+        LoopHints hints;
+
+        WhileLoop(Expression *expr_, CodeBlock *code_block_);
+
+        // an Int variable compared with a bound, incremented by a constant by the last statement of the body
+        // and assigned nowhere else in it: codegen emits such loops in rotated form
+        bool isCounted() const;
+
+        virtual llvm::Value *CodeGen(codegen::CodeGenContext &context) override;
+    };
+
+    // reduce(+: s): every thread accumulates s of its iterations from the identity of the operator,
+    // the results are combined with the value s had before the loop
+    struct Reduction {
+        ReductionOp op;
+        Identifier *ident;
+    };
 
-        WhileLoop(Expression &expr_, CodeBlock code_block_);
+    // parallel for i in begin..end reduce(+: s, ...) { ... }: the iterations of [begin, end) run in any order and
+    // on many threads (codegen outlines the body, runtime/lolrt.h runs it). The body reads the variables declared
+    // outside of it, assigns only its own ones and the reduction variables, which it can use only as s = s + e,
+    // and doesn't print, so the loop gives the same result when run sequentially. i is max(begin, end) after it
+    struct ParallelFor : Statement {
+        Identifier *index;
+        Expression *begin;
+        Expression *end;
+        std::vector<Reduction> reductions;
+        CodeBlock *body;
+        std::vector<Identifier *> shared; // read by the body and declared outside of it, except index and reductions
+
+        ParallelFor(Identifier *index_, Expression *begin_, Expression *end_, std::vector<Reduction> reductions_,
+                    CodeBlock *body_);
 
         virtual llvm::Value *CodeGen(codegen::CodeGenContext &context) override;
     };
 
     struct IfStatement : Statement {
-        Expression &expr;
-        CodeBlock on_if;
-        std::optional<CodeBlock> on_else;
+        Expression *expr;
+        CodeBlock *on_if;
+        CodeBlock *on_else; // nullptr if there is no else branch
 
-        IfStatement(Expression &expr_, CodeBlock on_if_, std::optional<CodeBlock> on_else_);
+        IfStatement(Expression *expr_, CodeBlock *on_if_, CodeBlock *on_else_);
 
         virtual llvm::Value *CodeGen(codegen::CodeGenContext &context) override;
     };
@@ -209,7 +367,7 @@ namespace AST {
         Expression *e;
 
         PrintStatement(Expression *e_) : e(e_) {
-            std::cout << "PrintStatement done\n";
+            TRACE(Ast, Debug) << "PrintStatement done";
         }
 
         virtual llvm::Value *CodeGen(codegen::CodeGenContext &context) override;
@@ -0,0 +1,225 @@
+#include "options.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+#include <vector>
+#include <sstream>
+
+namespace {
+    bool StartsWith(const std::string &s, const std::string &prefix) {
+        return s.compare(0, prefix.size(), prefix) == 0;
+    }
+
+    unsigned ParseEmitKinds(const std::string &list) {
+        unsigned kinds = 0;
+        std::stringstream ss(list);
+        std::string kind;
+        while (std::getline(ss, kind, ',')) {
+            if (kind == "ll") {
+                kinds |= options::EmitLL;
+            } else if (kind == "bc") {
+                kinds |= options::EmitBC;
+            } else if (kind == "obj") {
+                kinds |= options::EmitObj;
+            } else if (kind == "exe") {
+                kinds |= options::EmitExe;
+            } else {
+                throw std::runtime_error("Unknown kind of output: " + kind + "\n" + options::Usage());
+            }
+        }
+        return kinds;
+    }
+
+    constexpr std::uint64_t kMaxThreads = 1024;
+
+    std::uint64_t ParsePositive(const std::string &value, const std::string &option) {
+        if (value.empty() || value.size() > 18 || value.find_first_not_of("0123456789") != std::string::npos ||
+            std::stoull(value) == 0) {
+            throw std::runtime_error(option + " expects a positive number\n" + options::Usage());
+        }
+        return std::stoull(value);
+    }
+}
+
+namespace options {
+    CompilerOptions ParseOptions(int argc, char *argv[]) {
+        CompilerOptions opts;
+        std::vector<std::string> positional;
+
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--exec" || arg == "--exec=jit") {
+                opts.exec = true;
+            } else if (arg == "--exec=vm") {
+                opts.exec = opts.vm = true;
+            } else if (StartsWith(arg, "--jit-threshold=")) {
+                std::string value = arg.substr(16);
+                if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos) {
+                    throw std::runtime_error("--jit-threshold expects a number\n" + Usage());
+                }
+                opts.jitThreshold = std::stoul(value);
+            } else if (ParseCodeGenOption(arg, opts)) {
+                continue;
+            } else if (arg == "--time-report" || arg == "--time-report=text") {
+                opts.timeReport = TimeReport::Text;
+            } else if (arg == "--time-report=json") {
+                opts.timeReport = TimeReport::Json;
+            } else if (StartsWith(arg, "--time-report-file=")) {
+                opts.timeReportFile = arg.substr(19);
+            } else if (StartsWith(arg, "--trace=")) {
+                opts.trace = arg.substr(8);
+            } else if (arg == "--dump-ir") {
+                opts.dumpIr = true;
+            } else if (arg == "--stream") {
+                opts.stream = true;
+            } else if (StartsWith(arg, "--split=")) {
+                std::uint64_t partitions = ParsePositive(arg.substr(8), "--split");
+                if (partitions > kMaxThreads) {
+                    throw std::runtime_error("--split expects at most " + std::to_string(kMaxThreads) + " partitions");
+                }
+                opts.split = unsigned(partitions);
+            } else if (StartsWith(arg, "--outline=")) {
+                std::uint64_t instructions = ParsePositive(arg.substr(10), "--outline");
+                opts.outline = unsigned(std::min<std::uint64_t>(instructions, UINT_MAX));
+            } else if (arg == "--profile") {
+                opts.profile = true;
+            } else if (StartsWith(arg, "--pgo-gen=")) {
+                opts.pgoGenerate = arg.substr(10);
+            } else if (StartsWith(arg, "--pgo-use=")) {
+                opts.pgoUse = arg.substr(10);
+            } else if (StartsWith(arg, "--emit=")) {
+                opts.emit = ParseEmitKinds(arg.substr(7));
+            } else if (arg == "--jobs" || StartsWith(arg, "--jobs=")) {
+                std::string value = arg == "--jobs" ? (i + 1 < argc ? argv[++i] : "") : arg.substr(7);
+                if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos ||
+                    std::stoul(value) == 0) {
+                    throw std::runtime_error("--jobs expects a positive number\n" + Usage());
+                }
+                opts.jobs = std::stoul(value);
+            } else if (StartsWith(arg, "--serve=")) {
+                opts.serve = arg.substr(8);
+            } else if (StartsWith(arg, "--connect=")) {
+                // the rest is the request, its options are parsed by the server
+                opts.connect = arg.substr(10);
+                opts.request.assign(argv + i + 1, argv + argc);
+                break;
+            } else if (!arg.empty() && arg[0] == '-') {
+                throw std::runtime_error("Unknown option " + arg + "\n" + Usage());
+            } else {
+                positional.push_back(arg);
+            }
+        }
+
+        if (!opts.timeReportFile.empty() && opts.timeReport == TimeReport::None) {
+            opts.timeReport = TimeReport::Text;
+        }
+
+        if (!opts.pgoGenerate.empty() || !opts.pgoUse.empty()) {
+            if (!opts.pgoGenerate.empty() && !opts.pgoUse.empty()) {
+                throw std::runtime_error("--pgo-gen and --pgo-use can't be used together");
+            }
+            if (opts.jobs || opts.vm) {
+                throw std::runtime_error("A profile belongs to one program compiled by LLVM, "
+                                         "it can't be used with --jobs or --exec=vm");
+            }
+        }
+
+        if (opts.profile) {
+            if (opts.jobs || opts.vm) {
+                throw std::runtime_error("--profile can't be used with --jobs or --exec=vm");
+            }
+            opts.exec = opts.exec || !(opts.emit & EmitExe);
+        }
+
+        if (opts.stream && (opts.vm || opts.peval || opts.flatAst)) {
+            throw std::runtime_error("--stream can't be used with --exec=vm, --peval or --flat-ast, "
+                                     "which need the whole program");
+        }
+
+        if (!opts.serve.empty()) {
+            if (!positional.empty() || opts.jobs || opts.exec || !opts.connect.empty()) {
+                throw std::runtime_error("--serve takes no inputs\n" + Usage());
+            }
+            return opts;
+        }
+        if (!opts.connect.empty()) {
+            if (!positional.empty() || opts.request.empty() ||
+                (opts.request[0] != "shutdown" && opts.request.size() < 2)) {
+                throw std::runtime_error(Usage());
+            }
+            return opts;
+        }
+
+        if (opts.jobs) {
+            if (positional.empty()) {
+                throw std::runtime_error(Usage());
+            }
+            if (opts.exec) {
+                throw std::runtime_error("--exec can't be used together with --jobs");
+            }
+            opts.inputs = std::move(positional);
+            return opts;
+        }
+
+        if (opts.vm && positional.size() == 1) {
+            opts.input = positional[0];
+            return opts;
+        }
+        if (positional.size() != 2) {
+            throw std::runtime_error(Usage());
+        }
+        opts.input = positional[0];
+        opts.output = positional[1];
+        return opts;
+    }
+
+    bool ParseCodeGenOption(const std::string &arg, CompilerOptions &opts) {
+        if (arg == "--flat-ast") {
+            opts.flatAst = true;
+        } else if (arg == "--no-fold") {
+            opts.fold = false;
+        } else if (arg == "--peval") {
+            opts.peval = true;
+        } else if (StartsWith(arg, "--peval=")) {
+            opts.peval = true;
+            opts.pevalFuel = ParsePositive(arg.substr(8), "--peval");
+        } else if (StartsWith(arg, "--peval-memory=")) {
+            opts.peval = true;
+            opts.pevalMemory = ParsePositive(arg.substr(15), "--peval-memory");
+        } else if (StartsWith(arg, "--threads=")) {
+            std::uint64_t threads = ParsePositive(arg.substr(10), "--threads");
+            if (threads > kMaxThreads) {
+                throw std::runtime_error("--threads expects at most " + std::to_string(kMaxThreads) + " threads");
+            }
+            opts.threads = unsigned(threads);
+        } else if (StartsWith(arg, "--grain=")) {
+            opts.grain = ParsePositive(arg.substr(8), "--grain");
+        } else if (arg.size() == 3 && arg[0] == '-' && arg[1] == 'O' && arg[2] >= '0' && arg[2] <= '3') {
+            opts.optLevel = arg[2] - '0';
+        } else if (StartsWith(arg, "--mcpu=")) {
+            opts.cpu = arg.substr(7);
+        } else if (StartsWith(arg, "--mattr=")) {
+            opts.features = arg.substr(8);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    std::string Usage() {
+        return "Usage: lol-compiler <source.lang> <output> [--exec[=jit]] [-O0|-O1|-O2|-O3]\n"
+               "                    [--emit=ll,bc,obj,exe] [--mcpu=<cpu>] [--mattr=<features>]\n"
+               "                    [--flat-ast] [--no-fold] [--peval[=<steps>]] [--peval-memory=<bytes>]\n"
+               "                    [--threads=<N>] [--grain=<N>]\n"
+               "                    [--time-report[=text|json]] [--time-report-file=<file>]\n"
+               "                    [--trace=<category>[=<level>],...] [--dump-ir]\n"
+               "                    [--pgo-gen=<profile> | --pgo-use=<profile>] [--profile] [--stream]\n"
+               "                    [--split=<N>] [--outline=<instructions>]\n"
+               "       lol-compiler <source.lang> --exec=vm [--jit-threshold=<N>] [options]\n"
+               "       lol-compiler --jobs <N> [options] <a.lang> <b.lang> ...\n"
+               "       lol-compiler --serve=<socket> [--trace=...]\n"
+               "       lol-compiler --connect=<socket> check|compile|run [-O<level>] [options] <source.lang>\n"
+               "       lol-compiler --connect=<socket> shutdown";
+    }
+}
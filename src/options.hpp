@@ -0,0 +1,88 @@
+/*
+    Command line options of lol-compiler
+
+    Usage: lol-compiler <source.lang> <output> [--exec[=jit]] [-O<level>]
+                        [--emit=ll,bc,obj,exe] [--mcpu=<cpu>] [--mattr=<features>] [--flat-ast] [--no-fold]
+                        [--peval[=<steps>]] [--peval-memory=<bytes>] [--threads=<N>] [--grain=<N>]
+                        [--time-report[=text|json]] [--time-report-file=<file>]
+                        [--trace=<category>[=<level>],...] [--dump-ir]
+                        [--pgo-gen=<profile> | --pgo-use=<profile>] [--profile] [--stream]
+                        [--split=<N>] [--outline=<instructions>]
+           lol-compiler <source.lang> --exec=vm [--jit-threshold=<N>] [options]
+           lol-compiler --jobs <N> [options] <a.lang> <b.lang> ...
+           lol-compiler --serve=<socket> [--trace=...]
+           lol-compiler --connect=<socket> check|compile|run [-O<level>] [options] <source.lang>
+           lol-compiler --connect=<socket> shutdown
+*/
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace options {
+    // kinds of files written next to <output>, may be combined
+    enum EmitKind : unsigned {
+        EmitLL = 1 << 0,  // <output>.ll, textual IR
+        EmitBC = 1 << 1,  // <output>.bc, bitcode
+        EmitObj = 1 << 2, // <output>.o, native object file
+        EmitExe = 1 << 3, // <output>, linked executable
+    };
+
+    enum class TimeReport {
+        None,
+        Text,
+        Json, // one object per line
+    };
+
+    struct CompilerOptions {
+        std::string input;
+        std::string output; // compiler automatically adds a suffix depending on the emitted kind
+
+        // batch mode: every input is compiled to its own name without the .lang suffix
+        unsigned jobs = 0; // 0 means a single input/output pair
+        std::vector<std::string> inputs;
+        bool exec = false;
+        bool vm = false; // --exec=vm: run on the bytecode interpreter (vm.hpp), no LLVM codegen, nothing is written
+        unsigned jitThreshold = 1000; // iterations after which the VM compiles a loop natively, 0 never does
+        unsigned optLevel = 0; // 0..3, same meaning as in clang
+        unsigned emit = EmitLL;
+        std::string cpu; // empty means the host cpu
+        std::string features; // llc-style "+avx2,-sse4a", empty means the host features
+        bool flatAst = false; // codegen walks the flat layout of the AST (flat_ast.hpp)
+        bool fold = true; // constant folding and dead branch removal before codegen (fold.hpp)
+        bool peval = false; // the program is run at compile time and replaced by its residual (peval.hpp)
+        std::uint64_t pevalFuel = 1000000; // steps of the partial evaluation
+        std::uint64_t pevalMemory = 1 << 20; // bytes of strings and arrays it may create
+        unsigned threads = 0; // of a parallel for, 0 means one per CPU
+        std::uint64_t grain = 0; // iterations of a parallel for per chunk, 0 means about 8 chunks per thread
+        TimeReport timeReport = TimeReport::None; // per-phase time, memory and counters (timing.hpp)
+        std::string timeReportFile; // the report is appended to it, empty means stderr
+        std::string trace; // levels of the trace categories, see trace::Configure
+        bool dumpIr = false; // print the generated IR to stdout before optimization
+        std::string pgoGenerate; // the program counts its branches and writes the profile here (pgo.hpp)
+        std::string pgoUse; // branch weights from this profile
+        bool profile = false; // per-line hits and time printed to stderr when the program ends, implies --exec
+                              // unless an executable is emitted
+        unsigned split = 0; // objects and executables are compiled in this many partitions on as many threads,
+                            // 0 and 1 keep the module whole (CodeGenContext::saveSplit)
+        unsigned outline = 1000; // with --split, the top-level regions of main of at least this many instructions
+                                 // are outlined into functions of their own (CodeGenContext::outlineRegions)
+        bool stream = false; // every statement of main is generated as soon as it is parsed and its nodes are
+                             // freed, so the tree is never whole (ParsingContext::onStatement); the IR of main
+                             // still is
+
+        std::string serve; // run as a compile server listening on this Unix socket (server.hpp)
+        std::string connect; // send request to the compile server on this socket and print the answer
+        std::vector<std::string> request; // command, options and source file, as given after --connect
+    };
+
+    CompilerOptions ParseOptions(int argc, char *argv[]);
+
+    // -O<level>, --mcpu, --mattr, --flat-ast, --no-fold, --peval*, --threads and --grain, which also come in the
+    // requests to the compile server;
+    // returns false if arg is none of them
+    bool ParseCodeGenOption(const std::string &arg, CompilerOptions &opts);
+
+    std::string Usage();
+}
@@ -1,43 +1,145 @@
 #pragma once
 
 #include "decl.hpp"
+#include "arena.hpp"
+#include "trace.hpp"
 
+#include <cstring>
+#include <functional>
 #include <unordered_map>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <utility>
 #include <stack>
+#include <cassert>
+#include <stdexcept>
 
 namespace parsingcontext {
+    // text of an identifier or string literal token; points into the source buffer or the arena and stays valid
+    // until the end of parsing. A POD, so that it can live in the %union of the parser
+    struct Span {
+        const char *data;
+        std::size_t size;
+
+        std::string_view view() const {
+            return {data, size};
+        }
+
+        std::string str() const {
+            return {data, size};
+        }
+    };
+
+    // an identifier as the scanner returns it, text is the interned copy
+    struct Name {
+        Span text;
+        AST::Symbol symbol;
+    };
+
+    // the names of a file, numbered in the order they first occur. The scanner interns every identifier, so the
+    // parser resolves a name by indexing a vector with its number instead of hashing the string at every use
+    class SymbolTable {
+    public:
+        explicit SymbolTable(AST::Arena &arena_) : arena(arena_) {}
+
+        AST::Symbol intern(std::string_view text) {
+            auto iter = numbers.find(text);
+            if (iter != numbers.end()) {
+                return iter->second;
+            }
+            // the text of a token may live in a buffer of the scanner
+            char *copy = static_cast<char *>(arena.allocate(text.size(), 1));
+            std::memcpy(copy, text.data(), text.size());
+            auto symbol = AST::Symbol(names.size());
+            names.emplace_back(copy, text.size());
+            numbers.emplace(names.back(), symbol);
+            return symbol;
+        }
+
+        std::string_view name(AST::Symbol symbol) const {
+            return names[symbol];
+        }
+
+        std::size_t size() const {
+            return names.size();
+        }
+
+    private:
+        AST::Arena &arena;
+        std::unordered_map<std::string_view, AST::Symbol> numbers;
+        std::vector<std::string_view> names;
+    };
+
+    // all the state of parsing one file, so several files can be parsed in parallel
     struct ParsingContext {
-        std::unordered_map<std::string, AST::Identifier *> variables;
+        AST::Arena arena; // owns all the nodes of the file
+        AST::Arena globals; // the names and the variables of main, which outlive the statements of main
+        SymbolTable symbols{globals};
+
+        // streaming (--stream): every statement of main is passed here as soon as it is reduced instead of being
+        // kept in the tree, so main ends up empty. Its nodes are released once the next statement of main has been
+        // passed (the scanner may have read the first token of that one into the arena), so the memory of the
+        // tree is bounded by the nesting of the statements rather than by the length of the file
+        std::function<void(AST::Statement *)> onStatement;
+        AST::Arena previous; // the nodes of the last statement passed to onStatement
+
+        // lexical scopes: the variable every symbol names in the blocks open at the moment (nullptr for none),
+        // and the symbols declared by the open blocks, innermost last, which are hidden again when it ends
+        std::vector<AST::Identifier *> visible;
+        std::vector<AST::Symbol> declared;
+        std::vector<std::size_t> scopeStart; // where every open block starts in declared
+        std::uint32_t slots = 0; // declarations so far, Identifier::slot of the next one
+        std::vector<std::uint32_t> slotStart; // slots when every open block started, reused after it when streaming
+
         std::stack<AST::StatementList> StackOfCodeBlocks;
 
+        std::stack<AST::Statement *> StackOfStatements; // statements of all currently open code blocks
+        std::stack<std::size_t> CodeBlockStart; // where each open code block starts in StackOfStatements
+
+        AST::CodeBlock *program = nullptr; // body of main, set when parsing is done
+        std::size_t tokens = 0; // returned by the scanner so far
+
 
         ParsingContext() : StackOfCodeBlocks({AST::StatementList{}}) {
             assert(StackOfCodeBlocks.size() == 1);
         }
 
-        AST::Identifier *loadIdent(const std::string &name) {
-            auto resp = variables.find(name);
-            if (resp == variables.end()) {
-                return nullptr;
-            }
-            return resp->second;
+        AST::Identifier *loadIdent(AST::Symbol symbol) const {
+            return symbol < visible.size() ? visible[symbol] : nullptr;
         }
 
-        void storeIdent(std::string name, AST::Identifier *ident) {
-            if (!ident) {
-                throw std::runtime_error("[Internal error] Trying to store a nullptr-Ident!");
-            }
+        // declares ident->symbol in the innermost open block and gives ident its slot; a name can't be declared
+        // again while it is visible, in the same block or a nested one (line is that of the declaration)
+        void storeIdent(AST::Identifier *ident, int line);
 
-            if (auto iter = variables.find(name); iter != variables.end()) {
-                throw std::runtime_error("[Internal error] Trying to store an already storead value!");
+        void openScope() {
+            scopeStart.push_back(declared.size());
+            slotStart.push_back(slots);
+        }
+
+        void closeScope() {
+            assert(!scopeStart.empty());
+            while (declared.size() != scopeStart.back()) {
+                visible[declared.back()] = nullptr;
+                declared.pop_back();
             }
-            std::cout << "Before access" << std::endl;
-            variables[name] = ident;
+            scopeStart.pop_back();
+            if (onStatement) {
+                // nothing refers to the variables of a block once its statement of main has been generated
+                slots = slotStart.back();
+            }
+            slotStart.pop_back();
+        }
+
+        // the arena of the Identifier of a declaration in the innermost open block
+        AST::Arena &declarationArena() {
+            return CodeBlockStart.size() == 1 ? globals : arena;
         }
 
+        // adds st to the innermost open block, or passes it to onStatement if that is main
+        void pushStatement(AST::Statement *st);
+
         AST::StatementList GetBlockAndClear() {
             auto resp = std::move(StackOfCodeBlocks.top());
             StackOfCodeBlocks.pop();
@@ -49,4 +151,10 @@ namespace parsingcontext {
         }
 
     };
-}
\ No newline at end of file
+
+    // parses fname with a reentrant scanner and returns the body of main
+    AST::CodeBlock *ParseFile(const std::string &fname, ParsingContext &ctx);
+
+    // the same for a program held in memory (the requests of the compile server)
+    AST::CodeBlock *ParseSource(const std::string &source, ParsingContext &ctx);
+}
@@ -0,0 +1,522 @@
+#include "peval.hpp"
+#include "fold.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace AST {
+    namespace {
+        struct Array {
+            DataType type;
+            std::vector<std::int32_t> elements; // 0 and 1 in a Bool[]
+        };
+
+        // Int and Bool (0 or 1) are in i, a String in s; an array is shared by all the variables it was assigned to,
+        // as in the generated code
+        struct Value {
+            DataType type = DataType::None;
+            std::int32_t i = 0;
+            std::string s;
+            std::shared_ptr<Array> a;
+        };
+
+        Value MakeInt(std::int32_t i) {
+            Value v;
+            v.type = DataType::Int;
+            v.i = i;
+            return v;
+        }
+
+        Value MakeBool(bool b) {
+            Value v;
+            v.type = DataType::Bool;
+            v.i = b;
+            return v;
+        }
+
+        // thrown when the budget is spent or the program would end with an error
+        struct Stop {
+            std::string reason;
+        };
+
+        // thrown at the checkpoint the evaluation was asked to stop at
+        struct Reached {
+        };
+
+        // a point where the rest of the program is the top-level statements from statement on
+        struct Checkpoint {
+            std::uint64_t number = 0;
+            std::size_t statement = 0;
+        };
+
+        struct Print {
+            Value value;
+            int line;
+        };
+
+        class Interpreter {
+        public:
+            static constexpr std::uint64_t kNever = std::numeric_limits<std::uint64_t>::max();
+
+            Interpreter(const EvalBudget &budget_, std::uint64_t stopAt_) : budget(budget_), stopAt(stopAt_) {}
+
+            // throws Stop, or Reached at the checkpoint number stopAt
+            void run(const StatementList &statements) {
+                for (std::size_t i = 0; i < statements.size(); ++i) {
+                    if (auto *loop = dynamic_cast<WhileLoop *>(statements[i])) {
+                        // every iteration of a top-level loop starts at a checkpoint
+                        while (true) {
+                            checkpoint(i);
+                            step();
+                            if (!expression(loop->expr).i) {
+                                break;
+                            }
+                            block(*loop->code_block);
+                        }
+                    } else {
+                        checkpoint(i);
+                        statement(statements[i]);
+                    }
+                }
+            }
+
+            std::uint64_t steps = 0;
+            std::size_t bytes = 0;
+            Checkpoint last; // the last one passed
+
+            std::unordered_map<std::uint32_t, Value> variables; // by Identifier::slot
+            std::vector<Identifier *> declared; // in the order of the first assignment
+            std::vector<Print> prints;
+
+        private:
+            const EvalBudget &budget;
+            std::uint64_t stopAt;
+            std::uint64_t passed = 0;
+
+            void checkpoint(std::size_t statement) {
+                if (passed == stopAt) {
+                    throw Reached{};
+                }
+                last = {passed++, statement};
+            }
+
+            void step(std::uint64_t count = 1) {
+                steps += count;
+                if (steps > budget.fuel) {
+                    throw Stop{"out of fuel"};
+                }
+            }
+
+            void allocate(std::size_t size) {
+                bytes += size;
+                if (bytes > budget.memory) {
+                    throw Stop{"out of memory"};
+                }
+            }
+
+            void block(const CodeBlock &block) {
+                for (Statement *st: block.statements) {
+                    statement(st);
+                }
+            }
+
+            void statement(Statement *st) {
+                step();
+                if (auto *decl = dynamic_cast<VarDecl *>(st)) {
+                    assign(decl->ident, expression(decl->expr));
+                } else if (auto *assignment = dynamic_cast<VarAssign *>(st)) {
+                    assign(assignment->ident, expression(assignment->expr));
+                } else if (auto *assignment = dynamic_cast<IndexAssign *>(st)) {
+                    Value array = variable(assignment->ident);
+                    std::int32_t index = expression(assignment->index).i;
+                    element(*array.a, index) = expression(assignment->expr).i;
+                } else if (auto *call = dynamic_cast<ProcedureCall *>(st)) {
+                    procedure(call->proc, expression(call->target), expression(call->value));
+                } else if (auto *loop = dynamic_cast<WhileLoop *>(st)) {
+                    while (expression(loop->expr).i) {
+                        block(*loop->code_block);
+                        step();
+                    }
+                } else if (auto *loop = dynamic_cast<ParallelFor *>(st)) {
+                    // in order, like the VM
+                    std::int32_t begin = expression(loop->begin).i;
+                    std::int32_t end = expression(loop->end).i;
+                    for (std::int32_t i = begin; i < end; ++i) {
+                        assign(loop->index, MakeInt(i));
+                        block(*loop->body);
+                        step();
+                    }
+                    assign(loop->index, MakeInt(std::max(begin, end)));
+                } else if (auto *ifSt = dynamic_cast<IfStatement *>(st)) {
+                    if (expression(ifSt->expr).i) {
+                        block(*ifSt->on_if);
+                    } else if (ifSt->on_else) {
+                        block(*ifSt->on_else);
+                    }
+                } else if (auto *print = dynamic_cast<PrintStatement *>(st)) {
+                    Value value = expression(print->e);
+                    if (value.a) {
+                        step(value.a->elements.size());
+                        value.a = std::make_shared<Array>(*value.a); // later changes of the array aren't printed
+                    }
+                    prints.push_back({std::move(value), print->line});
+                } else if (!dynamic_cast<Skip *>(st)) {
+                    llvm_unreachable("PartiallyEvaluate: unknown statement!");
+                }
+            }
+
+            void assign(Identifier *ident, Value value) {
+                auto [it, inserted] = variables.insert_or_assign(ident->slot, std::move(value));
+                if (inserted) {
+                    declared.push_back(ident);
+                }
+            }
+
+            const Value &variable(const Identifier *ident) {
+                auto it = variables.find(ident->slot);
+                if (it == variables.end()) {
+                    throw Stop{"read of " + ident->name + " before it is assigned"};
+                }
+                return it->second;
+            }
+
+            std::int32_t &element(Array &array, std::int32_t index) {
+                if (index < 0 || std::size_t(index) >= array.elements.size()) {
+                    throw Stop{"index out of bounds"};
+                }
+                return array.elements[index];
+            }
+
+            Value newArray(DataType elementType, std::size_t length) {
+                allocate(length * (elementType == DataType::Int ? sizeof(std::int32_t) : 1));
+                step(length);
+                Value v;
+                v.type = details::ArrayOf(elementType);
+                v.a = std::make_shared<Array>(Array{v.type, std::vector<std::int32_t>(length)});
+                return v;
+            }
+
+            Value expression(Expression *e) {
+                step();
+                if (auto *c = dynamic_cast<ConstantInt *>(e)) {
+                    return MakeInt(c->val);
+                }
+                if (auto *c = dynamic_cast<ConstantBool *>(e)) {
+                    return MakeBool(c->val);
+                }
+                if (auto *c = dynamic_cast<ConstantString *>(e)) {
+                    Value v;
+                    v.type = DataType::String;
+                    v.s = c->val;
+                    return v;
+                }
+                if (auto *ident = dynamic_cast<Identifier *>(e)) {
+                    return variable(ident);
+                }
+                if (auto *op = dynamic_cast<UnaryOp *>(e)) {
+                    Value v = expression(op->expr);
+                    return op->op == UnaryOpType::Minus ? MakeInt(std::int32_t(0u - std::uint32_t(v.i))) : MakeBool(!v.i);
+                }
+                if (auto *op = dynamic_cast<BinaryOp *>(e)) {
+                    return binary(op);
+                }
+                if (auto *array = dynamic_cast<NewArray *>(e)) {
+                    std::int32_t length = expression(array->length).i;
+                    if (length < 0) {
+                        throw Stop{"negative length of an array"};
+                    }
+                    return newArray(details::ElementType(array->type), length);
+                }
+                if (auto *literal = dynamic_cast<ArrayLiteral *>(e)) {
+                    Value v = newArray(details::ElementType(literal->type), literal->elements.size());
+                    for (std::size_t i = 0; i < literal->elements.size(); ++i) {
+                        v.a->elements[i] = expression(literal->elements[i]).i;
+                    }
+                    return v;
+                }
+                if (auto *index = dynamic_cast<Index *>(e)) {
+                    Value array = expression(index->array);
+                    std::int32_t i = expression(index->index).i;
+                    return index->type == DataType::Int ? MakeInt(element(*array.a, i)) : MakeBool(element(*array.a, i));
+                }
+                if (auto *call = dynamic_cast<Call *>(e)) {
+                    return builtin(call);
+                }
+                llvm_unreachable("PartiallyEvaluate: unknown expression!");
+            }
+
+            Value binary(BinaryOp *op) {
+                // the generated code evaluates both operands of && and || too
+                Value lhs = expression(op->lhs);
+                Value rhs = expression(op->rhs);
+                if (op->type == DataType::IntArray) {
+                    return elementwise(op->op, lhs, rhs);
+                }
+                switch (op->op) {
+                    case BinaryOpType::Sum:
+                        if (lhs.type == DataType::String) {
+                            allocate(lhs.s.size() + rhs.s.size());
+                            lhs.s += rhs.s;
+                            return lhs;
+                        }
+                        [[fallthrough]];
+                    case BinaryOpType::Sub:
+                    case BinaryOpType::Mult:
+                    case BinaryOpType::Div:
+                    case BinaryOpType::Pow:
+                        if (auto v = eval::IntOp(op->op, lhs.i, rhs.i)) {
+                            return MakeInt(*v);
+                        }
+                        throw Stop{"division by zero or overflow"};
+                    case BinaryOpType::Eq:
+                    case BinaryOpType::Neq:
+                        if (lhs.type == DataType::String) {
+                            return MakeBool((lhs.s == rhs.s) == (op->op == BinaryOpType::Eq));
+                        }
+                        [[fallthrough]];
+                    case BinaryOpType::Leq:
+                    case BinaryOpType::Les:
+                    case BinaryOpType::Geq:
+                    case BinaryOpType::Gre:
+                        return MakeBool(eval::Compare(op->op, lhs.i, rhs.i));
+                    case BinaryOpType::And:
+                        return MakeBool(lhs.i && rhs.i);
+                    case BinaryOpType::Or:
+                        return MakeBool(lhs.i || rhs.i);
+                }
+                llvm_unreachable("PartiallyEvaluate: unknown binary operator!");
+            }
+
+            // Int[] with Int[] of the same length, or with Int on either side
+            Value elementwise(BinaryOpType op, const Value &lhs, const Value &rhs) {
+                std::size_t length = (lhs.a ? lhs.a : rhs.a)->elements.size();
+                if (lhs.a && rhs.a && rhs.a->elements.size() != length) {
+                    throw Stop{"arrays of different lengths"};
+                }
+                Value result = newArray(DataType::Int, length);
+                for (std::size_t i = 0; i < length; ++i) {
+                    std::int32_t l = lhs.a ? lhs.a->elements[i] : lhs.i;
+                    std::int32_t r = rhs.a ? rhs.a->elements[i] : rhs.i;
+                    result.a->elements[i] = *eval::IntOp(op, l, r);
+                }
+                return result;
+            }
+
+            Value builtin(Call *call) {
+                std::vector<Value> args;
+                for (Expression *arg: call->args) {
+                    args.push_back(expression(arg));
+                }
+                if (!args[0].a) {
+                    std::int32_t values[2] = {args[0].i, args.size() > 1 ? args[1].i : 0};
+                    return MakeInt(eval::CallBuiltin(call->fn, values));
+                }
+                const std::vector<std::int32_t> &elements = args[0].a->elements;
+                step(elements.size());
+                switch (call->fn) {
+                    case Builtin::Len:
+                        return MakeInt(std::int32_t(elements.size()));
+                    case Builtin::Sum: {
+                        std::uint32_t sum = 0; // wraps around as the Int additions do
+                        for (std::int32_t x: elements) {
+                            sum += std::uint32_t(x);
+                        }
+                        return MakeInt(std::int32_t(sum));
+                    }
+                    case Builtin::Min:
+                        return MakeInt(std::accumulate(elements.begin(), elements.end(),
+                                                       std::numeric_limits<std::int32_t>::max(),
+                                                       [](std::int32_t a, std::int32_t b) { return std::min(a, b); }));
+                    case Builtin::Max:
+                        return MakeInt(std::accumulate(elements.begin(), elements.end(),
+                                                       std::numeric_limits<std::int32_t>::min(),
+                                                       [](std::int32_t a, std::int32_t b) { return std::max(a, b); }));
+                    default:
+                        llvm_unreachable("PartiallyEvaluate: not a builtin of an array!");
+                }
+            }
+
+            void procedure(Procedure proc, const Value &target, const Value &value) {
+                std::vector<std::int32_t> &elements = target.a->elements;
+                step(elements.size());
+                switch (proc) {
+                    case Procedure::Fill:
+                        std::fill(elements.begin(), elements.end(), value.i);
+                        return;
+                    case Procedure::Copy:
+                        if (value.a->elements.size() != elements.size()) {
+                            throw Stop{"arrays of different lengths"};
+                        }
+                        elements = value.a->elements;
+                        return;
+                }
+            }
+        };
+
+        // a new expression of the value, Int[n] (Bool[n]) for arrays of zeros
+        Expression *Residual(const Value &v, Arena &arena) {
+            switch (v.type) {
+                case DataType::Int:
+                    return arena.make<ConstantInt>(v.i);
+                case DataType::Bool:
+                    return arena.make<ConstantBool>(v.i != 0);
+                case DataType::String:
+                    return arena.make<ConstantString>(v.s);
+                case DataType::IntArray:
+                case DataType::BoolArray: {
+                    const std::vector<std::int32_t> &values = v.a->elements;
+                    DataType elementType = details::ElementType(v.type);
+                    if (std::all_of(values.begin(), values.end(), [](std::int32_t x) { return x == 0; })) {
+                        return arena.make<NewArray>(elementType, arena.make<ConstantInt>(std::int32_t(values.size())));
+                    }
+                    std::vector<Expression *> elements;
+                    elements.reserve(values.size());
+                    for (std::int32_t x: values) {
+                        elements.push_back(Residual(elementType == DataType::Int ? MakeInt(x) : MakeBool(x), arena));
+                    }
+                    return arena.make<ArrayLiteral>(std::move(elements));
+                }
+                case DataType::None:
+                    break;
+            }
+            llvm_unreachable("PartiallyEvaluate: a value without a type!");
+        }
+
+        void CollectSlots(const Expression *e, std::unordered_set<std::uint32_t> &slots) {
+            if (auto *ident = dynamic_cast<const Identifier *>(e)) {
+                slots.insert(ident->slot);
+            } else if (auto *op = dynamic_cast<const UnaryOp *>(e)) {
+                CollectSlots(op->expr, slots);
+            } else if (auto *op = dynamic_cast<const BinaryOp *>(e)) {
+                CollectSlots(op->lhs, slots);
+                CollectSlots(op->rhs, slots);
+            } else if (auto *array = dynamic_cast<const NewArray *>(e)) {
+                CollectSlots(array->length, slots);
+            } else if (auto *literal = dynamic_cast<const ArrayLiteral *>(e)) {
+                for (const Expression *element: literal->elements) {
+                    CollectSlots(element, slots);
+                }
+            } else if (auto *index = dynamic_cast<const Index *>(e)) {
+                CollectSlots(index->array, slots);
+                CollectSlots(index->index, slots);
+            } else if (auto *call = dynamic_cast<const Call *>(e)) {
+                for (const Expression *arg: call->args) {
+                    CollectSlots(arg, slots);
+                }
+            }
+        }
+
+        // slots of the variables st reads or writes
+        void CollectSlots(const Statement *st, std::unordered_set<std::uint32_t> &slots) {
+            auto collectBlock = [&](const CodeBlock *block) {
+                for (const Statement *inner: block->statements) {
+                    CollectSlots(inner, slots);
+                }
+            };
+            if (auto *decl = dynamic_cast<const VarDecl *>(st)) {
+                slots.insert(decl->ident->slot);
+                CollectSlots(decl->expr, slots);
+            } else if (auto *assignment = dynamic_cast<const VarAssign *>(st)) {
+                slots.insert(assignment->ident->slot);
+                CollectSlots(assignment->expr, slots);
+            } else if (auto *assignment = dynamic_cast<const IndexAssign *>(st)) {
+                slots.insert(assignment->ident->slot);
+                CollectSlots(assignment->index, slots);
+                CollectSlots(assignment->expr, slots);
+            } else if (auto *call = dynamic_cast<const ProcedureCall *>(st)) {
+                CollectSlots(call->target, slots);
+                CollectSlots(call->value, slots);
+            } else if (auto *loop = dynamic_cast<const WhileLoop *>(st)) {
+                CollectSlots(loop->expr, slots);
+                collectBlock(loop->code_block);
+            } else if (auto *loop = dynamic_cast<const ParallelFor *>(st)) {
+                slots.insert(loop->index->slot);
+                CollectSlots(loop->begin, slots);
+                CollectSlots(loop->end, slots);
+                for (const Reduction &reduction: loop->reductions) {
+                    slots.insert(reduction.ident->slot);
+                }
+                collectBlock(loop->body);
+            } else if (auto *ifSt = dynamic_cast<const IfStatement *>(st)) {
+                CollectSlots(ifSt->expr, slots);
+                collectBlock(ifSt->on_if);
+                if (ifSt->on_else) {
+                    collectBlock(ifSt->on_else);
+                }
+            } else if (auto *print = dynamic_cast<const PrintStatement *>(st)) {
+                CollectSlots(print->e, slots);
+            }
+        }
+    }
+
+    PartialEvalReport PartiallyEvaluate(CodeBlock &root, Arena &arena, const EvalBudget &budget) {
+        PartialEvalReport report;
+        const StatementList &statements = root.statements;
+
+        // the state at the last checkpoint is not kept while the budget lasts: when it runs out,
+        // the program is run again up to that checkpoint, which takes no more than the same budget
+        Interpreter first(budget, Interpreter::kNever);
+        try {
+            first.run(statements);
+            report.complete = true;
+        } catch (Stop &stop) {
+            report.reason = std::move(stop.reason);
+        }
+        report.steps = first.steps;
+        report.bytes = first.bytes;
+
+        Interpreter second(budget, first.last.number);
+        Interpreter *state = &first;
+        std::size_t rest = statements.size();
+        if (!report.complete) {
+            try {
+                second.run(statements);
+            } catch (Reached &) {
+            }
+            state = &second;
+            rest = first.last.statement;
+        }
+
+        StatementList residual;
+        for (const Print &print: state->prints) {
+            auto *st = arena.make<PrintStatement>(Residual(print.value, arena));
+            st->line = print.line;
+            residual.push_back(st);
+        }
+        report.prints = unsigned(residual.size());
+
+        if (rest < statements.size()) {
+            std::unordered_set<std::uint32_t> used;
+            for (std::size_t i = rest; i < statements.size(); ++i) {
+                CollectSlots(statements[i], used);
+            }
+            // the variables sharing an array get it from the first of them
+            std::unordered_map<const Array *, Identifier *> arrays;
+            for (Identifier *ident: state->declared) {
+                if (!used.count(ident->slot)) {
+                    continue;
+                }
+                const Value &value = state->variables.at(ident->slot);
+                Expression *init = nullptr;
+                if (value.a) {
+                    auto [it, inserted] = arrays.emplace(value.a.get(), ident);
+                    init = inserted ? Residual(value, arena) : it->second;
+                } else {
+                    init = Residual(value, arena);
+                }
+                residual.push_back(arena.make<VarDecl>(ident, init));
+            }
+            report.line = statements[rest]->line;
+            report.statementsLeft = unsigned(statements.size() - rest);
+            residual.insert(residual.end(), statements.begin() + rest, statements.end());
+        }
+        root.statements = std::move(residual);
+        return report;
+    }
+}
@@ -0,0 +1,41 @@
+/*
+    Partial evaluation of closed programs
+
+    L programs take no input, so a program can be run by the compiler itself. The statements of main are
+    executed on the AST within a budget of steps (fuel) and of bytes of strings and arrays; the program is then
+    replaced by its residual: the prints it made, as prints of constants, followed by the part that was not
+    evaluated, started from the last point where the rest of the program is whole top-level statements (before
+    a top-level statement or at the head of a top-level while), with the variables it uses declared with
+    their values at that point. A program that runs to completion within the budget is reduced to its prints.
+
+    Evaluation also stops in front of anything that ends the program with an error at run time (an index out of
+    bounds, a division by zero, ...), which is left to the residual so that the error happens as before.
+*/
+#pragma once
+
+#include "node.hpp"
+#include "arena.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace AST {
+    struct EvalBudget {
+        std::uint64_t fuel = 1000000; // statements and expression nodes, every element of a whole-array operation
+        std::size_t memory = 1 << 20; // bytes of the strings and arrays created
+    };
+
+    struct PartialEvalReport {
+        bool complete = false; // the whole program was evaluated
+        std::uint64_t steps = 0;
+        std::size_t bytes = 0;
+        unsigned prints = 0; // residual prints of constants
+        unsigned statementsLeft = 0; // top-level statements of the original program in the residual
+        int line = 0; // where the residual starts when the program isn't complete
+        std::string reason; // why the evaluation stopped
+    };
+
+    // new nodes are allocated in arena, root is changed in place
+    PartialEvalReport PartiallyEvaluate(CodeBlock &root, Arena &arena, const EvalBudget &budget);
+}
@@ -0,0 +1,47 @@
+#include "pgo.hpp"
+
+#include <fstream>
+#include <stdexcept>
+
+namespace pgo {
+    Profile Read(const std::string &path) {
+        std::ifstream in(path);
+        if (!in) {
+            throw std::runtime_error("Can't open the profile " + path);
+        }
+        Profile profile;
+        std::string magic, version, hashKey, runsKey, countKey;
+        std::size_t count = 0;
+        in >> magic >> version >> hashKey >> std::hex >> profile.hash >> std::dec >> runsKey >> profile.runs >>
+           countKey >> count;
+        if (!in || magic != "lol-profile" || version != "1" || hashKey != "hash" || runsKey != "runs" ||
+            countKey != "counters") {
+            throw std::runtime_error(path + " is not a profile written by a program compiled with --pgo-gen");
+        }
+        profile.counters.resize(count);
+        for (std::uint64_t &counter: profile.counters) {
+            in >> counter;
+        }
+        if (!in) {
+            throw std::runtime_error("The profile " + path + " is truncated");
+        }
+        return profile;
+    }
+
+    std::uint64_t MixSite(std::uint64_t hash, char kind, unsigned depth, unsigned line, std::uint64_t statements) {
+        // FNV-1a over the kind and the bytes of the numbers
+        auto mix = [&hash](std::uint64_t byte) {
+            hash = (hash ^ byte) * 1099511628211ull;
+        };
+        auto mixWord = [&mix](std::uint64_t word) {
+            for (unsigned i = 0; i < 8; ++i) {
+                mix((word >> (8 * i)) & 0xff);
+            }
+        };
+        mix(std::uint64_t(kind));
+        mixWord(depth);
+        mixWord(line);
+        mixWord(statements);
+        return hash;
+    }
+}
@@ -0,0 +1,41 @@
+/*
+    Profile-guided optimization of --pgo-gen / --pgo-use
+
+    Every if and while of the program is a branch site, numbered in the order codegen emits them. A program
+    compiled with --pgo-gen=<file> counts for each site how often its condition was evaluated and how often it
+    was true, and at the end of main adds the counts to <file> (lol_profile_write of runtime/lolrt.h), so
+    several runs accumulate. Compiling with --pgo-use=<file> turns the counts into branch weights, the entry
+    count of main and the profile summary of the module, which the block layout, unrolling and inlining
+    heuristics of the optimizer take into account.
+
+    The file is text:
+        lol-profile 1
+        hash <hex>        kind, nesting, line and size of the body of every site; a profile of a changed program is
+                          rejected
+        runs <n>
+        counters <2 * sites>
+        <one count per line: evaluated, true for site 0, then for site 1, ...>
+*/
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace pgo {
+    struct Profile {
+        std::uint64_t hash = 0;
+        std::uint64_t runs = 0;
+        std::vector<std::uint64_t> counters;
+    };
+
+    // throws if the file can't be read or is not a profile
+    Profile Read(const std::string &path);
+
+    // the hash of a program without branch sites
+    constexpr std::uint64_t kEmptyHash = 14695981039346656037ull;
+
+    // the hash of the sites so far followed by one more: kind 'I' (if) or 'W' (while) at nesting depth, on line,
+    // with statements statements in its body (both branches of an if)
+    std::uint64_t MixSite(std::uint64_t hash, char kind, unsigned depth, unsigned line, std::uint64_t statements);
+}
@@ -0,0 +1,473 @@
+#include "server.hpp"
+
+#include "node.hpp"
+#include "codegen.hpp"
+#include "parsing_context.hpp"
+#include "fold.hpp"
+#include "peval.hpp"
+#include "trace.hpp"
+
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+    sockaddr_un Address(const std::string &path) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            throw std::runtime_error("Socket path is too long: " + path);
+        }
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        return addr;
+    }
+
+    std::string SystemError(const std::string &what) {
+        return what + ": " + std::strerror(errno);
+    }
+
+    // buffered reading and writing of one connection, false/exceptions when the other side is gone
+    class Stream {
+    public:
+        explicit Stream(int fd_) : fd(fd_) {}
+
+        bool readLine(std::string &line) {
+            std::size_t eol;
+            while ((eol = buffered.find('\n')) == std::string::npos) {
+                if (!fill()) {
+                    return false;
+                }
+            }
+            line = buffered.substr(0, eol);
+            buffered.erase(0, eol + 1);
+            return true;
+        }
+
+        bool read(std::size_t size, std::string &data) {
+            while (buffered.size() < size) {
+                if (!fill()) {
+                    return false;
+                }
+            }
+            data = buffered.substr(0, size);
+            buffered.erase(0, size);
+            return true;
+        }
+
+        void write(const std::string &data) {
+            for (std::size_t written = 0; written < data.size();) {
+                ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    throw std::runtime_error(SystemError("Can't write to the socket"));
+                }
+                written += n;
+            }
+        }
+
+    private:
+        int fd;
+        std::string buffered;
+
+        bool fill() {
+            char chunk[1 << 16];
+            ssize_t n;
+            do {
+                n = ::read(fd, chunk, sizeof(chunk));
+            } while (n < 0 && errno == EINTR);
+            if (n <= 0) {
+                return false;
+            }
+            buffered.append(chunk, n);
+            return true;
+        }
+    };
+
+    bool IsSize(const std::string &word) {
+        return !word.empty() && word.size() <= 18 && word.find_first_not_of("0123456789") == std::string::npos;
+    }
+
+    std::vector<std::string> Words(const std::string &line) {
+        std::istringstream words(line);
+        std::vector<std::string> result;
+        for (std::string word; words >> word;) {
+            result.push_back(word);
+        }
+        return result;
+    }
+
+    // what a program printed and how it ended
+    struct RunResult {
+        std::string output, errors;
+        int status = 0; // the exit code, 128 + the signal if the program was killed
+    };
+
+    // reads both pipes until the other side closes them, at the same time so neither of them fills up
+    void Drain(int outFd, int errFd, RunResult &result) {
+        pollfd fds[2] = {{outFd, POLLIN, 0}, {errFd, POLLIN, 0}};
+        std::string *targets[2] = {&result.output, &result.errors};
+        for (int open = 2; open > 0;) {
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error(SystemError("Can't read the output of the program"));
+            }
+            for (int i = 0; i < 2; ++i) {
+                if (fds[i].fd < 0 || !fds[i].revents) {
+                    continue;
+                }
+                char chunk[1 << 16];
+                ssize_t n = ::read(fds[i].fd, chunk, sizeof(chunk));
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    fds[i].fd = -1;
+                    --open;
+                    continue;
+                }
+                targets[i]->append(chunk, n);
+            }
+        }
+    }
+
+    // runs main in a child process with its stdout and stderr going to pipes: a program that exits on an error of
+    // the runtime or is killed by a signal ends only the child
+    RunResult RunInChild(int (*program)()) {
+        int out[2], err[2];
+        if (pipe(out) != 0) {
+            throw std::runtime_error(SystemError("Can't create a pipe for the output of the program"));
+        }
+        if (pipe(err) != 0) {
+            std::string error = SystemError("Can't create a pipe for the output of the program");
+            close(out[0]);
+            close(out[1]);
+            throw std::runtime_error(error);
+        }
+        std::fflush(stdout);
+        std::fflush(stderr);
+        pid_t child = fork();
+        if (child == 0) {
+            dup2(out[1], STDOUT_FILENO);
+            dup2(err[1], STDERR_FILENO);
+            for (int fd: {out[0], out[1], err[0], err[1]}) {
+                close(fd);
+            }
+            int ret = program();
+            std::fflush(stdout);
+            std::fflush(stderr);
+            _exit(ret);
+        }
+        int forkErrno = errno;
+        close(out[1]);
+        close(err[1]);
+        RunResult result;
+        try {
+            if (child < 0) {
+                errno = forkErrno;
+                throw std::runtime_error(SystemError("Can't start the program"));
+            }
+            Drain(out[0], err[0], result);
+        } catch (...) {
+            close(out[0]);
+            close(err[0]);
+            if (child > 0) {
+                kill(child, SIGKILL);
+                waitpid(child, nullptr, 0);
+            }
+            throw;
+        }
+        close(out[0]);
+        close(err[0]);
+
+        int status;
+        while (waitpid(child, &status, 0) < 0) {
+            if (errno != EINTR) {
+                throw std::runtime_error(SystemError("Can't wait for the program"));
+            }
+        }
+        result.status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+        return result;
+    }
+
+    class Server {
+    public:
+        explicit Server(const options::CompilerOptions &opts) : path(opts.serve), jit(codegen::CreateHostJIT()) {}
+
+        void listen();
+
+        void run();
+
+    private:
+        std::string path;
+        int listener = -1;
+        std::unique_ptr<llvm::orc::LLJIT> jit;
+        std::mutex runMutex; // one program runs at a time, all of them define main in the same JITDylib
+
+        std::atomic<bool> stopping{false};
+        std::mutex connectionsMutex;
+        std::set<int> connections; // open ones, woken up on shutdown
+        std::condition_variable allClosed;
+
+        void serveConnection(int fd);
+
+        // the answer, errors of the program are thrown
+        std::string handle(const std::string &command, const options::CompilerOptions &opts,
+                           const std::string &source);
+
+        void stop();
+    };
+
+    void Server::listen() {
+        sockaddr_un addr = Address(path);
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0) {
+            throw std::runtime_error(SystemError("Can't create a socket"));
+        }
+        // a socket file nobody listens on is left by a server that was killed
+        if (connect(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0) {
+            close(listener);
+            throw std::runtime_error("A server is already listening on " + path);
+        }
+        close(listener);
+
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(path.c_str());
+        if (listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+            ::listen(listener, SOMAXCONN) != 0) {
+            throw std::runtime_error(SystemError("Can't listen on " + path));
+        }
+        TRACE(Server, Info) << "Listening on " << path;
+    }
+
+    void Server::run() {
+        while (!stopping) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                if (stopping) {
+                    break;
+                }
+                throw std::runtime_error(SystemError("Can't accept a connection"));
+            }
+            {
+                std::lock_guard<std::mutex> lock(connectionsMutex);
+                connections.insert(fd);
+                if (stopping) {
+                    shutdown(fd, SHUT_RD); // accepted while stop() was waking up the others
+                }
+            }
+            std::thread(&Server::serveConnection, this, fd).detach();
+        }
+        {
+            std::unique_lock<std::mutex> lock(connectionsMutex);
+            allClosed.wait(lock, [this]() { return connections.empty(); });
+        }
+        close(listener);
+        unlink(path.c_str());
+        TRACE(Server, Info) << "Stopped";
+    }
+
+    void Server::stop() {
+        stopping = true;
+        shutdown(listener, SHUT_RDWR); // wakes up accept
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        for (int fd: connections) {
+            shutdown(fd, SHUT_RD); // the connection ends after its current request
+        }
+    }
+
+    void Server::serveConnection(int fd) {
+        Stream stream(fd);
+        std::string header;
+        try {
+            while (stream.readLine(header)) {
+                std::vector<std::string> request = Words(header);
+                if (request.size() == 1 && request[0] == "shutdown") {
+                    TRACE(Server, Info) << "Shutdown requested";
+                    stream.write("ok 0\n");
+                    stop();
+                    break;
+                }
+                if (request.size() < 2 || !IsSize(request.back())) {
+                    std::string error = "Malformed request: " + header;
+                    stream.write("error " + std::to_string(error.size()) + "\n" + error);
+                    break;
+                }
+                std::string source;
+                if (!stream.read(std::stoull(request.back()), source)) {
+                    break;
+                }
+
+                std::string answer;
+                try {
+                    options::CompilerOptions opts;
+                    for (std::size_t i = 1; i + 1 < request.size(); ++i) {
+                        if (!options::ParseCodeGenOption(request[i], opts)) {
+                            throw std::runtime_error("Unknown option " + request[i]);
+                        }
+                    }
+                    answer = handle(request[0], opts, source);
+                } catch (std::exception &e) {
+                    answer = "error " + std::to_string(std::strlen(e.what())) + "\n" + e.what();
+                }
+                TRACE(Server, Info) << "[" << fd << "] " << header << ": " << answer.substr(0, answer.find(' '));
+                stream.write(answer);
+            }
+        } catch (std::exception &e) {
+            TRACE(Server, Info) << "[" << fd << "] " << e.what();
+        }
+        close(fd);
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        connections.erase(fd);
+        allClosed.notify_all();
+    }
+
+    std::string Server::handle(const std::string &command, const options::CompilerOptions &opts,
+                               const std::string &source) {
+        if (command != "check" && command != "compile" && command != "run") {
+            throw std::runtime_error("Unknown command " + command + " (expected check, compile, run or shutdown)");
+        }
+
+        parsingcontext::ParsingContext parsing;
+        codegen::CodeGenContext codegen;
+        codegen.astBlock = parsingcontext::ParseSource(source, parsing);
+        if (opts.fold) {
+            AST::FoldConstants(*codegen.astBlock, parsing.arena);
+        }
+        if (opts.peval) {
+            AST::EvalBudget budget;
+            budget.fuel = opts.pevalFuel;
+            budget.memory = opts.pevalMemory;
+            AST::PartiallyEvaluate(*codegen.astBlock, parsing.arena, budget);
+        }
+        if (command == "check") {
+            return "ok 0\n";
+        }
+
+        codegen.useFlatAst = opts.flatAst;
+        codegen.parallelThreads = opts.threads;
+        codegen.parallelGrain = opts.grain;
+        codegen.initTarget(opts.cpu, opts.features);
+        codegen.generateCode();
+        codegen.optimize(opts.optLevel);
+        if (command == "compile") {
+            std::ostringstream ir;
+            codegen.dumpCode(ir);
+            return "ok " + std::to_string(ir.str().size()) + "\n" + ir.str();
+        }
+
+        RunResult result;
+        std::lock_guard<std::mutex> lock(runMutex);
+        codegen.runIn(*jit, [&](int (*program)()) {
+            result = RunInChild(program);
+            return result.status;
+        });
+        return "exit " + std::to_string(result.status) + " " + std::to_string(result.output.size()) + " " +
+               std::to_string(result.errors.size()) + "\n" + result.output + result.errors;
+    }
+
+    std::string ReadFile(const std::string &fname) {
+        std::ifstream in(fname, std::ios_base::binary);
+        if (!in) {
+            throw std::runtime_error("Can't open " + fname);
+        }
+        std::ostringstream contents;
+        contents << in.rdbuf();
+        return contents.str();
+    }
+}
+
+namespace server {
+    int Serve(const options::CompilerOptions &opts) {
+        std::signal(SIGPIPE, SIG_IGN); // a client that went away is an error of write, not the end of the server
+        Server server(opts);
+        server.listen();
+        server.run();
+        return 0;
+    }
+
+    int Connect(const options::CompilerOptions &opts) {
+        const std::vector<std::string> &request = opts.request;
+        std::string message = request[0];
+        if (request[0] != "shutdown") {
+            for (std::size_t i = 1; i + 1 < request.size(); ++i) {
+                message += " " + request[i];
+            }
+            std::string source = ReadFile(request.back());
+            message += " " + std::to_string(source.size()) + "\n" + source;
+        } else {
+            message += "\n";
+        }
+
+        sockaddr_un addr = Address(opts.connect);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+            std::string error = SystemError("Can't connect to " + opts.connect);
+            if (fd >= 0) {
+                close(fd);
+            }
+            throw std::runtime_error(error);
+        }
+
+        Stream stream(fd);
+        std::string header, payload, errors;
+        try {
+            stream.write(message);
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+        bool answered = stream.readLine(header);
+        std::vector<std::string> answer = Words(header);
+        bool exited = answer.size() == 4 && answer[0] == "exit" && IsSize(answer[1]) && IsSize(answer[2]) &&
+                      IsSize(answer[3]);
+        if (exited) {
+            answered = answered && stream.read(std::stoull(answer[2]), payload) &&
+                       stream.read(std::stoull(answer[3]), errors);
+        } else {
+            answered = answered && answer.size() == 2 && IsSize(answer[1]) &&
+                       stream.read(std::stoull(answer[1]), payload);
+        }
+        close(fd);
+        if (!answered) {
+            throw std::runtime_error("The server closed the connection");
+        }
+
+        if (exited) {
+            std::cout << payload << std::flush;
+            std::cerr << errors << std::flush;
+            return std::stoi(answer[1]);
+        }
+        if (answer[0] == "ok") {
+            std::cout << payload << std::flush;
+            return 0;
+        }
+        std::cout << payload << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,31 @@
+/*
+    Compile server of --serve and its client, --connect
+
+    The server keeps LLVM and a JIT initialized between requests, so editors and batch tools don't pay for the start
+    of the compiler on every file. Clients connect to a Unix socket, a connection may carry any number of requests,
+    each of them is answered before the next one is read.
+
+    Request: <command> [options] <size>\n<size bytes of the program>
+        check    parse and fold, the payload of the answer is empty
+        compile  also generate and optimize (-O<level>, --mcpu, ... as on the command line), the payload is the IR
+        run      also run main on the JIT of the server
+        shutdown (no size and no program) stops the server
+    Answer: ok <size>\n<payload> or error <size>\n<diagnostic>, and for run
+            exit <code> <size> <size of stderr>\n<what the program printed><what it printed to stderr>
+    where code is the exit code of the program, 128 + the signal if it was killed.
+
+    Connections are served on their own threads in parallel, but programs run one at a time. Each of them runs in a
+    child process of the server, so an array error of the runtime or a division by zero only ends the child.
+*/
+#pragma once
+
+#include "options.hpp"
+
+namespace server {
+    // serves opts.serve until a shutdown request; returns the exit code of the compiler, throws if it can't listen
+    int Serve(const options::CompilerOptions &opts);
+
+    // sends opts.request to the server on opts.connect and prints the answer to stdout like the compiler would;
+    // returns the exit code of the compiler
+    int Connect(const options::CompilerOptions &opts);
+}
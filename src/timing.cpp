@@ -0,0 +1,159 @@
+#include "timing.hpp"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <iomanip>
+
+namespace {
+    double CpuSeconds() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+               (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    }
+
+    long PeakRssKiB() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss; // KiB on Linux
+    }
+
+    double Seconds(std::chrono::steady_clock::duration d) {
+        return std::chrono::duration<double>(d).count();
+    }
+
+    std::string Quoted(const std::string &s) {
+        std::string result = "\"";
+        for (char c: s) {
+            if (c == '"' || c == '\\') {
+                result += '\\';
+            }
+            result += c;
+        }
+        return result + "\"";
+    }
+
+    constexpr std::size_t kPassesShown = 20;
+}
+
+namespace timing {
+    TimeReport::Phase::Phase(TimeReport *report_, std::string name_) : report(report_), name(std::move(name_)) {
+        if (report) {
+            wallStart = std::chrono::steady_clock::now();
+            cpuStart = CpuSeconds();
+        }
+    }
+
+    TimeReport::Phase::~Phase() {
+        if (report) {
+            double wall = Seconds(std::chrono::steady_clock::now() - wallStart);
+            report->phases.push_back({std::move(name), wall, CpuSeconds() - cpuStart, PeakRssKiB()});
+        }
+    }
+
+    TimeReport::Phase TimeReport::phase(std::string name) {
+        return Phase(enabled ? this : nullptr, std::move(name));
+    }
+
+    void TimeReport::count(const std::string &name, std::uint64_t value) {
+        if (enabled) {
+            counts[name] += value;
+        }
+    }
+
+    void TimeReport::instrument(llvm::PassInstrumentationCallbacks &pic) {
+        if (!enabled) {
+            return;
+        }
+        pic.registerBeforeNonSkippedPassCallback([this](llvm::StringRef name, llvm::Any) {
+            passStarted(name);
+        });
+        pic.registerAfterPassCallback([this](llvm::StringRef, llvm::Any, const llvm::PreservedAnalyses &) {
+            passFinished();
+        });
+        pic.registerAfterPassInvalidatedCallback([this](llvm::StringRef, const llvm::PreservedAnalyses &) {
+            passFinished();
+        });
+    }
+
+    void TimeReport::passStarted(llvm::StringRef name) {
+        auto now = std::chrono::steady_clock::now();
+        if (!passStack.empty()) {
+            passes[passStack.back().name] += Seconds(now - passStack.back().start);
+        }
+        passStack.push_back({name.str(), now});
+    }
+
+    void TimeReport::passFinished() {
+        if (passStack.empty()) {
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        passes[passStack.back().name] += Seconds(now - passStack.back().start);
+        passStack.pop_back();
+        if (!passStack.empty()) {
+            passStack.back().start = now;
+        }
+    }
+
+    void TimeReport::print(std::ostream &out, bool json) const {
+        if (!enabled) {
+            return;
+        }
+        std::vector<std::pair<std::string, double>> slowest(passes.begin(), passes.end());
+        std::sort(slowest.begin(), slowest.end(), [](auto &l, auto &r) { return l.second > r.second; });
+
+        if (json) {
+            out << "{\"file\": " << Quoted(file) << ", \"phases\": [";
+            for (std::size_t i = 0; i < phases.size(); ++i) {
+                const PhaseTimes &p = phases[i];
+                out << (i ? ", " : "") << "{\"name\": " << Quoted(p.name) << ", \"wall\": " << p.wall
+                    << ", \"cpu\": " << p.cpu << ", \"peakRssKiB\": " << p.peakRssKiB << "}";
+            }
+            out << "], \"counts\": {";
+            bool first = true;
+            for (auto &[name, value]: counts) {
+                out << (first ? "" : ", ") << Quoted(name) << ": " << value;
+                first = false;
+            }
+            out << "}, \"passes\": {";
+            for (std::size_t i = 0; i < slowest.size(); ++i) {
+                out << (i ? ", " : "") << Quoted(slowest[i].first) << ": " << slowest[i].second;
+            }
+            out << "}}" << std::endl;
+            return;
+        }
+
+        std::ios::fmtflags flags = out.flags();
+        out << "===== Time report: " << file << " =====\n"
+            << std::left << std::setw(16) << "phase" << std::right << std::setw(12) << "wall ms"
+            << std::setw(12) << "cpu ms" << std::setw(16) << "peak RSS KiB" << "\n" << std::fixed
+            << std::setprecision(3);
+        double wallTotal = 0, cpuTotal = 0;
+        for (const PhaseTimes &p: phases) {
+            out << std::left << std::setw(16) << p.name << std::right << std::setw(12) << p.wall * 1e3
+                << std::setw(12) << p.cpu * 1e3 << std::setw(16) << p.peakRssKiB << "\n";
+            wallTotal += p.wall;
+            cpuTotal += p.cpu;
+        }
+        out << std::left << std::setw(16) << "total" << std::right << std::setw(12) << wallTotal * 1e3
+            << std::setw(12) << cpuTotal * 1e3 << "\n";
+
+        if (!counts.empty()) {
+            out << "counts:\n";
+            for (auto &[name, value]: counts) {
+                out << "    " << std::left << std::setw(28) << name << std::right << std::setw(12) << value << "\n";
+            }
+        }
+        if (!slowest.empty()) {
+            out << "slowest passes (exclusive wall ms):\n";
+            for (std::size_t i = 0; i < std::min(kPassesShown, slowest.size()); ++i) {
+                out << "    " << std::left << std::setw(40) << slowest[i].first << std::right << std::setw(12)
+                    << slowest[i].second * 1e3 << "\n";
+            }
+        }
+        out.flags(flags);
+        out << std::flush;
+    }
+}
@@ -0,0 +1,87 @@
+/*
+    Phase timing and memory report of --time-report
+
+    Every phase of the compilation of one file is measured with a TimeReport::Phase guard: wall time,
+    CPU time of the process and its peak RSS at the end of the phase. Arbitrary counters (tokens, AST nodes,
+    IR size) and the time of every LLVM pass of the optimizer are collected next to the phases.
+    A disabled report measures nothing.
+*/
+#pragma once
+
+#include <llvm/IR/PassInstrumentation.h>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace timing {
+    class TimeReport {
+    public:
+        class Phase {
+        public:
+            Phase(const Phase &) = delete;
+
+            Phase &operator=(const Phase &) = delete;
+
+            ~Phase();
+
+        private:
+            friend class TimeReport;
+
+            Phase(TimeReport *report_, std::string name_);
+
+            TimeReport *report; // nullptr if the report is disabled
+            std::string name;
+            std::chrono::steady_clock::time_point wallStart;
+            double cpuStart = 0;
+        };
+
+        TimeReport(std::string file_, bool enabled_) : file(std::move(file_)), enabled(enabled_) {}
+
+        TimeReport(const TimeReport &) = delete;
+
+        TimeReport &operator=(const TimeReport &) = delete;
+
+        bool isEnabled() const {
+            return enabled;
+        }
+
+        // measures until the returned guard is destroyed
+        [[nodiscard]] Phase phase(std::string name);
+
+        void count(const std::string &name, std::uint64_t value);
+
+        // times every pass run with these callbacks, exclusive of the passes nested in it
+        void instrument(llvm::PassInstrumentationCallbacks &pic);
+
+        // json is one object per line, so reports of several files can be appended to one file
+        void print(std::ostream &out, bool json) const;
+
+    private:
+        struct PhaseTimes {
+            std::string name;
+            double wall; // seconds
+            double cpu; // seconds, all threads of the process
+            long peakRssKiB;
+        };
+
+        struct RunningPass {
+            std::string name;
+            std::chrono::steady_clock::time_point start;
+        };
+
+        std::string file;
+        bool enabled;
+        std::vector<PhaseTimes> phases;
+        std::map<std::string, std::uint64_t> counts;
+        std::map<std::string, double> passes; // seconds
+        std::vector<RunningPass> passStack;
+
+        void passStarted(llvm::StringRef name);
+
+        void passFinished();
+    };
+}
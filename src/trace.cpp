@@ -0,0 +1,60 @@
+#include "trace.hpp"
+
+#include <cstdio>
+#include <stdexcept>
+
+namespace {
+    const char *const kCategoryNames[] = {"lexer", "parser", "ast", "codegen", "jit", "server"};
+
+    static_assert(sizeof(kCategoryNames) / sizeof(kCategoryNames[0]) == unsigned(trace::Category::Count_),
+                  "every category needs a name");
+
+    trace::Level ParseLevel(const std::string &name) {
+        if (name == "off" || name == "0") {
+            return trace::Level::Off;
+        }
+        if (name == "info" || name == "1") {
+            return trace::Level::Info;
+        }
+        if (name == "debug" || name == "2") {
+            return trace::Level::Debug;
+        }
+        throw std::runtime_error("Unknown trace level " + name + " (expected off, info or debug)");
+    }
+}
+
+namespace trace {
+    Level levels[unsigned(Category::Count_)] = {};
+
+    void Configure(const std::string &spec) {
+        std::stringstream ss(spec);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            std::size_t eq = item.find('=');
+            std::string name = item.substr(0, eq);
+            Level level = eq == std::string::npos ? Level::Info : ParseLevel(item.substr(eq + 1));
+
+            bool known = false;
+            for (unsigned c = 0; c < unsigned(Category::Count_); ++c) {
+                if (name == "all" || name == kCategoryNames[c]) {
+                    levels[c] = level;
+                    known = true;
+                }
+            }
+            if (!known) {
+                throw std::runtime_error("Unknown trace category " + name +
+                                         " (expected lexer, parser, ast, codegen, jit, server or all)");
+            }
+        }
+    }
+
+    Line::Line(Category category) {
+        buffer << '[' << kCategoryNames[unsigned(category)] << "] ";
+    }
+
+    Line::~Line() {
+        buffer << '\n';
+        std::string line = buffer.str();
+        std::fwrite(line.data(), 1, line.size(), stderr);
+    }
+}
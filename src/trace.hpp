@@ -0,0 +1,64 @@
+/*
+    Diagnostic tracing of the compiler
+
+    TRACE(Category, Level) << ...; writes one line to stderr when the level of category is at least level.
+    Levels are chosen at run time with --trace=<category>[=<level>],... (all categories are off by default),
+    the arguments of a disabled TRACE are not evaluated. Building with -DLOL_TRACE=0 (make TRACE=0)
+    removes all the tracing code from the compiler.
+*/
+#pragma once
+
+#include <sstream>
+#include <string>
+
+#ifndef LOL_TRACE
+#define LOL_TRACE 1
+#endif
+
+namespace trace {
+    enum class Category : unsigned {
+        Lexer,
+        Parser,
+        Ast,
+        Codegen,
+        Jit,
+        Server,
+        Count_
+    };
+
+    enum class Level : unsigned {
+        Off,
+        Info,  // phases and summaries
+        Debug, // every token, grammar action, node
+    };
+
+    extern Level levels[unsigned(Category::Count_)];
+
+    inline bool Enabled(Category category, Level level) {
+        return LOL_TRACE && levels[unsigned(category)] >= level;
+    }
+
+    // "codegen,parser=debug,all=info"; a category without a level gets Info, throws on unknown names
+    void Configure(const std::string &spec);
+
+    // buffers one line and writes it at once, so lines of parallel compilations don't mix
+    class Line {
+    public:
+        explicit Line(Category category);
+
+        ~Line();
+
+        template<class T>
+        Line &operator<<(const T &value) {
+            buffer << value;
+            return *this;
+        }
+
+    private:
+        std::ostringstream buffer;
+    };
+}
+
+#define TRACE(category, level) \
+    if (!::trace::Enabled(::trace::Category::category, ::trace::Level::level)) {} \
+    else ::trace::Line(::trace::Category::category)
@@ -0,0 +1,700 @@
+#include "vm.hpp"
+
+#include "codegen.hpp"
+#include "fold.hpp"
+#include "trace.hpp"
+
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/IR/Constants.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace vm {
+    namespace {
+        class Compiler {
+        public:
+            explicit Compiler(Program &program_) : program(program_) {}
+
+            void compile(AST::CodeBlock &root) {
+                collect(root);
+                top = program.registers = std::uint32_t(program.variables.size());
+                block(root);
+                emit(Op::Halt);
+            }
+
+        private:
+            Program &program;
+            static constexpr std::uint32_t kNoRegister = std::numeric_limits<std::uint32_t>::max();
+
+            std::vector<std::uint32_t> registerOf; // by Identifier::slot
+            std::unordered_map<std::string, std::uint32_t> stringOf;
+            std::uint32_t top = 0; // first free temporary
+
+            // gives every variable its register before any temporary is allocated
+            void collect(AST::CodeBlock &b) {
+                for (AST::Statement *st: b.statements) {
+                    if (auto *decl = dynamic_cast<AST::VarDecl *>(st)) {
+                        collect(decl->ident);
+                        collect(decl->expr);
+                    } else if (auto *assign = dynamic_cast<AST::VarAssign *>(st)) {
+                        collect(assign->ident);
+                        collect(assign->expr);
+                    } else if (auto *print = dynamic_cast<AST::PrintStatement *>(st)) {
+                        collect(print->e);
+                    } else if (auto *assign = dynamic_cast<AST::IndexAssign *>(st)) {
+                        collect(assign->ident);
+                        collect(assign->index);
+                        collect(assign->expr);
+                    } else if (auto *call = dynamic_cast<AST::ProcedureCall *>(st)) {
+                        collect(call->target);
+                        collect(call->value);
+                    } else if (auto *loop = dynamic_cast<AST::WhileLoop *>(st)) {
+                        collect(loop->expr);
+                        collect(*loop->code_block);
+                    } else if (auto *loop = dynamic_cast<AST::ParallelFor *>(st)) {
+                        collect(loop->index);
+                        collect(loop->begin);
+                        collect(loop->end);
+                        collect(*loop->body);
+                    } else if (auto *ifSt = dynamic_cast<AST::IfStatement *>(st)) {
+                        collect(ifSt->expr);
+                        collect(*ifSt->on_if);
+                        if (ifSt->on_else) {
+                            collect(*ifSt->on_else);
+                        }
+                    }
+                }
+            }
+
+            void collect(AST::Expression *e) {
+                if (auto *ident = dynamic_cast<AST::Identifier *>(e)) {
+                    if (ident->slot >= registerOf.size()) {
+                        registerOf.resize(ident->slot + 1, kNoRegister);
+                    }
+                    if (registerOf[ident->slot] == kNoRegister) {
+                        registerOf[ident->slot] = std::uint32_t(program.variables.size());
+                        program.variables.push_back(ident);
+                    }
+                } else if (auto *op = dynamic_cast<AST::UnaryOp *>(e)) {
+                    collect(op->expr);
+                } else if (auto *op = dynamic_cast<AST::BinaryOp *>(e)) {
+                    collect(op->lhs);
+                    collect(op->rhs);
+                } else if (auto *call = dynamic_cast<AST::Call *>(e)) {
+                    for (AST::Expression *arg: call->args) {
+                        collect(arg);
+                    }
+                } else if (auto *array = dynamic_cast<AST::NewArray *>(e)) {
+                    collect(array->length);
+                } else if (auto *literal = dynamic_cast<AST::ArrayLiteral *>(e)) {
+                    for (AST::Expression *element: literal->elements) {
+                        collect(element);
+                    }
+                } else if (auto *index = dynamic_cast<AST::Index *>(e)) {
+                    collect(index->array);
+                    collect(index->index);
+                }
+            }
+
+            std::size_t emit(Op op, std::uint32_t a = 0, std::uint32_t b = 0, std::uint32_t c = 0) {
+                program.code.push_back({op, a, b, c});
+                return program.code.size() - 1;
+            }
+
+            std::uint32_t here() const {
+                return std::uint32_t(program.code.size());
+            }
+
+            std::uint32_t temporary() {
+                std::uint32_t r = top++;
+                program.registers = std::max(program.registers, top);
+                return r;
+            }
+
+            // the temporaries taken before the block stay live in it
+            void block(AST::CodeBlock &b) {
+                std::uint32_t base = top;
+                for (AST::Statement *st: b.statements) {
+                    statement(st);
+                    top = base;
+                }
+            }
+
+            void statement(AST::Statement *st) {
+                if (auto *decl = dynamic_cast<AST::VarDecl *>(st)) {
+                    expression(decl->expr, registerOf[decl->ident->slot]);
+                } else if (auto *assign = dynamic_cast<AST::VarAssign *>(st)) {
+                    expression(assign->expr, registerOf[assign->ident->slot]);
+                } else if (auto *print = dynamic_cast<AST::PrintStatement *>(st)) {
+                    std::uint32_t r = operand(print->e);
+                    switch (print->e->type) {
+                        case AST::DataType::Int:
+                            emit(Op::PrintInt, r);
+                            break;
+                        case AST::DataType::Bool:
+                            emit(Op::PrintBool, r);
+                            break;
+                        case AST::DataType::IntArray:
+                            emit(Op::PrintInts, r);
+                            break;
+                        case AST::DataType::BoolArray:
+                            emit(Op::PrintBools, r);
+                            break;
+                        default:
+                            emit(Op::PrintStr, r);
+                            break;
+                    }
+                } else if (auto *assign = dynamic_cast<AST::IndexAssign *>(st)) {
+                    std::uint32_t index = operand(assign->index);
+                    std::uint32_t value = operand(assign->expr);
+                    emit(assign->ident->type == AST::DataType::IntArray ? Op::SetInt : Op::SetBool,
+                         registerOf[assign->ident->slot], index, value);
+                } else if (auto *call = dynamic_cast<AST::ProcedureCall *>(st)) {
+                    std::uint32_t target = operand(call->target);
+                    std::uint32_t value = operand(call->value);
+                    Op op = call->proc == AST::Procedure::Copy ? Op::Copy :
+                            call->target->type == AST::DataType::IntArray ? Op::FillInt : Op::FillBool;
+                    emit(op, target, value, call->target->type == AST::DataType::IntArray ? 4 : 1);
+                } else if (auto *loop = dynamic_cast<AST::WhileLoop *>(st)) {
+                    auto id = std::uint32_t(program.loops.size());
+                    program.loops.push_back(loop);
+                    std::size_t head = emit(Op::LoopHead, id);
+                    std::size_t exit = emit(Op::JumpIfFalse, operand(loop->expr));
+                    top = std::uint32_t(program.variables.size());
+                    block(*loop->code_block);
+                    emit(Op::Jump, std::uint32_t(head));
+                    program.code[head].b = program.code[exit].b = here();
+                } else if (auto *loop = dynamic_cast<AST::ParallelFor *>(st)) {
+                    // the iterations run in order, which is one of the orders allowed (see AST::ParallelFor)
+                    std::uint32_t index = registerOf[loop->index->slot];
+                    std::uint32_t begin = operand(loop->begin);
+                    std::uint32_t end = temporary();
+                    expression(loop->end, end);
+                    std::uint32_t one = temporary();
+                    emit(Op::LoadInt, one, 1);
+                    emit(Op::Move, index, begin);
+                    std::uint32_t cond = temporary();
+                    std::uint32_t head = here();
+                    emit(Op::Les, cond, index, end);
+                    std::size_t exit = emit(Op::JumpIfFalse, cond);
+                    block(*loop->body);
+                    emit(Op::Add, index, index, one);
+                    emit(Op::Jump, head);
+                    program.code[exit].b = here();
+                } else if (auto *ifSt = dynamic_cast<AST::IfStatement *>(st)) {
+                    std::size_t toElse = emit(Op::JumpIfFalse, operand(ifSt->expr));
+                    top = std::uint32_t(program.variables.size());
+                    block(*ifSt->on_if);
+                    if (ifSt->on_else) {
+                        std::size_t toEnd = emit(Op::Jump);
+                        program.code[toElse].b = here();
+                        block(*ifSt->on_else);
+                        program.code[toEnd].a = here();
+                    } else {
+                        program.code[toElse].b = here();
+                    }
+                } else if (!dynamic_cast<AST::Skip *>(st)) {
+                    throw std::runtime_error("[internal error] Unknown statement in bytecode compiler");
+                }
+            }
+
+            // register holding the value of e: the one of the variable, or a new temporary
+            std::uint32_t operand(AST::Expression *e) {
+                if (auto *ident = dynamic_cast<AST::Identifier *>(e)) {
+                    return registerOf[ident->slot];
+                }
+                std::uint32_t r = temporary();
+                expression(e, r);
+                return r;
+            }
+
+            // only the last instruction writes dst, after it has read its operands
+            void expression(AST::Expression *e, std::uint32_t dst) {
+                if (auto *c = dynamic_cast<AST::ConstantInt *>(e)) {
+                    emit(Op::LoadInt, dst, std::uint32_t(c->val));
+                } else if (auto *c = dynamic_cast<AST::ConstantBool *>(e)) {
+                    emit(Op::LoadBool, dst, c->val);
+                } else if (auto *c = dynamic_cast<AST::ConstantString *>(e)) {
+                    auto iter = stringOf.find(c->val);
+                    if (iter == stringOf.end()) {
+                        iter = stringOf.emplace(c->val, std::uint32_t(program.strings.size())).first;
+                        program.strings.push_back(c->val);
+                        const std::string &text = program.strings.back();
+                        program.constants.push_back({text.data(), text.size(), nullptr});
+                    }
+                    emit(Op::LoadStr, dst, iter->second);
+                } else if (auto *ident = dynamic_cast<AST::Identifier *>(e)) {
+                    std::uint32_t r = registerOf[ident->slot];
+                    if (r != dst) {
+                        emit(Op::Move, dst, r);
+                    }
+                } else if (auto *op = dynamic_cast<AST::UnaryOp *>(e)) {
+                    std::uint32_t saved = top;
+                    std::uint32_t r = operand(op->expr);
+                    emit(op->op == AST::UnaryOpType::Minus ? Op::Neg : Op::Not, dst, r);
+                    top = saved;
+                } else if (auto *op = dynamic_cast<AST::BinaryOp *>(e)) {
+                    std::uint32_t saved = top;
+                    std::uint32_t l = operand(op->lhs);
+                    std::uint32_t r = operand(op->rhs);
+                    if (op->type == AST::DataType::IntArray) {
+                        if (op->lhs->type == AST::DataType::Int && op->op != AST::BinaryOpType::Sub) {
+                            std::swap(l, r); // x + a is a + x, the same for *
+                        }
+                        emit(elementwise(op->op, op->lhs->type, op->rhs->type), dst, l, r);
+                    } else {
+                        emit(binary(op->op, op->lhs->type), dst, l, r);
+                    }
+                    top = saved;
+                } else if (auto *call = dynamic_cast<AST::Call *>(e)) {
+                    std::uint32_t saved = top;
+                    std::uint32_t args[2] = {};
+                    for (std::size_t i = 0; i < call->args.size(); ++i) {
+                        args[i] = operand(call->args[i]);
+                    }
+                    bool reduction = call->args.size() == 1 && call->fn != AST::Builtin::Abs;
+                    emit(reduction ? reduce(call->fn) : builtin(call->fn), dst, args[0], args[1]);
+                    top = saved;
+                } else if (auto *array = dynamic_cast<AST::NewArray *>(e)) {
+                    std::uint32_t saved = top;
+                    std::uint32_t length = operand(array->length);
+                    emit(Op::NewArray, dst, length, array->type == AST::DataType::IntArray ? 4 : 1);
+                    top = saved;
+                } else if (auto *literal = dynamic_cast<AST::ArrayLiteral *>(e)) {
+                    // built in a temporary, the elements may read the old value of dst
+                    std::uint32_t saved = top;
+                    std::uint32_t array = temporary();
+                    std::uint32_t length = temporary();
+                    emit(Op::LoadInt, length, std::uint32_t(literal->elements.size()));
+                    emit(Op::NewArray, array, length, literal->type == AST::DataType::IntArray ? 4 : 1);
+                    Op init = literal->type == AST::DataType::IntArray ? Op::InitInt : Op::InitBool;
+                    for (std::size_t i = 0; i < literal->elements.size(); ++i) {
+                        std::uint32_t elementSaved = top;
+                        emit(init, array, std::uint32_t(i), operand(literal->elements[i]));
+                        top = elementSaved;
+                    }
+                    emit(Op::Move, dst, array);
+                    top = saved;
+                } else if (auto *index = dynamic_cast<AST::Index *>(e)) {
+                    std::uint32_t saved = top;
+                    std::uint32_t array = operand(index->array);
+                    std::uint32_t i = operand(index->index);
+                    emit(index->type == AST::DataType::Int ? Op::GetInt : Op::GetBool, dst, array, i);
+                    top = saved;
+                } else {
+                    throw std::runtime_error("[internal error] Unknown expression in bytecode compiler");
+                }
+            }
+
+            static Op builtin(AST::Builtin fn) {
+                switch (fn) {
+                    case AST::Builtin::Abs:
+                        return Op::Abs;
+                    case AST::Builtin::Min:
+                        return Op::Min;
+                    case AST::Builtin::Max:
+                        return Op::Max;
+                    case AST::Builtin::Pow:
+                        return Op::Pow;
+                }
+                throw std::runtime_error("Unknown builtin!");
+            }
+
+            // len and the reductions of one array
+            static Op reduce(AST::Builtin fn) {
+                switch (fn) {
+                    case AST::Builtin::Len:
+                        return Op::Len;
+                    case AST::Builtin::Sum:
+                        return Op::SumArr;
+                    case AST::Builtin::Min:
+                        return Op::MinArr;
+                    case AST::Builtin::Max:
+                        return Op::MaxArr;
+                    default:
+                        throw std::runtime_error("Unknown reduction!");
+                }
+            }
+
+            // Int[] op Int[], Int[] op Int or Int op Int[]; the Int operand of + and * is passed in c
+            static Op elementwise(AST::BinaryOpType op, AST::DataType lhsType, AST::DataType rhsType) {
+                bool lhsArray = lhsType == AST::DataType::IntArray, rhsArray = rhsType == AST::DataType::IntArray;
+                if (lhsArray && rhsArray) {
+                    return op == AST::BinaryOpType::Sum ? Op::AddArr : op == AST::BinaryOpType::Sub ? Op::SubArr : Op::MulArr;
+                }
+                if (op == AST::BinaryOpType::Sub) {
+                    return lhsArray ? Op::SubArrInt : Op::SubIntArr;
+                }
+                return op == AST::BinaryOpType::Sum ? Op::AddArrInt : Op::MulArrInt;
+            }
+
+            static Op binary(AST::BinaryOpType op, AST::DataType operandsType) {
+                switch (op) {
+                    case AST::BinaryOpType::Pow:
+                        return Op::Pow;
+                    case AST::BinaryOpType::Mult:
+                        return Op::Mul;
+                    case AST::BinaryOpType::Div:
+                        return Op::Div;
+                    case AST::BinaryOpType::Sum:
+                        return operandsType == AST::DataType::String ? Op::Concat : Op::Add;
+                    case AST::BinaryOpType::Sub:
+                        return Op::Sub;
+                    case AST::BinaryOpType::Leq:
+                        return Op::Leq;
+                    case AST::BinaryOpType::Les:
+                        return Op::Les;
+                    case AST::BinaryOpType::Geq:
+                        return Op::Geq;
+                    case AST::BinaryOpType::Gre:
+                        return Op::Gre;
+                    case AST::BinaryOpType::Eq:
+                        return operandsType == AST::DataType::Int ? Op::EqInt :
+                               operandsType == AST::DataType::Bool ? Op::EqBool : Op::EqStr;
+                    case AST::BinaryOpType::Neq:
+                        return operandsType == AST::DataType::Int ? Op::NeqInt :
+                               operandsType == AST::DataType::Bool ? Op::NeqBool : Op::NeqStr;
+                    case AST::BinaryOpType::And:
+                        return Op::And;
+                    case AST::BinaryOpType::Or:
+                        return Op::Or;
+                }
+                throw std::runtime_error("Unknown bin op!");
+            }
+        };
+
+        using codegen::unwrap;
+
+        using NativeLoop = void (*)(Slot *);
+
+        std::int32_t *Ints(const lol_array *a) {
+            return static_cast<std::int32_t *>(a->data);
+        }
+
+        std::uint8_t *Bools(const lol_array *a) {
+            return static_cast<std::uint8_t *>(a->data);
+        }
+
+        // the bounds check of the generated code: one unsigned comparison
+        std::size_t Checked(const lol_array *a, std::int32_t index) {
+            if (std::uint32_t(index) >= a->length) {
+                lol_array_index_error(index, a->length);
+            }
+            return std::size_t(index);
+        }
+
+        // a new Int[] of f(i) for every index of a, Int wraps around
+        template<class F>
+        const lol_array *Map(const lol_array *a, F f) {
+            const lol_array *result = lol_array_new(std::int64_t(a->length), sizeof(std::int32_t));
+            std::int32_t *out = Ints(result);
+            for (std::size_t i = 0; i < a->length; ++i) {
+                out[i] = std::int32_t(f(i));
+            }
+            return result;
+        }
+
+        const lol_array *SameLength(const lol_array *a, const lol_array *b) {
+            if (a->length != b->length) {
+                lol_array_length_error(a->length, b->length);
+            }
+            return a;
+        }
+
+        class Machine {
+        public:
+            Machine(Program &program_, const RunOptions &opts_)
+                    : program(program_), opts(opts_), regs(program_.registers), counters(program_.loops.size()),
+                      natives(program_.loops.size()) {
+                for (Slot &r: regs) {
+                    r.raw = 0;
+                }
+            }
+
+            int run() {
+                Instr *code = program.code.data();
+                Slot *r = regs.data();
+                std::size_t pc = 0;
+                for (;;) {
+                    Instr &in = code[pc++];
+                    switch (in.op) {
+                        case Op::LoadInt:
+                            r[in.a].i = std::int32_t(in.b);
+                            break;
+                        case Op::LoadBool:
+                            r[in.a].b = in.b != 0;
+                            break;
+                        case Op::LoadStr:
+                            r[in.a].s = &program.constants[in.b];
+                            break;
+                        case Op::Move:
+                            r[in.a] = r[in.b];
+                            break;
+                        case Op::Neg:
+                            r[in.a].i = std::int32_t(0u - std::uint32_t(r[in.b].i));
+                            break;
+                        case Op::Not:
+                            r[in.a].b = !r[in.b].b;
+                            break;
+                        case Op::Add:
+                            r[in.a].i = std::int32_t(std::uint32_t(r[in.b].i) + std::uint32_t(r[in.c].i));
+                            break;
+                        case Op::Sub:
+                            r[in.a].i = std::int32_t(std::uint32_t(r[in.b].i) - std::uint32_t(r[in.c].i));
+                            break;
+                        case Op::Mul:
+                            r[in.a].i = std::int32_t(std::uint32_t(r[in.b].i) * std::uint32_t(r[in.c].i));
+                            break;
+                        case Op::Pow:
+                            r[in.a].i = AST::eval::Pow(r[in.b].i, r[in.c].i);
+                            break;
+                        case Op::Abs:
+                            r[in.a].i = r[in.b].i < 0 ? std::int32_t(0u - std::uint32_t(r[in.b].i)) : r[in.b].i;
+                            break;
+                        case Op::Min:
+                            r[in.a].i = std::min(r[in.b].i, r[in.c].i);
+                            break;
+                        case Op::Max:
+                            r[in.a].i = std::max(r[in.b].i, r[in.c].i);
+                            break;
+                        case Op::Div:
+                            // 0 and INT_MIN / -1 end the program with an error instead of SIGFPE
+                            if (r[in.c].i == 0 ||
+                                (r[in.c].i == -1 && r[in.b].i == std::numeric_limits<std::int32_t>::min())) {
+                                lol_division_error(r[in.b].i, r[in.c].i);
+                            }
+                            r[in.a].i = r[in.b].i / r[in.c].i;
+                            break;
+                        case Op::Les:
+                            r[in.a].b = r[in.b].i < r[in.c].i;
+                            break;
+                        case Op::Leq:
+                            r[in.a].b = r[in.b].i <= r[in.c].i;
+                            break;
+                        case Op::Gre:
+                            r[in.a].b = r[in.b].i > r[in.c].i;
+                            break;
+                        case Op::Geq:
+                            r[in.a].b = r[in.b].i >= r[in.c].i;
+                            break;
+                        case Op::EqInt:
+                            r[in.a].b = r[in.b].i == r[in.c].i;
+                            break;
+                        case Op::NeqInt:
+                            r[in.a].b = r[in.b].i != r[in.c].i;
+                            break;
+                        case Op::EqBool:
+                            r[in.a].b = r[in.b].b == r[in.c].b;
+                            break;
+                        case Op::NeqBool:
+                            r[in.a].b = r[in.b].b != r[in.c].b;
+                            break;
+                        case Op::EqStr:
+                            r[in.a].b = lol_string_equal(r[in.b].s, r[in.c].s);
+                            break;
+                        case Op::NeqStr:
+                            r[in.a].b = !lol_string_equal(r[in.b].s, r[in.c].s);
+                            break;
+                        case Op::Concat:
+                            r[in.a].s = lol_string_concat(r[in.b].s, r[in.c].s);
+                            break;
+                        case Op::NewArray:
+                            r[in.a].arr = lol_array_new(r[in.b].i, in.c);
+                            break;
+                        case Op::InitInt:
+                            Ints(r[in.a].arr)[in.b] = r[in.c].i;
+                            break;
+                        case Op::InitBool:
+                            Bools(r[in.a].arr)[in.b] = r[in.c].b;
+                            break;
+                        case Op::GetInt:
+                            r[in.a].i = Ints(r[in.b].arr)[Checked(r[in.b].arr, r[in.c].i)];
+                            break;
+                        case Op::GetBool:
+                            r[in.a].b = Bools(r[in.b].arr)[Checked(r[in.b].arr, r[in.c].i)] != 0;
+                            break;
+                        case Op::SetInt:
+                            Ints(r[in.a].arr)[Checked(r[in.a].arr, r[in.b].i)] = r[in.c].i;
+                            break;
+                        case Op::SetBool:
+                            Bools(r[in.a].arr)[Checked(r[in.a].arr, r[in.b].i)] = r[in.c].b;
+                            break;
+                        case Op::Len:
+                            r[in.a].i = std::int32_t(r[in.b].arr->length);
+                            break;
+                        case Op::SumArr: {
+                            std::uint32_t sum = 0;
+                            const std::int32_t *data = Ints(r[in.b].arr);
+                            for (std::size_t i = 0; i < r[in.b].arr->length; ++i) {
+                                sum += std::uint32_t(data[i]);
+                            }
+                            r[in.a].i = std::int32_t(sum);
+                            break;
+                        }
+                        case Op::MinArr: {
+                            const std::int32_t *data = Ints(r[in.b].arr);
+                            r[in.a].i = std::accumulate(data, data + r[in.b].arr->length,
+                                                        std::numeric_limits<std::int32_t>::max(),
+                                                        [](std::int32_t x, std::int32_t y) { return std::min(x, y); });
+                            break;
+                        }
+                        case Op::MaxArr: {
+                            const std::int32_t *data = Ints(r[in.b].arr);
+                            r[in.a].i = std::accumulate(data, data + r[in.b].arr->length,
+                                                        std::numeric_limits<std::int32_t>::min(),
+                                                        [](std::int32_t x, std::int32_t y) { return std::max(x, y); });
+                            break;
+                        }
+                        case Op::AddArr: {
+                            const std::int32_t *x = Ints(SameLength(r[in.b].arr, r[in.c].arr)), *y = Ints(r[in.c].arr);
+                            r[in.a].arr = Map(r[in.b].arr, [&](std::size_t i) { return std::uint32_t(x[i]) + std::uint32_t(y[i]); });
+                            break;
+                        }
+                        case Op::SubArr: {
+                            const std::int32_t *x = Ints(SameLength(r[in.b].arr, r[in.c].arr)), *y = Ints(r[in.c].arr);
+                            r[in.a].arr = Map(r[in.b].arr, [&](std::size_t i) { return std::uint32_t(x[i]) - std::uint32_t(y[i]); });
+                            break;
+                        }
+                        case Op::MulArr: {
+                            const std::int32_t *x = Ints(SameLength(r[in.b].arr, r[in.c].arr)), *y = Ints(r[in.c].arr);
+                            r[in.a].arr = Map(r[in.b].arr, [&](std::size_t i) { return std::uint32_t(x[i]) * std::uint32_t(y[i]); });
+                            break;
+                        }
+                        case Op::AddArrInt: {
+                            const std::int32_t *x = Ints(r[in.b].arr);
+                            auto y = std::uint32_t(r[in.c].i);
+                            r[in.a].arr = Map(r[in.b].arr, [&](std::size_t i) { return std::uint32_t(x[i]) + y; });
+                            break;
+                        }
+                        case Op::SubArrInt: {
+                            const std::int32_t *x = Ints(r[in.b].arr);
+                            auto y = std::uint32_t(r[in.c].i);
+                            r[in.a].arr = Map(r[in.b].arr, [&](std::size_t i) { return std::uint32_t(x[i]) - y; });
+                            break;
+                        }
+                        case Op::SubIntArr: {
+                            auto x = std::uint32_t(r[in.b].i);
+                            const std::int32_t *y = Ints(r[in.c].arr);
+                            r[in.a].arr = Map(r[in.c].arr, [&](std::size_t i) { return x - std::uint32_t(y[i]); });
+                            break;
+                        }
+                        case Op::MulArrInt: {
+                            const std::int32_t *x = Ints(r[in.b].arr);
+                            auto y = std::uint32_t(r[in.c].i);
+                            r[in.a].arr = Map(r[in.b].arr, [&](std::size_t i) { return std::uint32_t(x[i]) * y; });
+                            break;
+                        }
+                        case Op::FillInt:
+                            std::fill_n(Ints(r[in.a].arr), r[in.a].arr->length, r[in.b].i);
+                            break;
+                        case Op::FillBool:
+                            std::memset(r[in.a].arr->data, r[in.b].b, r[in.a].arr->length);
+                            break;
+                        case Op::Copy: {
+                            const lol_array *dst = SameLength(r[in.a].arr, r[in.b].arr);
+                            std::memmove(dst->data, r[in.b].arr->data, dst->length * in.c);
+                            break;
+                        }
+                        case Op::And:
+                            r[in.a].b = r[in.b].b && r[in.c].b;
+                            break;
+                        case Op::Or:
+                            r[in.a].b = r[in.b].b || r[in.c].b;
+                            break;
+                        case Op::Jump:
+                            pc = in.a;
+                            break;
+                        case Op::JumpIfFalse:
+                            if (!r[in.a].b) {
+                                pc = in.b;
+                            }
+                            break;
+                        case Op::LoopHead:
+                            if (opts.jitThreshold == 0 || ++counters[in.a] < opts.jitThreshold) {
+                                break;
+                            }
+                            promote(in.a);
+                            in.op = Op::Native;
+                            [[fallthrough]];
+                        case Op::Native:
+                            natives[in.a](r);
+                            pc = in.b;
+                            break;
+                        case Op::PrintInt:
+                            lol_print_int(r[in.a].i);
+                            break;
+                        case Op::PrintBool:
+                            lol_print_bool(r[in.a].b);
+                            break;
+                        case Op::PrintStr:
+                            lol_print_string(r[in.a].s);
+                            break;
+                        case Op::PrintInts:
+                            lol_print_int_array(r[in.a].arr);
+                            break;
+                        case Op::PrintBools:
+                            lol_print_bool_array(r[in.a].arr);
+                            break;
+                        case Op::Halt:
+                            return 0;
+                    }
+                }
+            }
+
+        private:
+            Program &program;
+            const RunOptions &opts;
+            std::vector<Slot> regs;
+            std::vector<unsigned> counters; // times the head of every loop was reached
+            std::vector<NativeLoop> natives;
+            std::unique_ptr<llvm::orc::LLJIT> jit; // created by the first promotion
+
+            void promote(std::uint32_t loop) {
+                TRACE(Jit, Info) << "Promoting loop " << loop << " after " << counters[loop] << " iterations";
+                if (!jit) {
+                    jit = codegen::CreateHostJIT();
+                }
+
+                std::string name = "lol_loop_" + std::to_string(loop);
+                codegen::CodeGenContext codegen;
+                codegen.initTarget(opts.cpu, opts.features);
+                codegen.parallelThreads = opts.threads;
+                codegen.parallelGrain = opts.grain;
+
+                // string constants are the descriptors of the interpreter, native code and bytecode share the values
+                llvm::Type *i64 = llvm::Type::getInt64Ty(codegen.llvmCtx);
+                llvm::Type *i8ptr = llvm::Type::getInt8PtrTy(codegen.llvmCtx);
+                for (std::size_t i = 0; i < program.strings.size(); ++i) {
+                    codegen.stringPool[program.strings[i]] = llvm::ConstantExpr::getIntToPtr(
+                            llvm::ConstantInt::get(i64, reinterpret_cast<std::uintptr_t>(&program.constants[i])), i8ptr);
+                }
+
+                codegen.generateLoop(name, *program.loops[loop], program.variables);
+                codegen.optimize(opts.optLevel);
+
+                unwrap(jit->addIRModule(llvm::orc::ThreadSafeModule(std::move(codegen.module), codegen.tsCtx)));
+                natives[loop] = reinterpret_cast<NativeLoop>(unwrap(jit->lookup(name)).getAddress());
+            }
+        };
+    }
+
+    Program Compile(AST::CodeBlock &root) {
+        Program program;
+        Compiler(program).compile(root);
+        return program;
+    }
+
+    int Run(Program &program, const RunOptions &opts) {
+        int result = Machine(program, opts).run();
+        lol_finish();
+        return result;
+    }
+}
@@ -0,0 +1,122 @@
+/*
+    Bytecode interpreter tier of --exec=vm
+
+    The AST is compiled straight to a register-based bytecode and run without touching LLVM, so short
+    programs start immediately. Every variable owns one register, temporaries live above them.
+    A while loop whose head is reached jitThreshold times is handed to the LLVM codegen
+    (CodeGenContext::generateLoop) working on top of the register file, and from then on the loop
+    runs natively.
+*/
+#pragma once
+
+#include "node.hpp"
+#include "lolrt.h"
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace vm {
+    enum class Op : std::uint8_t {
+        LoadInt,     // a = int(b)
+        LoadBool,    // a = bool(b)
+        LoadStr,     // a = strings[b]
+        Move,        // a = b
+        Neg,         // a = -b
+        Not,         // a = !b
+        Add,         // a = b + c, Int wraps around like in the generated code
+        Sub,
+        Mul,
+        Div,         // the program ends with lol_division_error for a zero divisor and INT_MIN / -1
+        Pow,         // the semantics of the builtins of the runtime (builtins.hpp)
+        Abs,         // a = abs(b)
+        Min,
+        Max,
+        Les,         // a = b < c
+        Leq,
+        Gre,
+        Geq,
+        EqInt,
+        NeqInt,
+        EqBool,
+        NeqBool,
+        EqStr,       // strings are compared by contents
+        NeqStr,
+        Concat,      // a = b + c on strings
+        And,
+        Or,
+        NewArray,    // a = a new array of length b of c-byte elements
+        InitInt,     // a[b] = c, b is a constant index into a new array
+        InitBool,
+        GetInt,      // a = b[c], the program ends with lol_array_index_error for an index out of bounds
+        GetBool,
+        SetInt,      // a[b] = c
+        SetBool,
+        Len,         // a = len(b)
+        SumArr,      // a = sum(b) of an Int[]
+        MinArr,
+        MaxArr,
+        AddArr,      // a = b + c, elementwise on Int[] of the same length
+        SubArr,
+        MulArr,
+        AddArrInt,   // a = b + c, b is an Int[], c an Int
+        SubArrInt,
+        SubIntArr,   // a = b - c, b is an Int, c an Int[]
+        MulArrInt,
+        FillInt,     // fill(a, b)
+        FillBool,
+        Copy,        // copy(a, b) of arrays with c-byte elements
+        Jump,        // goto a
+        JumpIfFalse, // if (!a) goto b
+        LoopHead,    // head of loop a, b is the first instruction after the loop
+        Native,      // loop a was promoted: run its native code, then goto b
+        PrintInt,
+        PrintBool,
+        PrintStr,
+        PrintInts,
+        PrintBools,
+        Halt
+    };
+
+    struct Instr {
+        Op op;
+        std::uint32_t a; // destination register, if any
+        std::uint32_t b;
+        std::uint32_t c;
+    };
+
+    // one register, the same as one i64 slot of the functions made by CodeGenContext::generateLoop
+    union Slot {
+        std::int64_t raw;
+        std::int32_t i;
+        bool b;
+        const lol_string *s;
+        const lol_array *arr;
+    };
+
+    static_assert(sizeof(Slot) == sizeof(std::int64_t), "registers are passed to native code as i64*");
+
+    struct Program {
+        std::vector<Instr> code;
+        std::deque<std::string> strings; // text of the string constants, equal constants share one entry
+        std::deque<lol_string> constants; // constants[i] is the runtime value of strings[i]
+        std::vector<AST::Identifier *> variables; // variables[r] lives in register r
+        std::vector<AST::WhileLoop *> loops; // indexed by LoopHead::a
+        std::uint32_t registers = 0; // variables and temporaries
+    };
+
+    Program Compile(AST::CodeBlock &root);
+
+    struct RunOptions {
+        unsigned jitThreshold = 1000; // 0 disables the promotion of hot loops
+        unsigned optLevel = 2; // of the promoted loops
+        std::string cpu;
+        std::string features;
+        unsigned threads = 0; // of the parallel loops in the promoted ones, which the VM runs in order
+        std::uint64_t grain = 0;
+    };
+
+    // returns the exit code; promoted loops patch program.code in place
+    int Run(Program &program, const RunOptions &opts);
+}